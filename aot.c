@@ -0,0 +1,455 @@
+/* Compile scripts ahead of time to C source for linking into a host.
+ * usage: mujs-aot [-s] name file.js... > name.c
+ * with -s: compile as strict code, for states made with JS_STRICT
+ *
+ * Each function becomes a C function that runs its bytecode instruction by
+ * instruction, with the same inline fast paths and runtime helpers as the
+ * JIT in jsjit.c. The host calls js_aot_<name>(J) once, after which loading
+ * the same sources with js_loadstring runs the native code. The bytecode of
+ * each function is checksummed, so a script that has changed, or that was
+ * compiled by a different version of mujs, falls back to the interpreter.
+ */
+
+#include <stdio.h>
+
+#include "jsi.h"
+#include "jsparse.h"
+#include "jscompile.h"
+
+static const char *preamble =
+	"#include \"jsi.h\"\n"
+	"#include \"jscompile.h\"\n"
+	"#include \"jsvalue.h\"\n"
+	"#include \"jsrun.h\"\n"
+	"\n"
+	"#define STACK (J->stack)\n"
+	"#define TOP (J->top)\n"
+	"#define BOT (J->bot)\n"
+	"#define LT (J->frame[J->frametop-1].E->slots - 1)\n"
+	"#define OPS(k) (code + (k) + 1)\n"
+	"#define X STACK[TOP-2]\n"
+	"#define Y STACK[TOP-1]\n"
+	"#define ISINT(v) (JSV_TYPE(v) == JS_TINTEGER)\n"
+	"#define INTOPS() (ISINT(X) && ISINT(Y))\n"
+	"#define NUMOPS() (JSV_ISNUMBER(X) && JSV_ISNUMBER(Y))\n"
+	"#define CHECKSTACK(k) if (TOP + 1 >= J->stacksize) jsR_jitcheckstack(J, OPS(k))\n"
+	"#define SAFEPOINT(k) if (J->gccounter > JS_GCLIMIT) jsR_jitsafepoint(J, OPS(k))\n"
+	"#define STEP(k) jsR_jitstep(J, OPS(k))\n"
+	"#define BRANCH(k) jsR_jitbranch(J, OPS(k))\n"
+	"\n"
+	"#define INTARITH(k, op) \\\n"
+	"\tif (INTOPS()) { \\\n"
+	"\t\tint64_t r = (int64_t)JSV_INTEGER(X) op JSV_INTEGER(Y); \\\n"
+	"\t\tif (r >= INT_MIN && r <= INT_MAX) JSV_SETINTEGER(X, (int)r); else JSV_SETNUMBER(X, (double)r); \\\n"
+	"\t\t--TOP; \\\n"
+	"\t} else NUMARITH(k, op)\n"
+	"#define NUMARITH(k, op) \\\n"
+	"\tif (NUMOPS()) { \\\n"
+	"\t\tdouble r = JSV_ASNUMBER(X) op JSV_ASNUMBER(Y); \\\n"
+	"\t\tJSV_SETNUMBER(X, r); \\\n"
+	"\t\t--TOP; \\\n"
+	"\t} else STEP(k)\n"
+	"#define NUMCMP(op) (INTOPS() ? JSV_INTEGER(X) op JSV_INTEGER(Y) : JSV_ASNUMBER(X) op JSV_ASNUMBER(Y))\n"
+	"#define COMPARE(k, op) \\\n"
+	"\tif (NUMOPS()) { \\\n"
+	"\t\tint b = NUMCMP(op); \\\n"
+	"\t\tJSV_SETBOOLEAN(X, b); \\\n"
+	"\t\t--TOP; \\\n"
+	"\t} else STEP(k)\n"
+	"#define CMPJUMP(k, op, L) \\\n"
+	"\tif (NUMOPS()) { \\\n"
+	"\t\tint b = NUMCMP(op); \\\n"
+	"\t\tTOP -= 2; \\\n"
+	"\t\tif (!b) goto L; \\\n"
+	"\t} else if (BRANCH(k)) goto L\n"
+	"#define BOOLJUMP(k, want, L) \\\n"
+	"\tif (JSV_TYPE(Y) == JS_TBOOLEAN) { \\\n"
+	"\t\tint b = JSV_BOOLEAN(Y); \\\n"
+	"\t\t--TOP; \\\n"
+	"\t\tif (b == want) goto L; \\\n"
+	"\t} else if (BRANCH(k)) goto L\n"
+	"\n";
+
+/* The same restrictions as the JIT: handlers, eval and with need the interpreter */
+static int aotsupported(js_Function *F)
+{
+	int pc;
+	if (F->trylen > 0)
+		return 0;
+	for (pc = 0; pc < F->codelen; pc += jsC_oplength(F->code[pc])) {
+		switch (F->code[pc]) {
+		case OP_EVAL:
+		case OP_CATCH:
+		case OP_ENDCATCH:
+		case OP_WITH:
+		case OP_ENDWITH:
+		case OP_DEBUGGER:
+			return 0;
+		}
+	}
+	return 1;
+}
+
+static int isjump(int op)
+{
+	switch (op) {
+	case OP_JUMP:
+	case OP_JTRUE:
+	case OP_JFALSE:
+	case OP_JCASE:
+	case OP_LT_JFALSE:
+	case OP_GT_JFALSE:
+	case OP_LE_JFALSE:
+	case OP_GE_JFALSE:
+		return 1;
+	}
+	return 0;
+}
+
+static const char *cmpop(int op)
+{
+	switch (op) {
+	case OP_LT: case OP_LT_JFALSE: return "<";
+	case OP_GT: case OP_GT_JFALSE: return ">";
+	case OP_LE: case OP_LE_JFALSE: return "<=";
+	case OP_GE: case OP_GE_JFALSE: return ">=";
+	case OP_EQ: case OP_STRICTEQ: return "==";
+	default: return "!=";
+	}
+}
+
+static void aotinstruction(js_Function *F, int k)
+{
+	js_Instruction *pc = F->code + k + 1;
+	int op = jsC_genericop(F->code[k]);
+	js_SwitchTable *T;
+	int i, j;
+
+	if (isjump(op) && *pc <= k)
+		printf("\tSAFEPOINT(%d);\n", k);
+
+	switch (op) {
+	case OP_POP:
+		printf("\t--TOP;\n");
+		break;
+
+	case OP_DUP:
+		printf("\tCHECKSTACK(%d); STACK[TOP] = STACK[TOP-1]; ++TOP;\n", k);
+		break;
+
+	case OP_INTEGER:
+		printf("\tCHECKSTACK(%d); JSV_SETINTEGER(STACK[TOP], %d); ++TOP;\n", k, *pc - 32768);
+		break;
+	case OP_UNDEF:
+		printf("\tCHECKSTACK(%d); JSV_SETUNDEFINED(STACK[TOP]); ++TOP;\n", k);
+		break;
+	case OP_NULL:
+		printf("\tCHECKSTACK(%d); JSV_SETNULL(STACK[TOP]); ++TOP;\n", k);
+		break;
+	case OP_TRUE:
+	case OP_FALSE:
+		printf("\tCHECKSTACK(%d); JSV_SETBOOLEAN(STACK[TOP], %d); ++TOP;\n", k, op == OP_TRUE);
+		break;
+
+	case OP_GETLOCAL:
+		if (F->lightweight)
+			printf("\tCHECKSTACK(%d); STACK[TOP] = STACK[BOT + %d]; ++TOP;\n", k, *pc);
+		else if (F->flatenv)
+			printf("\tCHECKSTACK(%d); STACK[TOP] = LT[%d]; ++TOP;\n", k, *pc);
+		else
+			printf("\tjsR_jitlocal(J, OPS(%d));\n", k);
+		break;
+
+	case OP_SETLOCAL:
+		if (F->lightweight)
+			printf("\tSTACK[BOT + %d] = STACK[TOP-1];\n", *pc);
+		else if (F->flatenv)
+			printf("\tLT[%d] = STACK[TOP-1];\n", *pc);
+		else
+			printf("\tjsR_jitlocal(J, OPS(%d));\n", k);
+		break;
+
+	case OP_DELLOCAL:
+	case OP_ARGUMENTS:
+	case OP_GETARG:
+	case OP_ARGLEN:
+	case OP_GETUPVAL:
+	case OP_SETUPVAL:
+		printf("\tjsR_jitlocal(J, OPS(%d));\n", k);
+		break;
+
+	case OP_SETLOCAL_POP:
+		printf("\t--TOP; STACK[BOT + %d] = STACK[TOP];\n", *pc);
+		break;
+
+	case OP_INC_LOCAL:
+	case OP_DEC_LOCAL:
+		printf("\tif (ISINT(STACK[BOT + %d]) && JSV_INTEGER(STACK[BOT + %d]) != %s)\n",
+			*pc, *pc, op == OP_INC_LOCAL ? "INT_MAX" : "INT_MIN");
+		printf("\t\tJSV_SETINTEGER(STACK[BOT + %d], JSV_INTEGER(STACK[BOT + %d]) %s 1);\n",
+			*pc, *pc, op == OP_INC_LOCAL ? "+" : "-");
+		printf("\telse\n\t\tSTEP(%d);\n", k);
+		break;
+
+	case OP_ADD: printf("\tINTARITH(%d, +);\n", k); break;
+	case OP_SUB: printf("\tINTARITH(%d, -);\n", k); break;
+	case OP_MUL: printf("\tNUMARITH(%d, *);\n", k); break;
+	case OP_DIV: printf("\tNUMARITH(%d, /);\n", k); break;
+
+	case OP_ADD_INTEGER:
+		printf("\tif (ISINT(Y) && JSV_INTEGER(Y) %s (%d))\n", *pc >= 32768 ? "<= INT_MAX -" : ">= INT_MIN -", *pc - 32768);
+		printf("\t\tJSV_SETINTEGER(Y, JSV_INTEGER(Y) + %d);\n", *pc - 32768);
+		printf("\telse\n\t\tSTEP(%d);\n", k);
+		break;
+
+	case OP_LT:
+	case OP_GT:
+	case OP_LE:
+	case OP_GE:
+	case OP_EQ:
+	case OP_NE:
+	case OP_STRICTEQ:
+	case OP_STRICTNE:
+		printf("\tCOMPARE(%d, %s);\n", k, cmpop(op));
+		break;
+
+	case OP_LT_JFALSE:
+	case OP_GT_JFALSE:
+	case OP_LE_JFALSE:
+	case OP_GE_JFALSE:
+		printf("\tCMPJUMP(%d, %s, L%d);\n", k, cmpop(op), *pc);
+		break;
+
+	case OP_JUMP: printf("\tgoto L%d;\n", *pc); break;
+	case OP_JTRUE: printf("\tBOOLJUMP(%d, 1, L%d);\n", k, *pc); break;
+	case OP_JFALSE: printf("\tBOOLJUMP(%d, 0, L%d);\n", k, *pc); break;
+	case OP_JCASE: printf("\tif (BRANCH(%d)) goto L%d;\n", k, *pc); break;
+
+	case OP_SWITCH:
+		T = &F->switchtab[*pc];
+		printf("\tswitch (jsR_jitswitch(J, OPS(%d))) {\n", k);
+		for (i = 0; i < T->len; ++i) {
+			for (j = 0; j < i && T->jump[j] != T->jump[i]; ++j)
+				;
+			if (T->jump[i] >= 0 && j == i)
+				printf("\tcase %d: goto L%d;\n", T->jump[i], T->jump[i]);
+		}
+		printf("\t}\n");
+		break;
+
+	case OP_RETURN:
+		printf("\treturn;\n");
+		break;
+
+	case OP_GETPROP: printf("\tjsR_jitgetprop(J, OPS(%d));\n", k); break;
+	case OP_SETPROP: printf("\tjsR_jitsetprop(J, OPS(%d));\n", k); break;
+	case OP_GETPROP_S: printf("\tjsR_jitgetprop_s(J, OPS(%d));\n", k); break;
+	case OP_GETLOCAL_GETPROP_S: printf("\tjsR_jitgetprop_s(J, OPS(%d));\n", k); break;
+	case OP_SETPROP_S: printf("\tjsR_jitsetprop_s(J, OPS(%d));\n", k); break;
+	case OP_GETGLOBAL: printf("\tjsR_jitgetglobal(J, OPS(%d));\n", k); break;
+	case OP_SETGLOBAL: printf("\tjsR_jitsetglobal(J, OPS(%d));\n", k); break;
+	case OP_CALL: printf("\tjsR_jitcall(J, OPS(%d));\n", k); break;
+	case OP_NEW: printf("\tjsR_jitcall(J, OPS(%d));\n", k); break;
+
+	default:
+		printf("\tSTEP(%d);\n", k);
+		break;
+	}
+}
+
+static void aotfunction(js_State *J, const char *name, int n, js_Function *F)
+{
+	char *target;
+	int pc, op, i, backward = 0;
+
+	/* find the jump targets, and enter the code at the targets of backward jumps */
+	target = js_malloc(J, F->codelen);
+	memset(target, 0, F->codelen);
+	for (pc = 0; pc < F->codelen; pc += jsC_oplength(op)) {
+		op = F->code[pc];
+		if (isjump(op) && F->code[pc+1] <= pc) {
+			target[F->code[pc+1]] = 2;
+			backward = 1;
+		} else if (isjump(op) && !target[F->code[pc+1]]) {
+			target[F->code[pc+1]] = 1;
+		}
+	}
+	for (i = 0; i < F->switchlen; ++i)
+		for (pc = 0; pc < F->switchtab[i].len; ++pc)
+			if (F->switchtab[i].jump[pc] >= 0 && !target[F->switchtab[i].jump[pc]])
+				target[F->switchtab[i].jump[pc]] = 1;
+
+	printf("/* %s:%d: function %s */\n", F->filename, F->line, F->name[0] ? F->name : "(anonymous)");
+	printf("static void %s_%d(js_State *J, int pc)\n{\n", name, n);
+	printf("\tjs_Instruction *code = J->frame[J->frametop-1].F->code;\n");
+	if (backward) {
+		printf("\tswitch (pc) {\n");
+		for (pc = 0; pc < F->codelen; ++pc)
+			if (target[pc] == 2)
+				printf("\tcase %d: goto L%d;\n", pc, pc);
+		printf("\t}\n");
+	} else {
+		printf("\t(void)pc;\n");
+	}
+
+	for (pc = 0; pc < F->codelen; pc += jsC_oplength(op)) {
+		op = F->code[pc];
+		if (target[pc])
+			printf("L%d:\n", pc);
+		printf("\t/* %d: %s */\n", pc, jsC_opcodestring(op));
+		aotinstruction(F, pc);
+	}
+	printf("}\n\n");
+
+	js_free(J, target);
+}
+
+/* Number the functions in compile order, and emit the native code of those we can compile */
+static void aottree(js_State *J, const char *name, int *n, js_Function *F)
+{
+	int i;
+	if (aotsupported(F))
+		aotfunction(J, name, *n, F);
+	++*n;
+	for (i = 0; i < F->funlen; ++i)
+		aottree(J, name, n, F->funtab[i]);
+}
+
+static void aottable(js_State *J, const char *name, int *n, js_Function *F)
+{
+	int i;
+	printf("\t{ %d, 0x%08xu, ", F->codelen, jsC_checksum(F));
+	if (aotsupported(F))
+		printf("%s_%d },\n", name, *n);
+	else
+		printf("NULL },\n");
+	++*n;
+	for (i = 0; i < F->funlen; ++i)
+		aottable(J, name, n, F->funtab[i]);
+}
+
+static void aotscript(js_State *J, const char *name, int script, int *n, const char *filename, const char *source)
+{
+	js_Ast *P;
+	js_Function *F;
+	int first = *n, count;
+
+	if (js_try(J)) {
+		jsP_freeparse(J);
+		js_throw(J);
+	}
+	P = jsP_parse(J, filename, source);
+	F = jsC_compilescript(J, P, J->default_strict, 0);
+	jsP_freeparse(J);
+	js_endtry(J);
+
+	/* function numbers run on across the scripts, so their names are unique */
+	aottree(J, name, n, F);
+
+	printf("static const js_AotFunction %s_funs%d[] = {\n", name, script);
+	count = *n - first;
+	aottable(J, name, &first, F);
+	printf("};\n\n");
+	printf("static const js_AotScript %s_script%d = { %d, %s_funs%d };\n\n", name, script, count, name, script);
+}
+
+static void aotfile(js_State *J, const char *name, int script, int *nfun, const char *filename)
+{
+	FILE *f;
+	char *s;
+	int n, t;
+
+	f = fopen(filename, "rb");
+	if (!f) {
+		js_error(J, "cannot open file: '%s'", filename);
+	}
+
+	if (fseek(f, 0, SEEK_END) < 0) {
+		fclose(f);
+		js_error(J, "cannot seek in file: '%s'", filename);
+	}
+
+	n = ftell(f);
+	if (n < 0) {
+		fclose(f);
+		js_error(J, "cannot tell in file: '%s'", filename);
+	}
+
+	if (fseek(f, 0, SEEK_SET) < 0) {
+		fclose(f);
+		js_error(J, "cannot seek in file: '%s'", filename);
+	}
+
+	s = js_malloc(J, n + 1); /* add space for string terminator */
+	if (!s) {
+		fclose(f);
+		js_error(J, "cannot allocate storage for file contents: '%s'", filename);
+	}
+
+	t = fread(s, 1, (size_t)n, f);
+	if (t != n) {
+		js_free(J, s);
+		fclose(f);
+		js_error(J, "cannot read data from file: '%s'", filename);
+	}
+
+	s[n] = 0; /* zero-terminate string containing file data */
+
+	if (js_try(J)) {
+		js_free(J, s);
+		fclose(f);
+		js_throw(J);
+	}
+
+	aotscript(J, name, script, nfun, filename, s);
+
+	js_free(J, s);
+	fclose(f);
+	js_endtry(J);
+}
+
+int
+main(int argc, char **argv)
+{
+	js_State *J;
+	const char *name;
+	int strict = 0;
+	int i, first, nfun = 0;
+
+	i = 1;
+	if (i < argc && !strcmp(argv[i], "-s")) {
+		strict = 1;
+		++i;
+	}
+	if (i + 1 >= argc) {
+		fprintf(stderr, "usage: mujs-aot [-s] name file.js...\n");
+		return 1;
+	}
+	name = argv[i++];
+	first = i;
+
+	J = js_newstate(NULL, NULL, strict ? JS_STRICT : 0);
+
+	printf("/* Native code made by mujs-aot; do not edit. */\n\n");
+	printf("%s", preamble);
+
+	for (; i < argc; ++i) {
+		if (js_try(J)) {
+			js_report(J, js_trystring(J, -1, "Error"));
+			js_freestate(J);
+			return 1;
+		}
+		aotfile(J, name, i, &nfun, argv[i]);
+		js_endtry(J);
+	}
+
+	printf("void js_aot_%s(js_State *J)\n{\n", name);
+	for (i = first; i < argc; ++i)
+		printf("\tjs_registeraot(J, &%s_script%d);\n", name, i);
+	printf("}\n");
+
+	js_gc(J, 0);
+	js_freestate(J);
+
+	return 0;
+}
@@ -17,22 +17,46 @@ void js_setlength(js_State *J, int idx, int len)
 	js_setproperty(J, idx < 0 ? idx - 1 : idx, "length");
 }
 
+static js_Value *js_element(js_State *J, int idx, int i)
+{
+	return js_isobject(J, idx) ? jsV_getelement(js_toobject(J, idx), i) : NULL;
+}
+
 int js_hasindex(js_State *J, int idx, int i)
 {
 	char buf[32];
+	js_Value *v = js_element(J, idx, i);
+	if (v) {
+		js_pushvalue(J, *v);
+		return 1;
+	}
 	return js_hasproperty(J, idx, js_itoa(buf, i));
 }
 
 void js_getindex(js_State *J, int idx, int i)
 {
 	char buf[32];
-	js_getproperty(J, idx, js_itoa(buf, i));
+	js_Value *v = js_element(J, idx, i);
+	if (v)
+		js_pushvalue(J, *v);
+	else
+		js_getproperty(J, idx, js_itoa(buf, i));
 }
 
 void js_setindex(js_State *J, int idx, int i)
 {
 	char buf[32];
-	js_setproperty(J, idx, js_itoa(buf, i));
+	js_Value *v = js_element(J, idx, i);
+	if (v) {
+		js_Object *obj = js_toobject(J, idx);
+		if (obj->type == JS_CARRAY && i >= obj->u.a.length)
+			obj->u.a.length = i + 1;
+		JSG_BARRIER(J, obj, *js_tovalue(J, -1));
+		*v = *js_tovalue(J, -1);
+		js_pop(J, 1);
+	} else {
+		js_setproperty(J, idx, js_itoa(buf, i));
+	}
 }
 
 void js_delindex(js_State *J, int idx, int i)
@@ -261,8 +285,8 @@ static int sortcmp(const void *avoid, const void *bvoid)
 	const char *sx, *sy;
 	int c;
 
-	int unx = (a->type == JS_TUNDEFINED);
-	int uny = (b->type == JS_TUNDEFINED);
+	int unx = (JSV_TYPE(*a) == JS_TUNDEFINED);
+	int uny = (JSV_TYPE(*b) == JS_TUNDEFINED);
 	if (unx) return !uny;
 	if (uny) return -1;
 
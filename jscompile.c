@@ -11,9 +11,13 @@
 JS_NORETURN void jsC_error(js_State *J, js_Ast *node, const char *fmt, ...) JS_PRINTFLIKE(3,4);
 
 static void cfunbody(JF, js_Ast *name, js_Ast *params, js_Ast *body);
+static void peephole(JF);
+static void initcaches(JF);
+static int inlinable(JF);
 static void cexp(JF, js_Ast *exp);
 static void cstmlist(JF, js_Ast *list);
 static void cstm(JF, js_Ast *stm);
+static int isfun(enum js_AstType T);
 
 void jsC_error(js_State *J, js_Ast *node, const char *fmt, ...)
 {
@@ -51,22 +55,38 @@ static void checkfutureword(JF, js_Ast *exp)
 	}
 }
 
-static js_Function *newfun(js_State *J, int line, js_Ast *name, js_Ast *params, js_Ast *body, int script, int default_strict)
+static js_Function *newfun(js_State *J, js_Function *outer, int line, js_Ast *name, js_Ast *params, js_Ast *body, int script, int default_strict)
 {
 	js_Function *F = js_malloc(J, sizeof *F);
 	memset(F, 0, sizeof *F);
-	F->gcmark = J->gcmark;
 	F->gcnext = J->gcfun;
 	J->gcfun = F;
 	++J->gccounter;
 
 	F->filename = js_intern(J, J->filename);
 	F->line = line;
-	F->script = script;
+	F->script = script != 0;
+	F->dynamic = script == 2; /* eval code runs in the scope of its caller */
 	F->strict = default_strict;
 	F->name = name ? name->string : "";
+	F->outer = outer;
+	F->body = body;
 
 	cfunbody(J, F, name, params, body);
+	peephole(J, F);
+	initcaches(J, F);
+	F->inlinable = inlinable(J, F);
+
+	F->outer = NULL;
+	F->body = NULL;
+	if (F->lightweight)
+		F->flatenv = 0;
+	if (F->dynamic)
+		F->escapes = 1;
+
+	/* closures of F hold on to the scope of F, and so may arguments.callee */
+	if (outer && (F->escapes || F->arguments || F->argslot))
+		outer->escapes = 1;
 
 	return F;
 }
@@ -86,7 +106,15 @@ static void emitraw(JF, int value)
 
 static void emit(JF, int value)
 {
-	emitraw(J, F, F->lastline);
+	if (F->linelen == 0 || F->linetab[F->linelen-1].line != F->lastline) {
+		if (F->linelen >= F->linecap) {
+			F->linecap = F->linecap ? F->linecap * 2 : 16;
+			F->linetab = js_realloc(J, F->linetab, F->linecap * sizeof *F->linetab);
+		}
+		F->linetab[F->linelen].pc = F->codelen;
+		F->linetab[F->linelen].line = F->lastline;
+		++F->linelen;
+	}
 	emitraw(J, F, value);
 }
 
@@ -138,6 +166,16 @@ static int addstring(JF, const char *value)
 	return F->strlen++;
 }
 
+static int pushlocal(JF, const char *name)
+{
+	if (F->varlen >= F->varcap) {
+		F->varcap = F->varcap ? F->varcap * 2 : 16;
+		F->vartab = js_realloc(J, F->vartab, F->varcap * sizeof *F->vartab);
+	}
+	F->vartab[F->varlen] = name;
+	return ++F->varlen;
+}
+
 static int addlocal(JF, js_Ast *ident, int reuse)
 {
 	const char *name = ident->string;
@@ -161,12 +199,7 @@ static int addlocal(JF, js_Ast *ident, int reuse)
 			}
 		}
 	}
-	if (F->varlen >= F->varcap) {
-		F->varcap = F->varcap ? F->varcap * 2 : 16;
-		F->vartab = js_realloc(J, F->vartab, F->varcap * sizeof *F->vartab);
-	}
-	F->vartab[F->varlen] = name;
-	return ++F->varlen;
+	return pushlocal(J, F, name);
 }
 
 static int findlocal(JF, const char *name)
@@ -209,15 +242,97 @@ static void emitstring(JF, int opcode, const char *str)
 {
 	emit(J, F, opcode);
 	emitarg(J, F, addstring(J, F, str));
+	if (opcode == OP_GETVAR || opcode == OP_GETGLOBAL || opcode == OP_SETGLOBAL || opcode == OP_GETPROP_S || opcode == OP_SETPROP_S)
+		emitarg(J, F, 0); /* inline cache, numbered by initcaches */
+}
+
+/* Is exp the function of a call expression, so that its value is not kept? */
+static int iscallee(js_Ast *exp)
+{
+	return exp->parent && exp->parent->type == EXP_CALL && exp->parent->a == exp;
+}
+
+/* Is name declared by a function declaration in the body of fun? */
+static int isfundecname(js_Function *fun, const char *name)
+{
+	js_Ast *list = fun->body;
+	while (list) {
+		if (list->a->type == AST_FUNDEC && !strcmp(list->a->a->string, name))
+			return 1;
+		list = list->b;
+	}
+	return 0;
+}
+
+/*
+	A closure that is only ever called can not keep its scope alive past
+	the call. Any other use of a local holding a function declaration or
+	the function's own name lets the scope escape.
+*/
+static void markescape(js_Function *fun, js_Ast *ident)
+{
+	if (iscallee(ident))
+		return;
+	if (isfundecname(fun, ident->string))
+		fun->escapes = 1;
+	else if (!strcmp(fun->name, ident->string) && fun->outer)
+		fun->outer->escapes = 1;
+}
+
+/*
+	Resolve a name to a local of F or to a slot of an enclosing flat
+	environment. Returns the 1-based local index, with depth set to -1 for
+	locals of F and to the number of flat environments to skip otherwise.
+	Returns -1 when the name can only be a property of the global object.
+	Returns 0 when the name must be looked up at runtime: it is shadowed by
+	a catch or with scope, or an enclosing function uses eval or does not
+	keep its variables in slots.
+*/
+static int findscope(JF, js_Ast *ident, int *depth)
+{
+	const char *name = ident->string;
+	js_Function *fun = F;
+	js_Ast *node = ident, *prev;
+	int i, d = 0;
+
+	for (;;) {
+		for (prev = node, node = node->parent; node && !isfun(node->type); prev = node, node = node->parent) {
+			if (node->type == STM_WITH && prev == node->b)
+				return 0;
+			if (node->type == STM_TRY && prev == node->c && !strcmp(node->b->string, name))
+				return 0;
+		}
+		if (fun->script)
+			return fun->dynamic ? 0 : -1; /* variables of global code are global properties */
+		i = findlocal(J, fun, name);
+		if (i > 0) {
+			markescape(fun, ident);
+			if (fun == F) {
+				*depth = -1;
+				return i;
+			}
+			if (!fun->flatenv)
+				return 0;
+			*depth = d;
+			return i;
+		}
+		if (fun->dynamic)
+			return 0;
+		if (!fun->outer)
+			return -1; /* made by the Function constructor in the global scope */
+		if (fun != F && fun->flatenv)
+			++d;
+		fun = fun->outer;
+	}
 }
 
 static void emitlocal(JF, int oploc, int opvar, js_Ast *ident)
 {
 	int is_arguments = !strcmp(ident->string, "arguments");
 	int is_eval = !strcmp(ident->string, "eval");
-	int i;
+	int i, depth = -1;
 
-	if (is_arguments) {
+	if (is_arguments && F->dynamic) {
 		F->lightweight = 0;
 		F->arguments = 1;
 	}
@@ -232,15 +347,41 @@ static void emitlocal(JF, int oploc, int opvar, js_Ast *ident)
 	if (is_eval)
 		js_evalerror(J, "%s:%d: invalid use of 'eval'", J->filename, ident->line);
 
-	i = findlocal(J, F, ident->string);
-	if (i < 0) {
+	if (is_arguments && !F->argslot) {
+		i = findlocal(J, F, ident->string);
+		if (i < 0)
+			i = 0; /* the arguments object of F, looked up by name */
+	} else {
+		i = findscope(J, F, ident, &depth);
+	}
+	if (i < 0 && opvar == OP_GETVAR) {
+		emitstring(J, F, OP_GETGLOBAL, ident->string);
+	} else if (i < 0 && opvar == OP_SETVAR) {
+		emitstring(J, F, OP_SETGLOBAL, ident->string);
+	} else if (i <= 0 || (depth >= 0 && oploc == OP_DELLOCAL)) {
 		emitstring(J, F, opvar, ident->string);
+	} else if (F->argslot && i == F->argslot && depth < 0 && oploc == OP_GETLOCAL) {
+		emit(J, F, OP_ARGUMENTS);
+		emitarg(J, F, i);
+	} else if (depth >= 0) {
+		emit(J, F, oploc == OP_SETLOCAL ? OP_SETUPVAL : OP_GETUPVAL);
+		emitarg(J, F, depth);
+		emitarg(J, F, i);
 	} else {
 		emit(J, F, oploc);
 		emitarg(J, F, i);
 	}
 }
 
+/* Is exp a reference to the arguments object that F makes on demand? */
+static int isarguments(JF, js_Ast *exp)
+{
+	int depth = -1;
+	if (!F->argslot || exp->type != EXP_IDENTIFIER || strcmp(exp->string, "arguments"))
+		return 0;
+	return findscope(J, F, exp, &depth) == F->argslot && depth < 0;
+}
+
 static int here(JF)
 {
 	return F->codelen;
@@ -374,12 +515,14 @@ static void cobject(JF, js_Ast *list)
 			emit(J, F, OP_INITPROP);
 			break;
 		case EXP_PROP_GET:
-			emitfunction(J, F, newfun(J, prop->line, NULL, NULL, kv->c, 0, F->strict));
+			F->escapes = 1;
+			emitfunction(J, F, newfun(J, F, prop->line, NULL, NULL, kv->c, 0, F->strict));
 			emitline(J, F, kv);
 			emit(J, F, OP_INITGETTER);
 			break;
 		case EXP_PROP_SET:
-			emitfunction(J, F, newfun(J, prop->line, NULL, kv->b, kv->c, 0, F->strict));
+			F->escapes = 1;
+			emitfunction(J, F, newfun(J, F, prop->line, NULL, kv->b, kv->c, 0, F->strict));
 			emitline(J, F, kv);
 			emit(J, F, OP_INITSETTER);
 			break;
@@ -651,8 +794,10 @@ static void cexp(JF, js_Ast *exp)
 		break;
 
 	case EXP_FUN:
+		if (!iscallee(exp))
+			F->escapes = 1;
 		emitline(J, F, exp);
-		emitfunction(J, F, newfun(J, exp->line, exp->a, exp->b, exp->c, 0, F->strict));
+		emitfunction(J, F, newfun(J, F, exp->line, exp->a, exp->b, exp->c, 0, F->strict));
 		break;
 
 	case EXP_IDENTIFIER:
@@ -661,6 +806,13 @@ static void cexp(JF, js_Ast *exp)
 		break;
 
 	case EXP_INDEX:
+		if (isarguments(J, F, exp->a)) {
+			cexp(J, F, exp->b);
+			emitline(J, F, exp);
+			emit(J, F, OP_GETARG);
+			emitarg(J, F, F->argslot);
+			break;
+		}
 		cexp(J, F, exp->a);
 		cexp(J, F, exp->b);
 		emitline(J, F, exp);
@@ -668,6 +820,12 @@ static void cexp(JF, js_Ast *exp)
 		break;
 
 	case EXP_MEMBER:
+		if (isarguments(J, F, exp->a) && !strcmp(exp->b->string, "length")) {
+			emitline(J, F, exp);
+			emit(J, F, OP_ARGLEN);
+			emitarg(J, F, F->argslot);
+			break;
+		}
 		cexp(J, F, exp->a);
 		emitline(J, F, exp);
 		emitstring(J, F, OP_GETPROP_S, exp->b->string);
@@ -897,11 +1055,86 @@ static js_Ast *returntarget(JF, js_Ast *node)
 	return NULL;
 }
 
+/*
+ * Exception handler ranges. A try statement has no runtime cost until
+ * something throws: its block is covered by a range in the handler table,
+ * and the handler code is placed out of line. Abrupt exits close the range
+ * before running any finally blocks, and open a new one after the jump.
+ */
+
+/* Stack height at statement level, not counting the locals */
+static int stmheight(JF, js_Ast *node)
+{
+	int n = F->script + F->stackextra; /* completion value of scripts */
+	for (; node && !isfun(node->type); node = node->parent)
+		if (node->type == STM_FOR_IN || node->type == STM_FOR_IN_VAR)
+			++n; /* iterator */
+	return n;
+}
+
+/* Number of catch and with scopes around a statement */
+static int stmscope(js_Ast *node)
+{
+	js_Ast *prev;
+	int n = 0;
+	for (prev = node, node = node->parent; node && !isfun(node->type); prev = node, node = node->parent)
+		if ((node->type == STM_WITH && prev == node->b) || (node->type == STM_TRY && prev == node->c))
+			++n;
+	return n;
+}
+
+static js_TryRange *newrange(JF, js_Ast *stm)
+{
+	if (F->trylen >= F->trycap) {
+		F->trycap = F->trycap ? F->trycap * 2 : 4;
+		F->trytab = js_realloc(J, F->trytab, F->trycap * sizeof *F->trytab);
+	}
+	stm->tryrange = F->trylen;
+	return &F->trytab[F->trylen++];
+}
+
+/* Open the range of a try block or catch block; its handler is not known yet */
+static void beginrange(JF, js_Ast *stm)
+{
+	js_TryRange *r = newrange(J, F, stm);
+	r->start = F->codelen;
+	r->end = -1;
+	r->handler = -1 - stm->tryrange; /* tag shared by all pieces of the range */
+	r->height = stmheight(J, F, stm);
+	r->scope = stmscope(stm);
+}
+
+static void endrange(JF, js_Ast *stm)
+{
+	F->trytab[stm->tryrange].end = F->codelen;
+}
+
+static void resumerange(JF, js_Ast *stm)
+{
+	js_TryRange last = F->trytab[stm->tryrange];
+	js_TryRange *r = newrange(J, F, stm);
+	*r = last;
+	r->start = F->codelen;
+	r->end = -1;
+}
+
+/* The handler code of the range starts here */
+static void handlerange(JF, js_Ast *stm)
+{
+	int tag = F->trytab[stm->tryrange].handler;
+	int i;
+	for (i = -1 - tag; i < F->trylen; ++i)
+		if (F->trytab[i].handler == tag)
+			F->trytab[i].handler = F->codelen;
+}
+
 /* Emit code to rebalance stack and scopes during an abrupt exit */
 
 static void cexit(JF, enum js_AstType T, js_Ast *node, js_Ast *target)
 {
 	js_Ast *prev;
+	if (T == STM_RETURN)
+		++F->stackextra; /* return value */
 	do {
 		prev = node, node = node->parent;
 		switch (node->type) {
@@ -938,124 +1171,256 @@ static void cexit(JF, enum js_AstType T, js_Ast *node, js_Ast *target)
 			emitline(J, F, node);
 			/* came from try block */
 			if (prev == node->a) {
-				emit(J, F, OP_ENDTRY);
+				endrange(J, F, node);
 				if (node->d) cstm(J, F, node->d); /* finally */
 			}
 			/* came from catch block */
 			if (prev == node->c) {
+				emit(J, F, OP_ENDCATCH);
 				/* ... with finally */
 				if (node->d) {
-					emit(J, F, OP_ENDCATCH);
-					emit(J, F, OP_ENDTRY);
+					endrange(J, F, node);
 					cstm(J, F, node->d); /* finally */
-				} else {
-					emit(J, F, OP_ENDCATCH);
 				}
 			}
 			break;
 		}
 	} while (node != target);
+	if (T == STM_RETURN)
+		--F->stackextra;
+}
+
+/* Reopen the ranges closed by cexit, outermost first, after the abrupt exit */
+
+static void cresume(JF, js_Ast *prev, js_Ast *target)
+{
+	js_Ast *node = prev->parent;
+	if (node != target)
+		cresume(J, F, node, target);
+	if (node->type == STM_TRY && (prev == node->a || (prev == node->c && node->d)))
+		resumerange(J, F, node);
 }
 
 /* Try/catch/finally */
 
-static void ctryfinally(JF, js_Ast *trystm, js_Ast *finallystm)
+static void ccatchvar(JF, js_Ast *catchvar)
+{
+	checkfutureword(J, F, catchvar);
+	if (F->strict) {
+		if (!strcmp(catchvar->string, "arguments"))
+			jsC_error(J, catchvar, "redefining 'arguments' is not allowed in strict mode");
+		if (!strcmp(catchvar->string, "eval"))
+			jsC_error(J, catchvar, "redefining 'eval' is not allowed in strict mode");
+	}
+	emitline(J, F, catchvar);
+}
+
+static void ctryfinally(JF, js_Ast *stm)
 {
 	int L1;
-	L1 = emitjump(J, F, OP_TRY);
+	beginrange(J, F, stm);
+	cstm(J, F, stm->a);
+	endrange(J, F, stm);
+	cstm(J, F, stm->d);
+	L1 = emitjump(J, F, OP_JUMP); /* skip past the handler */
+	handlerange(J, F, stm);
 	{
 		/* if we get here, we have caught an exception in the try block */
-		cstm(J, F, finallystm); /* inline finally block */
+		++F->stackextra;
+		cstm(J, F, stm->d); /* inline finally block */
+		--F->stackextra;
 		emit(J, F, OP_THROW); /* rethrow exception */
 	}
 	label(J, F, L1);
-	cstm(J, F, trystm);
-	emit(J, F, OP_ENDTRY);
-	cstm(J, F, finallystm);
 }
 
-static void ctrycatch(JF, js_Ast *trystm, js_Ast *catchvar, js_Ast *catchstm)
+static void ctrycatch(JF, js_Ast *stm)
 {
-	int L1, L2;
-	L1 = emitjump(J, F, OP_TRY);
+	int L1;
+	beginrange(J, F, stm);
+	cstm(J, F, stm->a);
+	endrange(J, F, stm);
+	L1 = emitjump(J, F, OP_JUMP); /* skip past the catch block */
+	handlerange(J, F, stm);
 	{
 		/* if we get here, we have caught an exception in the try block */
-		checkfutureword(J, F, catchvar);
-		if (F->strict) {
-			if (!strcmp(catchvar->string, "arguments"))
-				jsC_error(J, catchvar, "redefining 'arguments' is not allowed in strict mode");
-			if (!strcmp(catchvar->string, "eval"))
-				jsC_error(J, catchvar, "redefining 'eval' is not allowed in strict mode");
-		}
-		emitline(J, F, catchvar);
-		emitstring(J, F, OP_CATCH, catchvar->string);
-		cstm(J, F, catchstm);
+		ccatchvar(J, F, stm->b);
+		emitstring(J, F, OP_CATCH, stm->b->string);
+		cstm(J, F, stm->c);
 		emit(J, F, OP_ENDCATCH);
-		L2 = emitjump(J, F, OP_JUMP); /* skip past the try block */
 	}
 	label(J, F, L1);
-	cstm(J, F, trystm);
-	emit(J, F, OP_ENDTRY);
-	label(J, F, L2);
 }
 
-static void ctrycatchfinally(JF, js_Ast *trystm, js_Ast *catchvar, js_Ast *catchstm, js_Ast *finallystm)
+static void ctrycatchfinally(JF, js_Ast *stm)
 {
-	int L1, L2, L3;
-	L1 = emitjump(J, F, OP_TRY);
+	int L1, L2;
+	beginrange(J, F, stm);
+	cstm(J, F, stm->a);
+	endrange(J, F, stm);
+	L1 = emitjump(J, F, OP_JUMP); /* skip past the catch block to the finally block */
+	handlerange(J, F, stm);
 	{
 		/* if we get here, we have caught an exception in the try block */
-		L2 = emitjump(J, F, OP_TRY);
+		ccatchvar(J, F, stm->b);
+		beginrange(J, F, stm);
+		emitstring(J, F, OP_CATCH, stm->b->string);
+		cstm(J, F, stm->c);
+		emit(J, F, OP_ENDCATCH);
+		endrange(J, F, stm);
+		L2 = emitjump(J, F, OP_JUMP); /* skip past the handler to the finally block */
+		handlerange(J, F, stm);
 		{
 			/* if we get here, we have caught an exception in the catch block */
-			cstm(J, F, finallystm); /* inline finally block */
+			++F->stackextra;
+			cstm(J, F, stm->d); /* inline finally block */
+			--F->stackextra;
 			emit(J, F, OP_THROW); /* rethrow exception */
 		}
 		label(J, F, L2);
-		if (F->strict) {
-			checkfutureword(J, F, catchvar);
-			if (!strcmp(catchvar->string, "arguments"))
-				jsC_error(J, catchvar, "redefining 'arguments' is not allowed in strict mode");
-			if (!strcmp(catchvar->string, "eval"))
-				jsC_error(J, catchvar, "redefining 'eval' is not allowed in strict mode");
-		}
-		emitline(J, F, catchvar);
-		emitstring(J, F, OP_CATCH, catchvar->string);
-		cstm(J, F, catchstm);
-		emit(J, F, OP_ENDCATCH);
-		emit(J, F, OP_ENDTRY);
-		L3 = emitjump(J, F, OP_JUMP); /* skip past the try block to the finally block */
 	}
 	label(J, F, L1);
-	cstm(J, F, trystm);
-	emit(J, F, OP_ENDTRY);
-	label(J, F, L3);
-	cstm(J, F, finallystm);
+	cstm(J, F, stm->d);
 }
 
 /* Switch */
 
+/* Can the switch jump through a table: are there enough cases, all integer or all string constants? */
+static int switchtable(js_Ast *head)
+{
+	js_Ast *node, *exp;
+	int ints = 0, strings = 0;
+	double min = 0, max = 0;
+
+	for (node = head; node; node = node->b) {
+		if (node->a->type == STM_DEFAULT)
+			continue;
+		exp = node->a->a;
+		if (exp->type == EXP_NUMBER && exp->number == (int)exp->number && fabs(exp->number) < 0x40000000) {
+			if (ints == 0 || exp->number < min) min = exp->number;
+			if (ints == 0 || exp->number > max) max = exp->number;
+			++ints;
+		} else if (exp->type == EXP_STRING) {
+			++strings;
+		} else {
+			return 0;
+		}
+	}
+	if (ints > 0 && strings > 0)
+		return 0;
+	if (ints + strings < JS_SWITCHCASES)
+		return 0;
+	/* integer cases must be dense enough for an array */
+	if (ints > 0 && max - min >= 4 * ints)
+		return 0;
+	return 1;
+}
+
+unsigned int jsC_strhash(const char *s)
+{
+	unsigned int h = 2166136261u;
+	while (*s)
+		h = (h ^ (unsigned char)*s++) * 16777619u;
+	return h;
+}
+
+static int newswitch(JF)
+{
+	if (F->switchlen >= F->switchcap) {
+		F->switchcap = F->switchcap ? F->switchcap * 2 : 4;
+		F->switchtab = js_realloc(J, F->switchtab, F->switchcap * sizeof *F->switchtab);
+	}
+	memset(&F->switchtab[F->switchlen], 0, sizeof *F->switchtab);
+	return F->switchlen++;
+}
+
+/* Fill in the table once the case clauses have been emitted; the first of duplicate cases wins */
+static void fillswitch(JF, int k, js_Ast *head)
+{
+	js_SwitchTable *T = &F->switchtab[k];
+	js_Ast *node, *clause;
+	int i, n = 0, min = INT_MAX, max = INT_MIN, slot, key;
+
+	for (node = head; node; node = node->b) {
+		clause = node->a;
+		if (clause->type == STM_DEFAULT)
+			continue;
+		if (clause->a->type == EXP_STRING) {
+			T->strings = 1;
+		} else {
+			if (clause->a->number < min) min = clause->a->number;
+			if (clause->a->number > max) max = clause->a->number;
+		}
+		++n;
+	}
+
+	if (T->strings) {
+		T->min = 0;
+		for (T->len = 1; T->len < 2 * n; T->len <<= 1)
+			;
+		T->key = js_malloc(J, T->len * sizeof *T->key);
+	} else {
+		T->min = min;
+		T->len = max - min + 1;
+	}
+	T->jump = js_malloc(J, T->len * sizeof *T->jump);
+	for (i = 0; i < T->len; ++i)
+		T->jump[i] = -1;
+
+	for (node = head; node; node = node->b) {
+		clause = node->a;
+		if (clause->type == STM_DEFAULT)
+			continue;
+		if (T->strings) {
+			key = addstring(J, F, clause->a->string);
+			slot = jsC_strhash(clause->a->string) & (T->len - 1);
+			while (T->jump[slot] >= 0 && strcmp(F->strtab[T->key[slot]], clause->a->string))
+				slot = (slot + 1) & (T->len - 1);
+			if (T->jump[slot] < 0) {
+				T->key[slot] = key;
+				T->jump[slot] = clause->casejump;
+			}
+		} else {
+			slot = (int)clause->a->number - T->min;
+			if (T->jump[slot] < 0)
+				T->jump[slot] = clause->casejump;
+		}
+	}
+}
+
 static void cswitch(JF, js_Ast *ref, js_Ast *head)
 {
 	js_Ast *node, *clause, *def = NULL;
-	int end;
+	int end, table = -1;
 
 	cexp(J, F, ref);
 
-	/* emit an if-else chain of tests for the case clause expressions */
 	for (node = head; node; node = node->b) {
 		clause = node->a;
 		if (clause->type == STM_DEFAULT) {
 			if (def)
 				jsC_error(J, clause, "more than one default label in switch");
 			def = clause;
-		} else {
-			cexp(J, F, clause->a);
-			emitline(J, F, clause);
-			clause->casejump = emitjump(J, F, OP_JCASE);
 		}
 	}
-	emit(J, F, OP_POP);
+
+	if (switchtable(head)) {
+		/* jump through a table, filled in below */
+		emitline(J, F, ref);
+		emit(J, F, OP_SWITCH);
+		emitarg(J, F, table = newswitch(J, F));
+	} else {
+		/* emit an if-else chain of tests for the case clause expressions */
+		for (node = head; node; node = node->b) {
+			clause = node->a;
+			if (clause->type != STM_DEFAULT) {
+				cexp(J, F, clause->a);
+				emitline(J, F, clause);
+				clause->casejump = emitjump(J, F, OP_JCASE);
+			}
+		}
+		emit(J, F, OP_POP);
+	}
 	if (def) {
 		emitline(J, F, def);
 		def->casejump = emitjump(J, F, OP_JUMP);
@@ -1067,15 +1432,23 @@ static void cswitch(JF, js_Ast *ref, js_Ast *head)
 	/* emit the case clause bodies */
 	for (node = head; node; node = node->b) {
 		clause = node->a;
-		label(J, F, clause->casejump);
-		if (clause->type == STM_DEFAULT)
+		if (clause->type == STM_DEFAULT) {
+			label(J, F, clause->casejump);
 			cstmlist(J, F, clause->a);
-		else
+		} else {
+			if (table >= 0)
+				clause->casejump = F->codelen;
+			else
+				label(J, F, clause->casejump);
 			cstmlist(J, F, clause->b);
+		}
 	}
 
 	if (end)
 		label(J, F, end);
+
+	if (table >= 0)
+		fillswitch(J, F, table, head);
 }
 
 /* Statements */
@@ -1248,6 +1621,7 @@ static void cstm(JF, js_Ast *stm)
 		cexit(J, F, STM_BREAK, stm, target);
 		emitline(J, F, stm);
 		addjump(J, F, STM_BREAK, target, emitjump(J, F, OP_JUMP));
+		cresume(J, F, stm, target);
 		break;
 
 	case STM_CONTINUE:
@@ -1264,6 +1638,7 @@ static void cstm(JF, js_Ast *stm)
 		cexit(J, F, STM_CONTINUE, stm, target);
 		emitline(J, F, stm);
 		addjump(J, F, STM_CONTINUE, target, emitjump(J, F, OP_JUMP));
+		cresume(J, F, stm, target);
 		break;
 
 	case STM_RETURN:
@@ -1277,6 +1652,7 @@ static void cstm(JF, js_Ast *stm)
 		cexit(J, F, STM_RETURN, stm, target);
 		emitline(J, F, stm);
 		emit(J, F, OP_RETURN);
+		cresume(J, F, stm, target);
 		break;
 
 	case STM_THROW:
@@ -1286,7 +1662,9 @@ static void cstm(JF, js_Ast *stm)
 		break;
 
 	case STM_WITH:
+		/* the with scope is on the heap, and may be remembered by the collector */
 		F->lightweight = 0;
+		F->escapes = 1;
 		if (F->strict)
 			jsC_error(J, stm->a, "'with' statements are not allowed in strict mode");
 		cexp(J, F, stm->a);
@@ -1300,13 +1678,15 @@ static void cstm(JF, js_Ast *stm)
 	case STM_TRY:
 		emitline(J, F, stm);
 		if (stm->b && stm->c) {
+			/* and so is the catch scope */
 			F->lightweight = 0;
+			F->escapes = 1;
 			if (stm->d)
-				ctrycatchfinally(J, F, stm->a, stm->b, stm->c, stm->d);
+				ctrycatchfinally(J, F, stm);
 			else
-				ctrycatch(J, F, stm->a, stm->b, stm->c);
+				ctrycatch(J, F, stm);
 		} else {
-			ctryfinally(J, F, stm->a, stm->d);
+			ctryfinally(J, F, stm);
 		}
 		break;
 
@@ -1380,29 +1760,77 @@ static void cvardecs(JF, js_Ast *node)
 	if (node->d) cvardecs(J, F, node->d);
 }
 
-static void cfundecs(JF, js_Ast *list)
+static void cfundecnames(JF, js_Ast *list)
+{
+	while (list) {
+		if (list->a->type == AST_FUNDEC)
+			addlocal(J, F, list->a->a, 0);
+		list = list->b;
+	}
+}
+
+static void cfundecs(JF, js_Ast *list, int local)
 {
 	while (list) {
 		js_Ast *stm = list->a;
 		if (stm->type == AST_FUNDEC) {
 			emitline(J, F, stm);
-			emitfunction(J, F, newfun(J, stm->line, stm->a, stm->b, stm->c, 0, F->strict));
+			emitfunction(J, F, newfun(J, F, stm->line, stm->a, stm->b, stm->c, 0, F->strict));
 			emitline(J, F, stm);
 			emit(J, F, OP_SETLOCAL);
-			emitarg(J, F, addlocal(J, F, stm->a, 0));
+			emitarg(J, F, ++local);
 			emit(J, F, OP_POP);
 		}
 		list = list->b;
 	}
 }
 
+static void cscope(JF, js_Ast *node)
+{
+	if (node->type == AST_LIST) {
+		while (node) {
+			cscope(J, F, node->a);
+			node = node->b;
+		}
+		return;
+	}
+
+	if (isfun(node->type))
+		return; /* stop at inner functions */
+
+	if (node->type == STM_WITH)
+		F->dynamic = 1;
+	if (node->type == EXP_IDENTIFIER) {
+		if (!strcmp(node->string, "eval"))
+			F->dynamic = 1;
+		if (!strcmp(node->string, "arguments"))
+			F->arguments = 1;
+	}
+
+	if (node->a) cscope(J, F, node->a);
+	if (node->b) cscope(J, F, node->b);
+	if (node->c) cscope(J, F, node->c);
+	if (node->d) cscope(J, F, node->d);
+}
+
 static void cfunbody(JF, js_Ast *name, js_Ast *params, js_Ast *body)
 {
+	int fundecs = 0;
+
 	F->lightweight = 1;
 	F->arguments = 0;
+	F->flatenv = 1;
 
-	if (F->script)
+	if (F->script) {
 		F->lightweight = 0;
+		F->flatenv = 0;
+	}
+
+	/* Inner functions resolve to slots only if nothing can add names at runtime */
+	if (body && !F->script)
+		cscope(J, F, body);
+	if (F->dynamic)
+		F->flatenv = 0;
 
 	/* Check if first statement is 'use strict': */
 	if (body && body->type == AST_LIST && body->a && body->a->type == EXP_STRING)
@@ -1413,9 +1841,19 @@ static void cfunbody(JF, js_Ast *name, js_Ast *params, js_Ast *body)
 
 	cparams(J, F, params, name);
 
+	/* Declare every name before compiling inner functions that refer to them */
 	if (body) {
 		cvardecs(J, F, body);
-		cfundecs(J, F, body);
+
+		/* Keep the arguments on the stack and make the object only if it is used as one */
+		if (F->arguments && !F->dynamic) {
+			if (findlocal(J, F, "arguments") < 0)
+				F->argslot = pushlocal(J, F, "arguments");
+			F->arguments = 0;
+		}
+
+		fundecs = F->varlen;
+		cfundecnames(J, F, body);
 	}
 
 	if (name) {
@@ -1428,6 +1866,9 @@ static void cfunbody(JF, js_Ast *name, js_Ast *params, js_Ast *body)
 		}
 	}
 
+	if (body)
+		cfundecs(J, F, body, fundecs);
+
 	if (F->script) {
 		emit(J, F, OP_UNDEF);
 		cstmlist(J, F, body);
@@ -1439,14 +1880,408 @@ static void cfunbody(JF, js_Ast *name, js_Ast *params, js_Ast *body)
 	}
 }
 
+/* Peephole optimizer */
+
+int jsC_oplength(int op)
+{
+	switch (op) {
+	case OP_GETLOCAL_GETPROP_S:
+		return 4;
+	case OP_NEWREGEXP:
+	case OP_GETGLOBAL:
+	case OP_SETGLOBAL:
+	case OP_GETUPVAL:
+	case OP_SETUPVAL:
+	case OP_GETVAR:
+	case OP_GETPROP_S:
+	case OP_SETPROP_S:
+		return 3;
+	case OP_INTEGER:
+	case OP_NUMBER:
+	case OP_STRING:
+	case OP_CLOSURE:
+	case OP_GETLOCAL:
+	case OP_SETLOCAL:
+	case OP_DELLOCAL:
+	case OP_ARGUMENTS:
+	case OP_GETARG:
+	case OP_ARGLEN:
+	case OP_HASVAR:
+	case OP_SETVAR:
+	case OP_DELVAR:
+	case OP_DELPROP_S:
+	case OP_CALL:
+	case OP_NEW:
+	case OP_JCASE:
+	case OP_SWITCH:
+	case OP_CATCH:
+	case OP_JUMP:
+	case OP_JTRUE:
+	case OP_JFALSE:
+	case OP_SETLOCAL_POP:
+	case OP_INC_LOCAL:
+	case OP_DEC_LOCAL:
+	case OP_ADD_INTEGER:
+	case OP_LT_JFALSE:
+	case OP_GT_JFALSE:
+	case OP_LE_JFALSE:
+	case OP_GE_JFALSE:
+	case OP_LT_JFALSE_NUM:
+	case OP_GT_JFALSE_NUM:
+	case OP_LE_JFALSE_NUM:
+	case OP_GE_JFALSE_NUM:
+		return 2;
+	}
+	return 1;
+}
+
+/* The opcode that a quickened opcode was rewritten from */
+int jsC_genericop(int op)
+{
+	switch (op) {
+	case OP_ADD_NUM: case OP_ADD_STR: return OP_ADD;
+	case OP_LT_NUM: return OP_LT;
+	case OP_GT_NUM: return OP_GT;
+	case OP_LE_NUM: return OP_LE;
+	case OP_GE_NUM: return OP_GE;
+	case OP_EQ_NUM: case OP_EQ_STR: return OP_EQ;
+	case OP_NE_NUM: case OP_NE_STR: return OP_NE;
+	case OP_STRICTEQ_NUM: case OP_STRICTEQ_STR: return OP_STRICTEQ;
+	case OP_STRICTNE_NUM: case OP_STRICTNE_STR: return OP_STRICTNE;
+	case OP_LT_JFALSE_NUM: return OP_LT_JFALSE;
+	case OP_GT_JFALSE_NUM: return OP_GT_JFALSE;
+	case OP_LE_JFALSE_NUM: return OP_LE_JFALSE;
+	case OP_GE_JFALSE_NUM: return OP_GE_JFALSE;
+	}
+	return op;
+}
+
+static int isjump(int op)
+{
+	switch (op) {
+	case OP_JUMP:
+	case OP_JTRUE:
+	case OP_JFALSE:
+	case OP_JCASE:
+	case OP_LT_JFALSE:
+	case OP_GT_JFALSE:
+	case OP_LE_JFALSE:
+	case OP_GE_JFALSE:
+		return 1;
+	}
+	return 0;
+}
+
+/* Match a sequence of opcodes at pc, none of which (except the first) may be a jump target. */
+static int peepmatch(JF, const char *jt, int pc, const int *ops, int n)
+{
+	int i;
+	for (i = 0; i < n; ++i) {
+		if (pc >= F->codelen || F->code[pc] != ops[i])
+			return 0;
+		if (i > 0 && jt[pc])
+			return 0;
+		pc += jsC_oplength(ops[i]);
+	}
+	return 1;
+}
+
+static int fusecompare(int op)
+{
+	switch (op) {
+	case OP_LT: return OP_LT_JFALSE;
+	case OP_GT: return OP_GT_JFALSE;
+	case OP_LE: return OP_LE_JFALSE;
+	case OP_GE: return OP_GE_JFALSE;
+	}
+	return 0;
+}
+
+/*
+ * Thread jumps to unconditional jumps, then rewrite common instruction
+ * sequences into superinstructions and compact the code in place.
+ * Jump targets and the line table are remapped to the new addresses.
+ */
+static void peephole(JF)
+{
+	static const int postinc[] = { OP_GETLOCAL, OP_POSTINC, OP_ROT2, OP_SETLOCAL, OP_POP, OP_POP };
+	static const int postdec[] = { OP_GETLOCAL, OP_POSTDEC, OP_ROT2, OP_SETLOCAL, OP_POP, OP_POP };
+	static const int preinc[] = { OP_GETLOCAL, OP_INC, OP_SETLOCAL, OP_POP };
+	static const int predec[] = { OP_GETLOCAL, OP_DEC, OP_SETLOCAL, OP_POP };
+	static const int getlocalprop[] = { OP_GETLOCAL, OP_GETPROP_S };
+	static const int dupsetlocal[] = { OP_DUP, OP_SETLOCAL, OP_POP };
+	static const int setlocalpop[] = { OP_SETLOCAL, OP_POP };
+	static const int addinteger[] = { OP_INTEGER, OP_ADD };
+
+	js_Instruction *code = F->code;
+	int len = F->codelen;
+	int *map;
+	char *jt;
+	int r, w, i, k, n, op, dest;
+
+	map = js_malloc(J, (len + 1) * sizeof *map);
+	jt = js_malloc(J, len + 1);
+	memset(jt, 0, len + 1);
+
+	/* thread jumps and mark jump targets */
+	for (r = 0; r < len; r += jsC_oplength(code[r])) {
+		op = code[r];
+		if (isjump(op)) {
+			dest = code[r+1];
+			if (op != OP_JCASE) {
+				for (n = 0; code[dest] == OP_JUMP && code[dest+1] != dest && n < 8; ++n)
+					dest = code[dest+1];
+				code[r+1] = dest;
+			}
+			jt[dest] = 1;
+		}
+	}
+
+	/* nor the cases of switch tables, or handler ranges */
+	for (i = 0; i < F->switchlen; ++i)
+		for (k = 0; k < F->switchtab[i].len; ++k)
+			if (F->switchtab[i].jump[k] >= 0)
+				jt[F->switchtab[i].jump[k]] = 1;
+	for (i = 0; i < F->trylen; ++i) {
+		jt[F->trytab[i].start] = 1;
+		jt[F->trytab[i].end] = 1;
+		jt[F->trytab[i].handler] = 1;
+	}
+
+	/* fuse and compact */
+	for (r = w = 0; r < len; ) {
+		op = code[r];
+		n = 0;
+		if (F->lightweight && peepmatch(J, F, jt, r, postinc, nelem(postinc)) && code[r+1] == code[r+5]) {
+			k = code[r+1];
+			code[w] = OP_INC_LOCAL;
+			code[w+1] = k;
+			n = 8;
+		} else if (F->lightweight && peepmatch(J, F, jt, r, postdec, nelem(postdec)) && code[r+1] == code[r+5]) {
+			k = code[r+1];
+			code[w] = OP_DEC_LOCAL;
+			code[w+1] = k;
+			n = 8;
+		} else if (F->lightweight && peepmatch(J, F, jt, r, preinc, nelem(preinc)) && code[r+1] == code[r+4]) {
+			k = code[r+1];
+			code[w] = OP_INC_LOCAL;
+			code[w+1] = k;
+			n = 6;
+		} else if (F->lightweight && peepmatch(J, F, jt, r, predec, nelem(predec)) && code[r+1] == code[r+4]) {
+			k = code[r+1];
+			code[w] = OP_DEC_LOCAL;
+			code[w+1] = k;
+			n = 6;
+		} else if (F->lightweight && peepmatch(J, F, jt, r, getlocalprop, nelem(getlocalprop))) {
+			k = code[r+1];
+			i = code[r+3];
+			code[w] = OP_GETLOCAL_GETPROP_S;
+			code[w+1] = k;
+			code[w+2] = i;
+			code[w+3] = 0;
+			n = 5;
+		} else if (peepmatch(J, F, jt, r, dupsetlocal, nelem(dupsetlocal))) {
+			k = code[r+2];
+			code[w] = OP_SETLOCAL;
+			code[w+1] = k;
+			n = 4;
+		} else if (F->lightweight && peepmatch(J, F, jt, r, setlocalpop, nelem(setlocalpop))) {
+			k = code[r+1];
+			code[w] = OP_SETLOCAL_POP;
+			code[w+1] = k;
+			n = 3;
+		} else if (peepmatch(J, F, jt, r, addinteger, nelem(addinteger))) {
+			k = code[r+1];
+			code[w] = OP_ADD_INTEGER;
+			code[w+1] = k;
+			n = 3;
+		} else if (fusecompare(op) && r + 1 < len && code[r+1] == OP_JFALSE && !jt[r+1]) {
+			k = code[r+2];
+			code[w] = fusecompare(op);
+			code[w+1] = k;
+			n = 3;
+		}
+
+		if (n > 0) {
+			for (i = 0; i < n; ++i)
+				map[r+i] = w;
+			r += n;
+			w += jsC_oplength(code[w]);
+		} else {
+			n = jsC_oplength(op);
+			for (i = 0; i < n; ++i) {
+				map[r] = w;
+				code[w++] = code[r++];
+			}
+		}
+	}
+	map[len] = w;
+	F->codelen = w;
+
+	/* relocate jump targets */
+	for (r = 0; r < w; r += jsC_oplength(code[r]))
+		if (isjump(code[r]))
+			code[r+1] = map[code[r+1]];
+	for (i = 0; i < F->switchlen; ++i)
+		for (k = 0; k < F->switchtab[i].len; ++k)
+			if (F->switchtab[i].jump[k] >= 0)
+				F->switchtab[i].jump[k] = map[F->switchtab[i].jump[k]];
+
+	/* relocate the line table */
+	for (i = k = 0; i < F->linelen; ++i) {
+		int pc = map[F->linetab[i].pc];
+		int line = F->linetab[i].line;
+		if (k > 0 && F->linetab[k-1].pc == pc)
+			--k;
+		if (k > 0 && F->linetab[k-1].line == line)
+			continue;
+		F->linetab[k].pc = pc;
+		F->linetab[k].line = line;
+		++k;
+	}
+	F->linelen = k;
+
+	/* relocate the handler table, dropping ranges left empty by abrupt exits */
+	for (i = k = 0; i < F->trylen; ++i) {
+		js_TryRange r = F->trytab[i];
+		r.start = map[r.start];
+		r.end = map[r.end];
+		r.handler = map[r.handler];
+		if (r.start < r.end)
+			F->trytab[k++] = r;
+	}
+	F->trylen = k;
+
+	js_free(J, jt);
+	js_free(J, map);
+}
+
+/* Number the inline caches of the property access instructions and allocate them */
+
+static void initcaches(JF)
+{
+	int pc, n = 0;
+	for (pc = 0; pc < F->codelen; pc += jsC_oplength(F->code[pc])) {
+		switch (F->code[pc]) {
+		case OP_GETVAR:
+		case OP_GETGLOBAL:
+		case OP_SETGLOBAL:
+		case OP_GETPROP_S:
+		case OP_SETPROP_S:
+			F->code[pc+2] = n++;
+			break;
+		case OP_GETLOCAL_GETPROP_S:
+			F->code[pc+3] = n++;
+			break;
+		}
+		if (n > 0xffff)
+			js_syntaxerror(J, "too many property accesses in function");
+	}
+	F->cachelen = n;
+	if (n > 0) {
+		F->cachetab = js_malloc(J, n * JS_CACHEWAYS * sizeof *F->cachetab);
+		memset(F->cachetab, 0, n * JS_CACHEWAYS * sizeof *F->cachetab);
+	}
+}
+
+/* Small straight-line functions of locals, numbers and named properties can be run at their call sites */
+
+static int inlinable(JF)
+{
+	int pc;
+	if (!F->lightweight || F->argslot || F->script)
+		return 0;
+	if (F->codelen > JS_INLINESIZE || F->varlen >= JS_INLINESIZE)
+		return 0;
+	for (pc = 0; pc < F->codelen; pc += jsC_oplength(F->code[pc])) {
+		switch (jsC_genericop(F->code[pc])) {
+		case OP_POP:
+		case OP_UNDEF:
+		case OP_NULL:
+		case OP_TRUE:
+		case OP_FALSE:
+		case OP_INTEGER:
+		case OP_NUMBER:
+		case OP_THIS:
+		case OP_CURRENT:
+		case OP_GETLOCAL:
+		case OP_SETLOCAL:
+		case OP_SETLOCAL_POP:
+		case OP_GETPROP_S:
+		case OP_GETLOCAL_GETPROP_S:
+		case OP_ADD:
+		case OP_SUB:
+		case OP_MUL:
+		case OP_DIV:
+		case OP_LT:
+		case OP_GT:
+		case OP_LE:
+		case OP_GE:
+		case OP_EQ:
+		case OP_NE:
+		case OP_STRICTEQ:
+		case OP_STRICTNE:
+			break;
+		case OP_RETURN:
+			return 1;
+		default:
+			return 0;
+		}
+	}
+	return 0;
+}
+
+/* Find the source line of the instruction at pc */
+
+int jsC_lineat(js_Function *F, int pc)
+{
+	int lo = 0, hi = F->linelen - 1, m;
+	if (hi < 0 || pc < F->linetab[0].pc)
+		return F->line;
+	while (lo < hi) {
+		m = (lo + hi + 1) >> 1;
+		if (F->linetab[m].pc <= pc)
+			lo = m;
+		else
+			hi = m - 1;
+	}
+	return F->linetab[lo].line;
+}
+
+/* Hash the bytecode and the flags that native code for it depends on */
+
+unsigned int jsC_checksum(js_Function *F)
+{
+	unsigned int h = 2166136261u;
+	int pc, i, n;
+	h = (h ^ F->lightweight) * 16777619u;
+	h = (h ^ F->flatenv) * 16777619u;
+	for (pc = 0; pc < F->codelen; pc += n) {
+		n = jsC_oplength(F->code[pc]);
+		h = (h ^ jsC_genericop(F->code[pc])) * 16777619u;
+		for (i = 1; i < n; ++i)
+			h = (h ^ F->code[pc+i]) * 16777619u;
+	}
+	for (i = 0; i < F->switchlen; ++i) {
+		js_SwitchTable *T = &F->switchtab[i];
+		h = (h ^ T->min) * 16777619u;
+		for (n = 0; n < T->len; ++n) {
+			h = (h ^ T->jump[n]) * 16777619u;
+			if (T->strings && T->jump[n] >= 0)
+				h = (h ^ jsC_strhash(F->strtab[T->key[n]])) * 16777619u;
+		}
+	}
+	return h;
+}
+
 js_Function *jsC_compilefunction(js_State *J, js_Ast *prog)
 {
-	return newfun(J, prog->line, prog->a, prog->b, prog->c, 0, J->default_strict);
+	return newfun(J, NULL, prog->line, prog->a, prog->b, prog->c, 0, J->default_strict);
 }
 
-js_Function *jsC_compilescript(js_State *J, js_Ast *prog, int default_strict)
+js_Function *jsC_compilescript(js_State *J, js_Ast *prog, int default_strict, int iseval)
 {
-	return newfun(J, prog ? prog->line : 0, NULL, NULL, prog, 1, default_strict);
+	return newfun(J, NULL, prog ? prog->line : 0, NULL, NULL, prog, iseval ? 2 : 1, default_strict);
 }
 
 // ##########################################################################################
@@ -1466,7 +2301,8 @@ static int8_t writeInt(js_State *J, char* out, int data) {
     return 4;
 }
 static int8_t writeDouble(js_State *J, char* out, double data) {
-    uint64_t tmp = ((uint64_t*)&data)[0];
+    uint64_t tmp;
+    memcpy(&tmp, &data, sizeof tmp);
     out[0] = (char)(tmp & 0xFF);
     out[1] = (char)((tmp >> 8) & 0xFF);
     out[2] = (char)((tmp >> 16) & 0xFF);
@@ -1496,9 +2332,12 @@ static int16_t writeStr(js_State *J, char* out, const char* data, int len) {
 int jsC_function_serialization(js_State *J, js_Function *fun, char* cursor, int* len, int depth) {
     int str_len = 0;
     char* out = cursor;
-    // only write filename once
+    // only write the format and filename once
     if(depth == 1) {
-        *len = 0;
+        *len = 4;
+        if(out) {
+            out += writeInt(J, out, JS_BYTECODEVERSION);
+        }
         //    const char *filename;
         str_len = (int)strlen(fun->filename);
         *len += str_len + 3;
@@ -1527,14 +2366,70 @@ int jsC_function_serialization(js_State *J, js_Function *fun, char* cursor, int*
     //    int numparams;
     *len += 2;
     if(out) { out += writeShort(J, out, fun->numparams); }
+    //    int flatenv;
+    *len += 2;
+    if(out) { out += writeShort(J, out, fun->flatenv); }
+    //    int argslot;
+    *len += 2;
+    if(out) { out += writeShort(J, out, fun->argslot); }
+    //    int escapes;
+    *len += 2;
+    if(out) { out += writeShort(J, out, fun->escapes); }
     //
     //    unsigned int *code;
     //    int codecap, codelen;
     *len += fun->codelen * 2 + 4;
     if(out) {
         out += writeInt(J, out, fun->codelen);
-        for(int i = 0; i < fun->codelen; ++i) {
-            out += writeShort(J, out, (fun->code)[i]);
+        // write the opcodes as compiled, not as quickened while running
+        for(int i = 0; i < fun->codelen; i += jsC_oplength(fun->code[i])) {
+            out += writeShort(J, out, jsC_genericop(fun->code[i]));
+            for(int k = 1; k < jsC_oplength(fun->code[i]); ++k)
+                out += writeShort(J, out, (fun->code)[i+k]);
+        }
+    }
+    //
+    //    js_LineInfo *linetab;
+    //    int linecap, linelen;
+    *len += fun->linelen * 8 + 4;
+    if(out) {
+        out += writeInt(J, out, fun->linelen);
+        for(int i = 0; i < fun->linelen; ++i) {
+            out += writeInt(J, out, (fun->linetab)[i].pc);
+            out += writeInt(J, out, (fun->linetab)[i].line);
+        }
+    }
+    //
+    //    js_TryRange *trytab;
+    //    int trycap, trylen;
+    *len += fun->trylen * 20 + 4;
+    if(out) {
+        out += writeInt(J, out, fun->trylen);
+        for(int i = 0; i < fun->trylen; ++i) {
+            out += writeInt(J, out, (fun->trytab)[i].start);
+            out += writeInt(J, out, (fun->trytab)[i].end);
+            out += writeInt(J, out, (fun->trytab)[i].handler);
+            out += writeInt(J, out, (fun->trytab)[i].height);
+            out += writeInt(J, out, (fun->trytab)[i].scope);
+        }
+    }
+    //
+    //    js_SwitchTable *switchtab;
+    //    int switchcap, switchlen;
+    *len += 4;
+    if(out) out += writeInt(J, out, fun->switchlen);
+    for(int i = 0; i < fun->switchlen; ++i) {
+        js_SwitchTable *T = &fun->switchtab[i];
+        *len += 12 + T->len * (T->strings ? 8 : 4);
+        if(out) {
+            out += writeInt(J, out, T->strings);
+            out += writeInt(J, out, T->min);
+            out += writeInt(J, out, T->len);
+            for(int k = 0; k < T->len; ++k) {
+                out += writeInt(J, out, T->jump[k]);
+                if(T->strings)
+                    out += writeInt(J, out, T->key[k]);
+            }
         }
     }
     //
@@ -1615,7 +2510,8 @@ double readDouble(js_State *J, char** buffer) {
     uint64_t c1 = (*buffer)[6] & 0xFF;
     uint64_t d1 = (*buffer)[7] & 0xFF;
     *buffer += 8;
-    ((uint64_t*)&ret)[0] = ((d1 << 56) | (c1 << 48) | (b1 << 40) | (a1 << 32) | (d << 24) | (c << 16) | (b << 8) | a);
+    uint64_t tmp = ((d1 << 56) | (c1 << 48) | (b1 << 40) | (a1 << 32) | (d << 24) | (c << 16) | (b << 8) | a);
+    memcpy(&ret, &tmp, sizeof ret);
     return ret;
 }
 const char* readStr(js_State *J, char** buffer) {
@@ -1626,9 +2522,16 @@ const char* readStr(js_State *J, char** buffer) {
 }
 // decode js_Function from string
 js_Function* jsC_function_deserialization(js_State *J, const char* name, char** buffer, int depth) {
-    js_Function *F = js_malloc(J, sizeof *F);
+    char *start = *buffer;
+    js_Function *F;
+    // refuse bytecode written with other opcode numbers or another layout
+    if(depth == 1 && readInt(J, buffer) != JS_BYTECODEVERSION) {
+        *buffer = start;
+        js_error(J, "bytecode was serialized by an incompatible version");
+    }
+    F = js_malloc(J, sizeof *F);
     memset(F, 0, sizeof *F);
-    F->codebits = *buffer;
+    F->codebits = start;
     F->gcnext = J->gcfun;
     J->gcfun = F;
     ++J->gccounter;
@@ -1651,6 +2554,12 @@ js_Function* jsC_function_deserialization(js_State *J, const char* name, char**
     F->arguments = readShort(J, buffer);
     //    int numparams;[short]
     F->numparams = readShort(J, buffer);
+    //    int flatenv;[short]
+    F->flatenv = readShort(J, buffer);
+    //    int argslot;[short]
+    F->argslot = readShort(J, buffer);
+    //    int escapes;[short]
+    F->escapes = readShort(J, buffer);
     //
     //    int codecap, codelen; [int]
     //    unsigned int *code; [short] array
@@ -1661,6 +2570,48 @@ js_Function* jsC_function_deserialization(js_State *J, const char* name, char**
         F->code[i] = readShort(J, buffer);
     }
     //
+    //    int linecap, linelen; [int]
+    //    js_LineInfo *linetab; [int, int] array
+    F->linelen = readInt(J, buffer);
+    F->linecap = F->linelen;
+    if(F->linelen > 0) F->linetab = js_realloc(J, F->linetab, F->linelen * sizeof *F->linetab);
+    for(int i = 0; i < F->linelen; ++i) {
+        F->linetab[i].pc = readInt(J, buffer);
+        F->linetab[i].line = readInt(J, buffer);
+    }
+    //
+    //    int trycap, trylen; [int]
+    //    js_TryRange *trytab; [int, int, int, int, int] array
+    F->trylen = readInt(J, buffer);
+    F->trycap = F->trylen;
+    if(F->trylen > 0) F->trytab = js_realloc(J, F->trytab, F->trylen * sizeof *F->trytab);
+    for(int i = 0; i < F->trylen; ++i) {
+        F->trytab[i].start = readInt(J, buffer);
+        F->trytab[i].end = readInt(J, buffer);
+        F->trytab[i].handler = readInt(J, buffer);
+        F->trytab[i].height = readInt(J, buffer);
+        F->trytab[i].scope = readInt(J, buffer);
+    }
+    //
+    //    int switchcap, switchlen; [int]
+    //    js_SwitchTable *switchtab; [int, int, int, int array, int array] array
+    F->switchlen = readInt(J, buffer);
+    F->switchcap = F->switchlen;
+    if(F->switchlen > 0) F->switchtab = js_malloc(J, F->switchlen * sizeof *F->switchtab);
+    for(int i = 0; i < F->switchlen; ++i) {
+        js_SwitchTable *T = &F->switchtab[i];
+        T->strings = readInt(J, buffer);
+        T->min = readInt(J, buffer);
+        T->len = readInt(J, buffer);
+        T->jump = js_malloc(J, T->len * sizeof *T->jump);
+        T->key = T->strings ? js_malloc(J, T->len * sizeof *T->key) : NULL;
+        for(int k = 0; k < T->len; ++k) {
+            T->jump[k] = readInt(J, buffer);
+            if(T->strings)
+                T->key[k] = readInt(J, buffer);
+        }
+    }
+    //
     //    int numcap, numlen;[int]
     //    double *numtab;[double] array
     F->numlen = readInt(J, buffer);
@@ -1703,6 +2654,8 @@ js_Function* jsC_function_deserialization(js_State *J, const char* name, char**
             F->funtab[i]->codebits = NULL;
         }
     }
+    initcaches(J, F);
+    F->inlinable = inlinable(J, F);
     F->gcmark = JS_OBJ_FROZEN;
     return F;
 }
@@ -32,7 +32,7 @@ enum js_OpCode
 	OP_DELLOCAL,	/* -K- false */
 
 	OP_HASVAR,	/* -S- ( <value> | undefined ) */
-	OP_GETVAR,	/* -S- <value> */
+	OP_GETVAR,	/* -S,C- <value> */
 	OP_SETVAR,	/* <value> -S- <value> */
 	OP_DELVAR,	/* -S- <success> */
 
@@ -43,9 +43,9 @@ enum js_OpCode
 	OP_INITSETTER,	/* <obj> <key> <closure> -- <obj> */
 
 	OP_GETPROP,	/* <obj> <name> -- <value> */
-	OP_GETPROP_S,	/* <obj> -S- <value> */
+	OP_GETPROP_S,	/* <obj> -S,C- <value> */
 	OP_SETPROP,	/* <obj> <name> <value> -- <value> */
-	OP_SETPROP_S,	/* <obj> <value> -S- <value> */
+	OP_SETPROP_S,	/* <obj> <value> -S,C- <value> */
 	OP_DELPROP,	/* <obj> <name> -- <success> */
 	OP_DELPROP_S,	/* <obj> -S- <success> */
 
@@ -91,8 +91,8 @@ enum js_OpCode
 
 	OP_THROW,
 
-	OP_TRY,		/* -ADDR- /jump/ or -ADDR- <exception> */
-	OP_ENDTRY,
+	OP_TRY,		/* retired, exceptions go through the try table */
+	OP_ENDTRY,	/* retired */
 
 	OP_CATCH,	/* push scope chain with exception variable */
 	OP_ENDCATCH,
@@ -105,6 +105,93 @@ enum js_OpCode
 	OP_JTRUE,
 	OP_JFALSE,
 	OP_RETURN,
+
+	/* New opcodes go at the end, so that the numbers of the old ones never change */
+
+	/* Superinstructions made by the peephole optimizer */
+
+	OP_GETLOCAL_GETPROP_S,	/* -K,S,C- <value> */
+	OP_SETLOCAL_POP,	/* <value> -K- */
+	OP_INC_LOCAL,	/* -K- */
+	OP_DEC_LOCAL,	/* -K- */
+	OP_ADD_INTEGER,	/* <x> -K- <x+(number-32768)> */
+	OP_LT_JFALSE,	/* <x> <y> -ADDR- */
+	OP_GT_JFALSE,	/* <x> <y> -ADDR- */
+	OP_LE_JFALSE,	/* <x> <y> -ADDR- */
+	OP_GE_JFALSE,	/* <x> <y> -ADDR- */
+
+	/* Closure variables in environment slots */
+
+	OP_GETUPVAL,	/* -D,K- <value> */
+	OP_SETUPVAL,	/* <value> -D,K- <value> */
+
+	/* Global variables through cached cells */
+
+	OP_GETGLOBAL,	/* -S,C- <value> */
+	OP_SETGLOBAL,	/* <value> -S,C- <value> */
+
+	/* The arguments object, made lazily from the stack */
+
+	OP_ARGUMENTS,	/* -K- <arguments> */
+	OP_GETARG,	/* <index> -K- <value> */
+	OP_ARGLEN,	/* -K- <length> */
+
+	/* Quickened opcodes, rewritten in place by the interpreter */
+
+	OP_ADD_NUM,
+	OP_ADD_STR,
+	OP_LT_NUM,
+	OP_GT_NUM,
+	OP_LE_NUM,
+	OP_GE_NUM,
+	OP_EQ_NUM,
+	OP_NE_NUM,
+	OP_EQ_STR,
+	OP_NE_STR,
+	OP_STRICTEQ_NUM,
+	OP_STRICTNE_NUM,
+	OP_STRICTEQ_STR,
+	OP_STRICTNE_STR,
+	OP_LT_JFALSE_NUM,	/* <x> <y> -ADDR- */
+	OP_GT_JFALSE_NUM,	/* <x> <y> -ADDR- */
+	OP_LE_JFALSE_NUM,	/* <x> <y> -ADDR- */
+	OP_GE_JFALSE_NUM,	/* <x> <y> -ADDR- */
+
+	/* Jump tables */
+
+	OP_SWITCH,	/* <value> -K- jump through switch table K, or go on */
+};
+
+/*
+ * Jump table of a switch on integer or string constants. Integer cases
+ * are found at jump[value - min]; string cases are hashed into len slots
+ * with the string constant of each slot in key. Slots that match no case
+ * hold -1 in jump.
+ */
+struct js_SwitchTable
+{
+	int strings;
+	int min, len;
+	int *jump;
+	int *key;
+};
+
+struct js_LineInfo
+{
+	int pc, line;
+};
+
+/*
+ * Exception handlers cover the code in [start, end) and are entered at
+ * handler with the exception pushed on a stack of the given height above
+ * the frame's base, after popping catch and with scopes down to scope.
+ * A try block that is left by break, continue or return is split into
+ * several ranges. Nested handlers come after the handlers they are in.
+ */
+struct js_TryRange
+{
+	int start, end, handler;
+	int height, scope;
 };
 
 struct js_Function
@@ -115,6 +202,14 @@ struct js_Function
 	int strict;
 	int arguments;
 	int numparams;
+	int flatenv; /* variables live in environment slots */
+	int argslot; /* local holding the arguments object once it is made, or 0 */
+	int dynamic; /* uses eval or with; names must be looked up at runtime */
+	int escapes; /* the environment may outlive the call */
+	int inlinable; /* small leaf function that can run at its call sites, see jsR_inlinecall */
+	js_Function *outer; /* enclosing function, only valid while compiling */
+	js_Ast *body; /* only valid while compiling */
+	int stackextra; /* values held above the statement level, only while compiling */
 
 	js_Instruction *code;
 	int codecap, codelen;
@@ -131,6 +226,26 @@ struct js_Function
 	const char **vartab;
 	int varcap, varlen;
 
+	js_LineInfo *linetab; /* run-length pc to line map */
+	int linecap, linelen;
+
+	js_TryRange *trytab; /* exception handler table */
+	int trycap, trylen;
+
+	js_SwitchTable *switchtab; /* jump tables of the switch instructions */
+	int switchcap, switchlen;
+
+	js_PropCache *cachetab; /* JS_CACHEWAYS entries per cached instruction */
+	int cachelen;
+
+	int deopts; /* quickened opcodes that have been reverted */
+
+	js_NativeCode native; /* native code, from mujs-aot or the JIT */
+	void *jitcode; /* machine code, see jsjit.c */
+	int *jitmap; /* offset in the machine code of each instruction */
+	int jitsize;
+	int hotness; /* calls and backward jumps so far, negative if it can not be compiled */
+
 	const char *filename;
 	int line, lastline;
 
@@ -141,12 +256,20 @@ struct js_Function
 };
 
 js_Function *jsC_compilefunction(js_State *J, js_Ast *prog);
-js_Function *jsC_compilescript(js_State *J, js_Ast *prog, int default_strict);
+js_Function *jsC_compilescript(js_State *J, js_Ast *prog, int default_strict, int iseval);
 
 const char *jsC_opcodestring(enum js_OpCode opcode);
+int jsC_lineat(js_Function *F, int pc);
+int jsC_oplength(int op);
+int jsC_genericop(int op);
+unsigned int jsC_checksum(js_Function *F);
+unsigned int jsC_strhash(const char *s);
 
 void jsC_dumpfunction(js_State *J, js_Function *fun);
 
+/* First word of serialized bytecode: "MJS" and a format number to bump when the opcodes or the layout change */
+#define JS_BYTECODEVERSION 0x01534a4d
+
 int jsC_function_serialization(js_State *J, js_Function *fun, char* buffer, int* len, int depth);
 js_Function* jsC_function_deserialization(js_State *J, const char* name, char** buffer, int depth);
 
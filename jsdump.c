@@ -776,13 +776,16 @@ void jsC_dumpfunction(js_State *J, js_Function *F)
 {
 	js_Instruction *p = F->code;
 	js_Instruction *end = F->code + F->codelen;
-	int i;
+	int i, k = 0, ln = F->line;
 
 	minify = 0;
 
 	printf("%s(%d)\n", F->name, F->numparams);
 	if (F->lightweight) printf("\tlightweight\n");
 	if (F->arguments) printf("\targuments\n");
+	if (F->flatenv) printf("\tflatenv\n");
+	if (F->flatenv && !F->escapes) printf("\tpooledenv\n");
+	if (F->argslot) printf("\targslot %d\n", F->argslot);
 	printf("\tsource %s:%d\n", F->filename, F->line);
 	for (i = 0; i < F->funlen; ++i)
 		printf("\tfunction %d %s\n", i, F->funtab[i]->name);
@@ -791,10 +794,13 @@ void jsC_dumpfunction(js_State *J, js_Function *F)
 
 	printf("{\n");
 	while (p < end) {
-		int ln = *p++;
+		int addr = (int)(p - F->code);
 		int c = *p++;
 
-		printf("%5d(%3d): ", (int)(p - F->code) - 2, ln);
+		while (k < F->linelen && F->linetab[k].pc <= addr)
+			ln = F->linetab[k++].line;
+
+		printf("%5d(%3d): ", addr, ln);
 		ps(opname[c]);
 
 		switch (c) {
@@ -814,24 +820,53 @@ void jsC_dumpfunction(js_State *J, js_Function *F)
 			p += 2;
 			break;
 
-		case OP_GETVAR:
 		case OP_HASVAR:
 		case OP_SETVAR:
 		case OP_DELVAR:
-		case OP_GETPROP_S:
-		case OP_SETPROP_S:
 		case OP_DELPROP_S:
 		case OP_CATCH:
 			pc(' ');
 			ps(F->strtab[*p++]);
 			break;
 
+		case OP_GETVAR:
+		case OP_GETGLOBAL:
+		case OP_SETGLOBAL:
+		case OP_GETPROP_S:
+		case OP_SETPROP_S:
+			pc(' ');
+			ps(F->strtab[*p++]);
+			++p; /* inline cache */
+			break;
+
 		case OP_GETLOCAL:
 		case OP_SETLOCAL:
 		case OP_DELLOCAL:
+		case OP_SETLOCAL_POP:
+		case OP_INC_LOCAL:
+		case OP_DEC_LOCAL:
+		case OP_ARGUMENTS:
+		case OP_GETARG:
+		case OP_ARGLEN:
 			printf(" %s", F->vartab[*p++ - 1]);
 			break;
 
+		case OP_GETUPVAL:
+		case OP_SETUPVAL:
+			printf(" %d %d", p[0], p[1]);
+			p += 2;
+			break;
+
+		case OP_GETLOCAL_GETPROP_S:
+			printf(" %s ", F->vartab[*p++ - 1]);
+			ps(F->strtab[*p++]);
+			++p; /* inline cache */
+			break;
+
+		case OP_ADD_INTEGER:
+			printf(" %d", (*p++) - 32768);
+			break;
+
 		case OP_CLOSURE:
 		case OP_CALL:
 		case OP_NEW:
@@ -839,7 +874,15 @@ void jsC_dumpfunction(js_State *J, js_Function *F)
 		case OP_JTRUE:
 		case OP_JFALSE:
 		case OP_JCASE:
-		case OP_TRY:
+		case OP_SWITCH:
+		case OP_LT_JFALSE:
+		case OP_GT_JFALSE:
+		case OP_LE_JFALSE:
+		case OP_GE_JFALSE:
+		case OP_LT_JFALSE_NUM:
+		case OP_GT_JFALSE_NUM:
+		case OP_LE_JFALSE_NUM:
+		case OP_GE_JFALSE_NUM:
 			printf(" %d", *p++);
 			break;
 		}
@@ -847,6 +890,10 @@ void jsC_dumpfunction(js_State *J, js_Function *F)
 		nl();
 	}
 	printf("}\n");
+	for (i = 0; i < F->trylen; ++i)
+		printf("try %d-%d handler %d height %d scope %d\n",
+			F->trytab[i].start, F->trytab[i].end, F->trytab[i].handler,
+			F->trytab[i].height, F->trytab[i].scope);
 
 	for (i = 0; i < F->funlen; ++i) {
 		if (F->funtab[i] != F) {
@@ -861,63 +908,57 @@ void jsC_dumpfunction(js_State *J, js_Function *F)
 void js_dumpvalue(js_State *J, js_Value v)
 {
 	minify = 0;
-	switch (v.type) {
+	switch (JSV_TYPE(v)) {
 	case JS_TUNDEFINED: printf("undefined"); break;
 	case JS_TNULL: printf("null"); break;
-	case JS_TBOOLEAN: printf(v.u.boolean ? "true" : "false"); break;
-	case JS_TNUMBER: printf("%.9g", v.u.number); break;
-	case JS_TSHRSTR: printf("'%s'", v.u.shrstr); break;
-	case JS_TLITSTR: printf("'%s'", v.u.litstr); break;
-	case JS_TMEMSTR: printf("'%s'", v.u.memstr->p); break;
+	case JS_THOLE: printf("hole"); break;
+	case JS_TBOOLEAN: printf(JSV_BOOLEAN(v) ? "true" : "false"); break;
+	case JS_TNUMBER: printf("%.9g", JSV_NUMBER(v)); break;
+	case JS_TINTEGER: printf("%d", JSV_INTEGER(v)); break;
+	case JS_TSHRSTR: printf("'%s'", JSV_SHRSTR(v)); break;
+	case JS_TLITSTR: printf("'%s'", JSV_LITSTR(v)); break;
+	case JS_TMEMSTR: printf("'%s'", JSV_MEMSTR(v)->p); break;
 	case JS_TOBJECT:
-		if (v.u.object == J->G) {
+		if (JSV_OBJECT(v) == J->G) {
 			printf("[Global]");
 			break;
 		}
-		switch (v.u.object->type) {
-		case JS_COBJECT: printf("[Object %p]", (void*)v.u.object); break;
-		case JS_CARRAY: printf("[Array %p]", (void*)v.u.object); break;
+		switch (JSV_OBJECT(v)->type) {
+		case JS_COBJECT: printf("[Object %p]", (void*)JSV_OBJECT(v)); break;
+		case JS_CARRAY: printf("[Array %p]", (void*)JSV_OBJECT(v)); break;
 		case JS_CFUNCTION:
 			printf("[Function %p, %s, %s:%d]",
-				(void*)v.u.object,
-				v.u.object->u.f.function->name,
-				v.u.object->u.f.function->filename,
-				v.u.object->u.f.function->line);
+				(void*)JSV_OBJECT(v),
+				JSV_OBJECT(v)->u.f.function->name,
+				JSV_OBJECT(v)->u.f.function->filename,
+				JSV_OBJECT(v)->u.f.function->line);
 			break;
-		case JS_CSCRIPT: printf("[Script %s]", v.u.object->u.f.function->filename); break;
-		case JS_CCFUNCTION: printf("[CFunction %s]", v.u.object->u.c.name); break;
-		case JS_CBOOLEAN: printf("[Boolean %d]", v.u.object->u.boolean); break;
-		case JS_CNUMBER: printf("[Number %g]", v.u.object->u.number); break;
-		case JS_CSTRING: printf("[String'%s']", v.u.object->u.s.string); break;
+		case JS_CSCRIPT: printf("[Script %s]", JSV_OBJECT(v)->u.f.function->filename); break;
+		case JS_CCFUNCTION: printf("[CFunction %s]", JSV_OBJECT(v)->u.c.name); break;
+		case JS_CBOOLEAN: printf("[Boolean %d]", JSV_OBJECT(v)->u.boolean); break;
+		case JS_CNUMBER: printf("[Number %g]", JSV_OBJECT(v)->u.number); break;
+		case JS_CSTRING: printf("[String'%s']", JSV_OBJECT(v)->u.s.string); break;
 		case JS_CERROR: printf("[Error]"); break;
-		case JS_CARGUMENTS: printf("[Arguments %p]", (void*)v.u.object); break;
-		case JS_CITERATOR: printf("[Iterator %p]", (void*)v.u.object); break;
+		case JS_CARGUMENTS: printf("[Arguments %p]", (void*)JSV_OBJECT(v)); break;
+		case JS_CITERATOR: printf("[Iterator %p]", (void*)JSV_OBJECT(v)); break;
 		case JS_CUSERDATA:
-			printf("[Userdata %s %p]", v.u.object->u.user.tag, v.u.object->u.user.data);
+			printf("[Userdata %s %p]", JSV_OBJECT(v)->u.user.tag, JSV_OBJECT(v)->u.user.data);
 			break;
-		default: printf("[Object %p]", (void*)v.u.object); break;
+		default: printf("[Object %p]", (void*)JSV_OBJECT(v)); break;
 		}
 		break;
 	}
 }
 
-static void js_dumpproperty(js_State *J, js_Property *node)
-{
-	minify = 0;
-	if (node->left->level)
-		js_dumpproperty(J, node->left);
-	printf("\t%s: ", node->name);
-	js_dumpvalue(J, node->value);
-	printf(",\n");
-	if (node->right->level)
-		js_dumpproperty(J, node->right);
-}
-
 void js_dumpobject(js_State *J, js_Object *obj)
 {
+	js_Property *ref;
 	minify = 0;
 	printf("{\n");
-	if (obj->properties->level)
-		js_dumpproperty(J, obj->properties);
+	for (ref = jsV_nextproperty(J, obj, NULL); ref; ref = jsV_nextproperty(J, obj, ref->name)) {
+		printf("\t%s: ", ref->name);
+		js_dumpvalue(J, ref->value);
+		printf(",\n");
+	}
 	printf("}\n");
 }
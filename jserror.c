@@ -14,7 +14,7 @@ static int jsB_stacktrace(js_State *J, int skip)
 	for (; n > 0; --n) {
 		const char *name = J->trace[n].name;
 		const char *file = J->trace[n].file;
-		int line = J->trace[n].line;
+		int line = js_traceline(J, n);
 		if (line > 0) {
 			if (name[0])
 				snprintf(buf, sizeof buf, "\n\tat %s (%s:%d)", name, file, line);
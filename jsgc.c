@@ -5,20 +5,73 @@
 
 #include "regexp.h"
 
-static void jsG_markobject(js_State *J, int mark, js_Object *obj);
+#include <time.h>
+
+#ifdef JS_PARALLELGC
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+/*
+	Where a thread that marks keeps its state: the mark to set, and when
+	marking in parallel, the deque to put the objects it marks on.
+*/
+
+typedef struct js_Marker js_Marker;
+typedef struct js_Worker js_Worker;
+
+struct js_Marker
+{
+	js_State *J;
+	int mark;
+#ifdef JS_PARALLELGC
+	js_Worker *w;
+#endif
+};
+
+static void jsG_markobject(js_Marker *m, js_Object *obj);
+
+static void jsG_initmarker(js_Marker *m, js_State *J, js_Worker *w)
+{
+	m->J = J;
+	m->mark = J->gcmark;
+#ifdef JS_PARALLELGC
+	m->w = w;
+#endif
+}
 
 static void jsG_freeenvironment(js_State *J, js_Environment *env)
 {
-	js_free(J, env);
+	js_slabfree(J, env, sizeof *env + env->slotcap * sizeof(js_Value));
+}
+
+static void jsG_freestring(js_State *J, js_String *str)
+{
+	if (str->size)
+		js_slabfree(J, str, str->size);
+	else
+		js_free(J, str);
 }
 
 static void jsG_freefunction(js_State *J, js_Function *fun)
 {
+	int i;
+	for (i = 0; i < fun->switchlen; ++i) {
+		js_free(J, fun->switchtab[i].jump);
+		js_free(J, fun->switchtab[i].key);
+	}
+	js_free(J, fun->switchtab);
 	js_free(J, fun->funtab);
 	js_free(J, fun->numtab);
 	js_free(J, fun->strtab);
 	js_free(J, fun->vartab);
 	js_free(J, fun->code);
+	js_free(J, fun->linetab);
+	js_free(J, fun->trytab);
+	js_free(J, fun->cachetab);
+#ifdef JS_JIT
+	jsJ_free(J, fun);
+#endif
     if(fun->codebits) {
         free(fun->codebits);
         fun->codebits = NULL;
@@ -26,26 +79,39 @@ static void jsG_freefunction(js_State *J, js_Function *fun)
 	js_free(J, fun);
 }
 
-static void jsG_freeproperty(js_State *J, js_Property *node)
+static void jsG_freeproperty(js_State *J, js_PropertyNode *node)
 {
 	if (node->left->level) jsG_freeproperty(J, node->left);
 	if (node->right->level) jsG_freeproperty(J, node->right);
-	js_free(J, node);
+	js_slabfree(J, node, sizeof *node);
+}
+
+static void jsG_freeshape(js_State *J, js_Shape *shape)
+{
+	js_Shape *kid, *next;
+	for (kid = shape->kids; kid; kid = next) {
+		next = kid->sibling;
+		jsG_freeshape(J, kid);
+	}
+	js_free(J, shape);
 }
 
 static void jsG_freeiterator(js_State *J, js_Iterator *node)
 {
 	while (node) {
 		js_Iterator *next = node->next;
-		js_free(J, node);
+		js_slabfree(J, node, sizeof *node);
 		node = next;
 	}
 }
 
 static void jsG_freeobject(js_State *J, js_Object *obj)
 {
-	if (obj->properties->level)
+	if (obj->shape)
+		js_free(J, obj->slots);
+	else if (obj->properties->level)
 		jsG_freeproperty(J, obj->properties);
+	js_free(J, obj->elements);
 	if (obj->type == JS_CREGEXP) {
 		js_free(J, obj->u.r.source);
 		js_regfreex(J->alloc, J->actx, obj->u.r.prog);
@@ -55,244 +121,882 @@ static void jsG_freeobject(js_State *J, js_Object *obj)
     if (obj->type == JS_CUSERDATA && obj->u.user.finalize) {
 		obj->u.user.finalize(J, obj->u.user.data, obj->u.user.tag);
     }
-	js_free(J, obj);
+	js_slabfree(J, obj, sizeof *obj);
+}
+
+#ifdef JS_PARALLELGC
+#define jsG_setmark(p, v) __atomic_store_n(p, v, __ATOMIC_RELAXED)
+#else
+#define jsG_setmark(p, v) (*(p) = (v))
+#endif
+
+/* Mark a function or object, and tell if it was not marked before */
+static int jsG_claim(js_Marker *m, int *gcmark)
+{
+	int old = *gcmark;
+	if (old == m->mark || old == JS_OBJ_FROZEN)
+		return 0;
+#ifdef JS_PARALLELGC
+	if (m->w)
+		return __atomic_compare_exchange_n(gcmark, &old, m->mark, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+#endif
+	*gcmark = m->mark;
+	return 1;
 }
 
-static void jsG_markfunction(js_State *J, int mark, js_Function *fun)
+static void jsG_markfunction(js_Marker *m, js_Function *fun)
 {
-    if(fun->gcmark != JS_OBJ_FROZEN) {
-        fun->gcmark = mark;
+    if(jsG_claim(m, &fun->gcmark)) {
         for (int i = 0; i < fun->funlen; ++i) {
-            if (fun->funtab[i]->gcmark != mark) {
-                jsG_markfunction(J, mark, fun->funtab[i]);
+            if (fun->funtab[i]->gcmark != m->mark) {
+                jsG_markfunction(m, fun->funtab[i]);
             }
         }
     }
 }
 
-static void jsG_markenvironment(js_State *J, int mark, js_Environment *env)
+static void jsG_markvalues(js_Marker *m, js_Value *v, int n)
+{
+	int mark = m->mark;
+	while (n--) {
+		if (JSV_TYPE(*v) == JS_TMEMSTR && JSV_MEMSTR(*v)->gcmark != mark && JSV_MEMSTR(*v)->gcmark != JS_OBJ_FROZEN)
+			jsG_setmark(&JSV_MEMSTR(*v)->gcmark, mark);
+		if (JSV_TYPE(*v) == JS_TOBJECT && JSV_OBJECT(*v)->gcmark != mark && JSV_OBJECT(*v)->gcmark != JS_OBJ_FROZEN)
+			jsG_markobject(m, JSV_OBJECT(*v));
+		++v;
+	}
+}
+
+static void jsG_markenvironment(js_Marker *m, js_Environment *env)
 {
+	int mark = m->mark;
 	do {
-		env->gcmark = env->gcmark == JS_OBJ_FROZEN ? JS_OBJ_FROZEN : mark;
-        if (env->variables->gcmark != mark) {
-			jsG_markobject(J, mark, env->variables);
-        }
+		if (env->gcmark != JS_OBJ_FROZEN)
+			jsG_setmark(&env->gcmark, mark);
+		if (env->slots) {
+			if (env->function->gcmark != mark)
+				jsG_markfunction(m, env->function);
+			jsG_markvalues(m, env->slots, env->function->varlen);
+		} else if (env->variables->gcmark != mark) {
+			jsG_markobject(m, env->variables);
+		}
 		env = env->outer;
 	} while (env && env->gcmark != mark);
 }
 
-static void jsG_markproperty(js_State *J, int mark, js_Property *node)
+static void jsG_markproperty(js_Marker *m, js_Property *node)
 {
-	if (node->left->level) jsG_markproperty(J, mark, node->left);
-	if (node->right->level) jsG_markproperty(J, mark, node->right);
-
-	if (node->value.type == JS_TMEMSTR && node->value.u.memstr->gcmark != mark && node->value.u.memstr->gcmark != JS_OBJ_FROZEN)
-		node->value.u.memstr->gcmark = mark;
-	if (node->value.type == JS_TOBJECT && node->value.u.object->gcmark != mark && node->value.u.object->gcmark != JS_OBJ_FROZEN)
-		jsG_markobject(J, mark, node->value.u.object);
+	int mark = m->mark;
+	if (JSV_TYPE(node->value) == JS_TMEMSTR && JSV_MEMSTR(node->value)->gcmark != mark && JSV_MEMSTR(node->value)->gcmark != JS_OBJ_FROZEN)
+		jsG_setmark(&JSV_MEMSTR(node->value)->gcmark, mark);
+	if (JSV_TYPE(node->value) == JS_TOBJECT && JSV_OBJECT(node->value)->gcmark != mark && JSV_OBJECT(node->value)->gcmark != JS_OBJ_FROZEN)
+		jsG_markobject(m, JSV_OBJECT(node->value));
 	if (node->getter && node->getter->gcmark != mark && node->getter->gcmark != JS_OBJ_FROZEN)
-		jsG_markobject(J, mark, node->getter);
+		jsG_markobject(m, node->getter);
 	if (node->setter && node->setter->gcmark != mark && node->setter->gcmark != JS_OBJ_FROZEN)
-		jsG_markobject(J, mark, node->setter);
+		jsG_markobject(m, node->setter);
 }
 
-static void jsG_markobject(js_State *J, int mark, js_Object *obj)
+static void jsG_markpropertytree(js_Marker *m, js_PropertyNode *node)
 {
-    if(obj->gcmark == JS_OBJ_FROZEN) {
-        return;
-    }
-	obj->gcmark = mark;
-	if (obj->properties->level)
-		jsG_markproperty(J, mark, obj->properties);
+	/* an AA tree is at most twice as deep as the level of its root */
+	js_PropertyNode *stack[64];
+	int top = 0;
+	for (;;) {
+		jsG_markproperty(m, &node->prop);
+		if (node->right->level)
+			stack[top++] = node->right;
+		if (node->left->level)
+			node = node->left;
+		else if (top > 0)
+			node = stack[--top];
+		else
+			break;
+	}
+}
+
+/*
+	Marking is tri-color. A marked object is gray while it waits on the
+	J->gcgray stack for its properties and elements to be marked, and black
+	once they have been. Environments, functions and strings have nothing
+	worth deferring and are scanned as soon as they are reached; functions
+	nest no deeper than the parser allows.
+
+	If the stack cannot grow, the object is left marked but unscanned and
+	J->gcgrayoverflow is set. Once the stack is empty, the object lists are
+	searched again for marked objects to scan (see jsG_rescan).
+*/
+
+#if defined(__GNUC__)
+#define jsG_prefetch(p) __builtin_prefetch(p)
+#else
+#define jsG_prefetch(p) (void)0
+#endif
+
+static void jsG_pushgray(js_State *J, js_Object *obj)
+{
+	if (J->gcgraytop == J->gcgraycap) {
+		int cap = J->gcgraycap ? J->gcgraycap * 2 : 1024;
+		js_Object **gray = J->alloc(J->actx, J->gcgray, cap * sizeof *gray);
+		if (!gray) {
+			J->gcgrayoverflow = 1;
+			return;
+		}
+		J->gcgray = gray;
+		J->gcgraycap = cap;
+	}
+	J->gcgray[J->gcgraytop++] = obj;
+}
+
+#ifdef JS_PARALLELGC
+static void jsG_pushworker(js_Worker *w, js_Object *obj);
+#endif
+
+static void jsG_markobject(js_Marker *m, js_Object *obj)
+{
+	if (!jsG_claim(m, &obj->gcmark))
+		return;
+#ifdef JS_PARALLELGC
+	if (m->w) {
+		jsG_pushworker(m->w, obj);
+		return;
+	}
+#endif
+	jsG_pushgray(m->J, obj);
+}
+
+/* Mark what a gray object points to, and return how much work that was */
+static int jsG_scanobject(js_Marker *m, js_Object *obj)
+{
+	int mark = m->mark;
+	int i;
+	if (obj->shape) {
+		for (i = 0; i < obj->count; ++i)
+			jsG_markproperty(m, &obj->slots[i]);
+	} else if (obj->properties->level) {
+		jsG_markpropertytree(m, obj->properties);
+	}
+	for (i = 0; i < obj->elemlen; ++i) {
+		js_Value *v = &obj->elements[i];
+		if (JSV_TYPE(*v) == JS_TMEMSTR && JSV_MEMSTR(*v)->gcmark != mark && JSV_MEMSTR(*v)->gcmark != JS_OBJ_FROZEN)
+			jsG_setmark(&JSV_MEMSTR(*v)->gcmark, mark);
+		if (JSV_TYPE(*v) == JS_TOBJECT && JSV_OBJECT(*v)->gcmark != mark && JSV_OBJECT(*v)->gcmark != JS_OBJ_FROZEN)
+			jsG_markobject(m, JSV_OBJECT(*v));
+	}
 	if (obj->prototype && obj->prototype->gcmark != mark)
-		jsG_markobject(J, mark, obj->prototype);
+		jsG_markobject(m, obj->prototype);
 	if (obj->type == JS_CITERATOR) {
-		jsG_markobject(J, mark, obj->u.iter.target);
+		jsG_markobject(m, obj->u.iter.target);
 	}
 	if (obj->type == JS_CFUNCTION || obj->type == JS_CSCRIPT) {
 		if (obj->u.f.scope && obj->u.f.scope->gcmark != mark)
-			jsG_markenvironment(J, mark, obj->u.f.scope);
+			jsG_markenvironment(m, obj->u.f.scope);
 		if (obj->u.f.function && obj->u.f.function->gcmark != mark)
-			jsG_markfunction(J, mark, obj->u.f.function);
+			jsG_markfunction(m, obj->u.f.function);
 	}
+	return 1 + obj->count + obj->elemlen;
 }
 
-static void jsG_markstack(js_State *J, int mark)
+static void jsG_markstack(js_Marker *m)
 {
-	js_Value *v = J->stack;
-	int n = J->top;
-	while (n--) {
-		if (v->type == JS_TMEMSTR && v->u.memstr->gcmark != mark && v->u.memstr->gcmark != JS_OBJ_FROZEN)
-			v->u.memstr->gcmark = mark;
-		if (v->type == JS_TOBJECT && v->u.object->gcmark != mark && v->u.object->gcmark != JS_OBJ_FROZEN)
-			jsG_markobject(J, mark, v->u.object);
-		++v;
-	}
+	jsG_markvalues(m, m->J->stack, m->J->top);
 }
 
-void js_gc(js_State *J, int report)
+static void jsG_markroots(js_Marker *m)
 {
-	js_Function *fun, *nextfun, **prevnextfun;
-	js_Object *obj, *nextobj, **prevnextobj;
-	js_String *str, *nextstr, **prevnextstr;
-	js_Environment *env, *nextenv, **prevnextenv;
-	int nenv = 0, nfun = 0, nobj = 0, nstr = 0;
-	int genv = 0, gfun = 0, gobj = 0, gstr = 0;
-	int mark;
+	js_State *J = m->J;
 	int i;
-    int frozen = 0, sum = 0;
 
-	if (J->gcpause) {
-		if (report)
-			js_report(J, "garbage collector is paused");
-		return;
-	}
+	jsG_markobject(m, J->Object_prototype);
+	jsG_markobject(m, J->Array_prototype);
+	jsG_markobject(m, J->Function_prototype);
+	jsG_markobject(m, J->Boolean_prototype);
+	jsG_markobject(m, J->Number_prototype);
+	jsG_markobject(m, J->String_prototype);
+	jsG_markobject(m, J->RegExp_prototype);
+	jsG_markobject(m, J->Date_prototype);
 
-	J->gccounter = 0;
+	jsG_markobject(m, J->Error_prototype);
+	jsG_markobject(m, J->EvalError_prototype);
+	jsG_markobject(m, J->RangeError_prototype);
+	jsG_markobject(m, J->ReferenceError_prototype);
+	jsG_markobject(m, J->SyntaxError_prototype);
+	jsG_markobject(m, J->TypeError_prototype);
+	jsG_markobject(m, J->URIError_prototype);
 
-    if(J->gcmark == JS_OBJ_FROZEN) {
-        mark = JS_OBJ_FROZEN;
-    } else {
-        mark = J->gcmark = (J->gcmark == 1 ? 2 : 1);
-    }
+	jsG_markobject(m, J->R);
+	jsG_markobject(m, J->G);
+
+	jsG_markstack(m);
 
-	jsG_markobject(J, mark, J->Object_prototype);
-	jsG_markobject(J, mark, J->Array_prototype);
-	jsG_markobject(J, mark, J->Function_prototype);
-	jsG_markobject(J, mark, J->Boolean_prototype);
-	jsG_markobject(J, mark, J->Number_prototype);
-	jsG_markobject(J, mark, J->String_prototype);
-	jsG_markobject(J, mark, J->RegExp_prototype);
-	jsG_markobject(J, mark, J->Date_prototype);
-
-	jsG_markobject(J, mark, J->Error_prototype);
-	jsG_markobject(J, mark, J->EvalError_prototype);
-	jsG_markobject(J, mark, J->RangeError_prototype);
-	jsG_markobject(J, mark, J->ReferenceError_prototype);
-	jsG_markobject(J, mark, J->SyntaxError_prototype);
-	jsG_markobject(J, mark, J->TypeError_prototype);
-	jsG_markobject(J, mark, J->URIError_prototype);
-
-	jsG_markobject(J, mark, J->R);
-	jsG_markobject(J, mark, J->G);
-
-	jsG_markstack(J, mark);
-
-	jsG_markenvironment(J, mark, J->E);
-	jsG_markenvironment(J, mark, J->GE);
+	jsG_markenvironment(m, J->E);
+	jsG_markenvironment(m, J->GE);
 	for (i = 0; i < J->envtop; ++i)
-		jsG_markenvironment(J, mark, J->envstack[i]);
-
-	prevnextenv = &J->gcenv;
-	for (env = J->gcenv; env; env = nextenv) {
-		nextenv = env->gcnext;
-        ++sum;
-        if(J->gcmark == JS_OBJ_FROZEN) {
-            ++frozen;
-            env->gcmark = JS_OBJ_FROZEN;
-            prevnextenv = &env->gcnext;
-        } else if (env->gcmark != mark && env->gcmark != JS_OBJ_FROZEN) {
-			*prevnextenv = nextenv;
-			jsG_freeenvironment(J, env);
-			++genv;
+		jsG_markenvironment(m, J->envstack[i]);
+}
+
+/*
+	Generations. Everything is allocated young, with a gcmark of 0. What
+	survives a collection moves to the old lists and keeps the mark of the
+	collection (J->gcmark), so a young collection marks with the same value
+	and stops wherever it reaches an old object. The remembered objects and
+	environments (see JSG_BARRIER and JSG_SCOPE) are old ones that may point
+	to young ones; they are marked through as extra roots. A full collection
+	flips the mark and sweeps both lists.
+
+	The same barriers keep a full collection correct when it is marked in
+	steps between runs of the program (see js_setgcbudget): a black object
+	that is given a white value is remembered, and marked again before the
+	sweep. Remembered things are live, so the sweep keeps them too.
+*/
+
+void jsG_remember(js_State *J, js_Object *obj)
+{
+	if (J->gcremtop == J->gcremcap) {
+		int cap = J->gcremcap ? J->gcremcap * 2 : 64;
+		J->gcrem = js_realloc(J, J->gcrem, cap * sizeof *J->gcrem);
+		J->gcremcap = cap;
+	}
+	obj->gcmark = JS_OBJ_REMEMBERED;
+	J->gcrem[J->gcremtop++] = obj;
+}
+
+void jsG_scope(js_State *J, js_Environment *E)
+{
+	while (E && E->gcmark == J->gcmark) {
+		if (J->gcscopetop == J->gcscopecap) {
+			int cap = J->gcscopecap ? J->gcscopecap * 2 : 64;
+			J->gcscope = js_realloc(J, J->gcscope, cap * sizeof *J->gcscope);
+			J->gcscopecap = cap;
+		}
+		E->gcmark = JS_OBJ_REMEMBERED;
+		J->gcscope[J->gcscopetop++] = E;
+		E = E->outer;
+	}
+}
+
+/* The environments code is running in may be written after marking */
+static void jsG_keepscope(js_State *J, js_Environment *E)
+{
+	for (; E; E = E->outer)
+		if (E->gcmark == J->gcmark)
+			jsG_scope(J, E);
+}
+
+static void jsG_keepscopes(js_State *J)
+{
+	int i;
+
+	/* pooled environments are not on the lists, and are never remembered */
+	for (i = 0; i < J->pooltop; ++i)
+		J->envpool[i]->gcmark = 0;
+
+	if (J->gcmark != JS_OBJ_FROZEN) {
+		jsG_keepscope(J, J->E);
+		for (i = 0; i < J->envtop; ++i)
+			jsG_keepscope(J, J->envstack[i]);
+	}
+}
+
+static int jsG_sweepenvironments(js_State *J, js_Environment **list, int work)
+{
+	js_Environment *env;
+	int mark = J->gcmark;
+	while ((env = *list) && work-- > 0) {
+		*list = env->gcnext;
+		++J->gcswept[0];
+		if (mark == JS_OBJ_FROZEN)
+			env->gcmark = JS_OBJ_FROZEN;
+		if (env->gcmark == mark || env->gcmark == JS_OBJ_FROZEN || env->gcmark == JS_OBJ_REMEMBERED) {
+			J->gcfrozen += env->gcmark == JS_OBJ_FROZEN;
+			env->gcnext = J->gcoldenv;
+			J->gcoldenv = env;
+			++J->gcoldcount;
 		} else {
-            frozen += (env->gcmark == JS_OBJ_FROZEN ? 1 : 0);
-			prevnextenv = &env->gcnext;
+			jsG_freeenvironment(J, env);
+			++J->gcfreed[0];
 		}
-		++nenv;
 	}
+	return work;
+}
 
-    prevnextfun = &J->gcfun;
-    for (fun = J->gcfun; fun; fun = nextfun) {
-        nextfun = fun->gcnext;
-        ++sum;
-        if(J->gcmark == JS_OBJ_FROZEN) {
-            ++frozen;
-            fun->gcmark = JS_OBJ_FROZEN;
-            prevnextfun = &fun->gcnext;
-        } else if (fun->gcmark != mark && fun->gcmark != JS_OBJ_FROZEN) {
-            *prevnextfun = nextfun;
-            jsG_freefunction(J, fun);
-            ++gfun;
-        } else {
-            frozen += (fun->gcmark == JS_OBJ_FROZEN ? 1 : 0);
-            prevnextfun = &fun->gcnext;
-        }
-        ++nfun;
-    }
+static int jsG_sweepfunctions(js_State *J, js_Function **list, int work)
+{
+	js_Function *fun;
+	int mark = J->gcmark;
+	while ((fun = *list) && work-- > 0) {
+		*list = fun->gcnext;
+		++J->gcswept[1];
+		if (mark == JS_OBJ_FROZEN)
+			fun->gcmark = JS_OBJ_FROZEN;
+		if (fun->gcmark == mark || fun->gcmark == JS_OBJ_FROZEN || fun->gcmark == JS_OBJ_REMEMBERED) {
+			J->gcfrozen += fun->gcmark == JS_OBJ_FROZEN;
+			fun->gcnext = J->gcoldfun;
+			J->gcoldfun = fun;
+			++J->gcoldcount;
+		} else {
+			jsG_freefunction(J, fun);
+			++J->gcfreed[1];
+		}
+	}
+	return work;
+}
 
-	prevnextobj = &J->gcobj;
-	for (obj = J->gcobj; obj; obj = nextobj) {
-		nextobj = obj->gcnext;
-        ++sum;
-        if(J->gcmark == JS_OBJ_FROZEN) {
-            ++frozen;
-            obj->gcmark = JS_OBJ_FROZEN;
-            prevnextobj = &obj->gcnext;
-        } else if (obj->gcmark != mark && obj->gcmark != JS_OBJ_FROZEN) {
-			*prevnextobj = nextobj;
-			jsG_freeobject(J, obj);
-			++gobj;
+static int jsG_sweepobjects(js_State *J, js_Object **list, int work)
+{
+	js_Object *obj;
+	int mark = J->gcmark;
+	while ((obj = *list) && work-- > 0) {
+		*list = obj->gcnext;
+		++J->gcswept[2];
+		if (mark == JS_OBJ_FROZEN)
+			obj->gcmark = JS_OBJ_FROZEN;
+		if (obj->gcmark == mark || obj->gcmark == JS_OBJ_FROZEN || obj->gcmark == JS_OBJ_REMEMBERED) {
+			J->gcfrozen += obj->gcmark == JS_OBJ_FROZEN;
+			obj->gcnext = J->gcoldobj;
+			J->gcoldobj = obj;
+			++J->gcoldcount;
 		} else {
-            frozen += (obj->gcmark == JS_OBJ_FROZEN ? 1 : 0);
-			prevnextobj = &obj->gcnext;
+			jsG_freeobject(J, obj);
+			++J->gcfreed[2];
 		}
-		++nobj;
-	}
-
-	prevnextstr = &J->gcstr;
-	for (str = J->gcstr; str; str = nextstr) {
-		nextstr = str->gcnext;
-        ++sum;
-        if(J->gcmark == JS_OBJ_FROZEN) {
-            ++frozen;
-            str->gcmark = JS_OBJ_FROZEN;
-            prevnextstr = &str->gcnext;
-        } else if (str->gcmark != mark && str->gcmark != JS_OBJ_FROZEN) {
-			*prevnextstr = nextstr;
-			js_free(J, str);
-			++gstr;
+	}
+	return work;
+}
+
+static int jsG_sweepstrings(js_State *J, js_String **list, int work)
+{
+	js_String *str;
+	int mark = J->gcmark;
+	while ((str = *list) && work-- > 0) {
+		*list = str->gcnext;
+		++J->gcswept[3];
+		if (mark == JS_OBJ_FROZEN)
+			str->gcmark = JS_OBJ_FROZEN;
+		if (str->gcmark == mark || str->gcmark == JS_OBJ_FROZEN) {
+			J->gcfrozen += str->gcmark == JS_OBJ_FROZEN;
+			str->gcnext = J->gcoldstr;
+			J->gcoldstr = str;
+			++J->gcoldcount;
 		} else {
-            frozen += (str->gcmark == JS_OBJ_FROZEN ? 1 : 0);
-			prevnextstr = &str->gcnext;
+			jsG_freestring(J, str);
+			++J->gcfreed[3];
+		}
+	}
+	return work;
+}
+
+/*
+	A collection marks from the roots, finishes marking with the program
+	stopped, and sweeps. Between the steps of an incremental one, the
+	program runs and allocates young; the lists to sweep are set aside
+	when marking is done, so nothing allocated after that is swept.
+*/
+
+enum { JS_GCIDLE, JS_GCMARK, JS_GCSWEEP };
+
+/* Microseconds since some fixed time; processor time without threads */
+static double jsG_clock(void)
+{
+#ifdef JS_PARALLELGC
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+#else
+	return clock() * (1e6 / CLOCKS_PER_SEC);
+#endif
+}
+
+#define JS_GCWORK 1024 /* objects scanned or swept between looks at the clock */
+
+static void jsG_beginmark(js_State *J, int full)
+{
+	js_Marker m;
+	int i;
+
+	J->gcstate = JS_GCMARK;
+	J->gcfull = full;
+	for (i = 0; i < 4; ++i)
+		J->gcswept[i] = J->gcfreed[i] = 0;
+	J->gcfrozen = 0;
+	J->gctime = 0;
+
+	if (full) {
+		if (J->gcmark != JS_OBJ_FROZEN)
+			J->gcmark = (J->gcmark == 1 ? 2 : 1);
+		while (J->gcremtop > 0)
+			J->gcrem[--J->gcremtop]->gcmark = 0;
+		while (J->gcscopetop > 0)
+			J->gcscope[--J->gcscopetop]->gcmark = 0;
+	}
+
+	jsG_initmarker(&m, J, NULL);
+	jsG_markroots(&m);
+}
+
+static int jsG_scangray(js_Marker *m, int work)
+{
+	js_State *J = m->J;
+	js_Object *obj;
+	while (J->gcgraytop > 0 && work > 0) {
+		obj = J->gcgray[--J->gcgraytop];
+		if (J->gcgraytop > 0)
+			jsG_prefetch(J->gcgray[J->gcgraytop - 1]);
+		work -= jsG_scanobject(m, obj);
+	}
+	return work;
+}
+
+/* Scan every marked object again, for those that did not fit on the stack */
+static void jsG_rescan(js_Marker *m)
+{
+	js_State *J = m->J;
+	js_Object *obj;
+	int k;
+	J->gcgrayoverflow = 0;
+	for (k = 0; k < 2; ++k) {
+		for (obj = k ? J->gcoldobj : J->gcobj; obj; obj = obj->gcnext) {
+			if (obj->gcmark == m->mark) {
+				jsG_scanobject(m, obj);
+				jsG_scangray(m, INT_MAX);
+			}
+		}
+	}
+}
+
+/* Mark the remembered objects and environments, and scan gray objects */
+static int jsG_mark(js_State *J, int work)
+{
+	js_Marker m;
+
+	jsG_initmarker(&m, J, NULL);
+
+	while (J->gcremtop > 0)
+		jsG_markobject(&m, J->gcrem[--J->gcremtop]);
+	while (J->gcscopetop > 0)
+		jsG_markenvironment(&m, J->gcscope[--J->gcscopetop]);
+
+	work = jsG_scangray(&m, work);
+	if (J->gcgraytop > 0)
+		return 0;
+
+	while (J->gcgrayoverflow)
+		jsG_rescan(&m);
+
+	return 1;
+}
+
+#ifdef JS_PARALLELGC
+
+/*
+	Parallel marking, for full collections when js_setgcthreads has asked
+	for more than one thread. Each thread scans the objects on its own
+	deque, and steals from the far end of the others' deques when it runs
+	out (Chase and Lev's work-stealing deque). Objects are claimed by
+	setting their mark with a compare-and-swap, so only one thread scans
+	each. A deque that fills up spills onto the gray stack, which is shared
+	under a lock. Marking is done when every thread is out of work at once.
+*/
+
+#define JS_GCDEQUE 4096 /* objects on the deque of a marking thread (a power of two) */
+
+typedef struct js_Team js_Team;
+
+struct js_Worker
+{
+	js_Marker m;
+	js_Team *team;
+	long top, bottom;
+	js_Object *deque[JS_GCDEQUE];
+	pthread_t thread;
+};
+
+struct js_Team
+{
+	pthread_mutex_t lock; /* for the gray stack */
+	int n, idle, go;
+	js_Worker *w;
+};
+
+static int jsG_pushdeque(js_Worker *w, js_Object *obj)
+{
+	long b = __atomic_load_n(&w->bottom, __ATOMIC_RELAXED);
+	long t = __atomic_load_n(&w->top, __ATOMIC_ACQUIRE);
+	if (b - t >= JS_GCDEQUE)
+		return 0;
+	__atomic_store_n(&w->deque[b & (JS_GCDEQUE - 1)], obj, __ATOMIC_RELAXED);
+	__atomic_store_n(&w->bottom, b + 1, __ATOMIC_RELEASE);
+	return 1;
+}
+
+static js_Object *jsG_popdeque(js_Worker *w)
+{
+	long b = __atomic_load_n(&w->bottom, __ATOMIC_RELAXED) - 1;
+	long t;
+	js_Object *obj;
+	__atomic_store_n(&w->bottom, b, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	t = __atomic_load_n(&w->top, __ATOMIC_RELAXED);
+	if (t > b) {
+		__atomic_store_n(&w->bottom, b + 1, __ATOMIC_RELAXED);
+		return NULL;
+	}
+	obj = __atomic_load_n(&w->deque[b & (JS_GCDEQUE - 1)], __ATOMIC_RELAXED);
+	if (t == b) {
+		/* the last one; a thief may be taking it too */
+		if (!__atomic_compare_exchange_n(&w->top, &t, t + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+			obj = NULL;
+		__atomic_store_n(&w->bottom, b + 1, __ATOMIC_RELAXED);
+	}
+	return obj;
+}
+
+static js_Object *jsG_stealdeque(js_Worker *w)
+{
+	long t = __atomic_load_n(&w->top, __ATOMIC_ACQUIRE);
+	long b;
+	js_Object *obj;
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	b = __atomic_load_n(&w->bottom, __ATOMIC_ACQUIRE);
+	if (t >= b)
+		return NULL;
+	obj = __atomic_load_n(&w->deque[t & (JS_GCDEQUE - 1)], __ATOMIC_RELAXED);
+	if (!__atomic_compare_exchange_n(&w->top, &t, t + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+		return NULL;
+	return obj;
+}
+
+static void jsG_pushworker(js_Worker *w, js_Object *obj)
+{
+	if (!jsG_pushdeque(w, obj)) {
+		pthread_mutex_lock(&w->team->lock);
+		jsG_pushgray(w->m.J, obj);
+		pthread_mutex_unlock(&w->team->lock);
+	}
+}
+
+/* Take an object to scan from another thread, or a batch from the gray stack */
+static js_Object *jsG_findwork(js_Worker *w)
+{
+	js_Team *team = w->team;
+	js_State *J = w->m.J;
+	js_Object *obj = NULL;
+	int i, k;
+
+	for (i = 1; i < team->n; ++i) {
+		k = (w - team->w + i) % team->n;
+		if ((obj = jsG_stealdeque(&team->w[k])))
+			return obj;
+	}
+
+	pthread_mutex_lock(&team->lock);
+	if (J->gcgraytop > 0) {
+		obj = J->gcgray[--J->gcgraytop];
+		for (k = 0; k < JS_GCDEQUE / 4 && J->gcgraytop > 0; ++k)
+			jsG_pushdeque(w, J->gcgray[--J->gcgraytop]);
+	}
+	pthread_mutex_unlock(&team->lock);
+	return obj;
+}
+
+static int jsG_haswork(js_Team *team)
+{
+	int i, gray;
+	for (i = 0; i < team->n; ++i)
+		if (__atomic_load_n(&team->w[i].top, __ATOMIC_ACQUIRE) < __atomic_load_n(&team->w[i].bottom, __ATOMIC_ACQUIRE))
+			return 1;
+	pthread_mutex_lock(&team->lock);
+	gray = team->w->m.J->gcgraytop > 0;
+	pthread_mutex_unlock(&team->lock);
+	return gray;
+}
+
+static void *jsG_markworker(void *arg)
+{
+	js_Worker *w = arg;
+	js_Team *team = w->team;
+	js_Object *obj;
+
+	while (!__atomic_load_n(&team->go, __ATOMIC_ACQUIRE))
+		sched_yield();
+
+	for (;;) {
+		while ((obj = jsG_popdeque(w)) || (obj = jsG_findwork(w)))
+			jsG_scanobject(&w->m, obj);
+
+		/* only a thread with work can make more, so once all are idle it is done */
+		__atomic_add_fetch(&team->idle, 1, __ATOMIC_SEQ_CST);
+		while (!jsG_haswork(team)) {
+			if (__atomic_load_n(&team->idle, __ATOMIC_SEQ_CST) == team->n)
+				return NULL;
+			sched_yield();
 		}
-		++nstr;
+		__atomic_sub_fetch(&team->idle, 1, __ATOMIC_SEQ_CST);
+	}
+}
+
+/* Scan the gray stack with the calling thread and J->gcthreads - 1 others */
+static void jsG_parallelmark(js_State *J)
+{
+	js_Team team;
+	int i, n;
+
+	team.w = J->alloc(J->actx, NULL, J->gcthreads * sizeof *team.w);
+	if (!team.w)
+		return;
+	pthread_mutex_init(&team.lock, NULL);
+	team.idle = team.go = 0;
+
+	for (i = 0; i < J->gcthreads; ++i) {
+		jsG_initmarker(&team.w[i].m, J, &team.w[i]);
+		team.w[i].team = &team;
+		team.w[i].top = team.w[i].bottom = 0;
+	}
+	for (n = 1; n < J->gcthreads; ++n)
+		if (pthread_create(&team.w[n].thread, NULL, jsG_markworker, &team.w[n]))
+			break;
+
+	/* the threads wait until they know how many of them were started */
+	team.n = n;
+	__atomic_store_n(&team.go, 1, __ATOMIC_RELEASE);
+	jsG_markworker(&team.w[0]);
+	for (i = 1; i < n; ++i)
+		pthread_join(team.w[i].thread, NULL);
+
+	pthread_mutex_destroy(&team.lock);
+	J->alloc(J->actx, team.w, 0);
+}
+
+#endif
+
+static void jsG_finishmark(js_State *J)
+{
+	js_Marker m;
+
+	jsG_initmarker(&m, J, NULL);
+	jsG_markroots(&m);
+#ifdef JS_PARALLELGC
+	if (J->gcfull && J->gcthreads > 1) {
+		jsG_mark(J, 0);
+		jsG_parallelmark(J);
+	}
+#endif
+	while (!jsG_mark(J, INT_MAX))
+		;
+
+	jsG_keepscopes(J);
+
+	J->gcsweepenv[0] = J->gcenv;
+	J->gcsweepfun[0] = J->gcfun;
+	J->gcsweepobj[0] = J->gcobj;
+	J->gcsweepstr[0] = J->gcstr;
+	J->gcenv = NULL;
+	J->gcfun = NULL;
+	J->gcobj = NULL;
+	J->gcstr = NULL;
+
+	if (J->gcfull) {
+		J->gcsweepenv[1] = J->gcoldenv;
+		J->gcsweepfun[1] = J->gcoldfun;
+		J->gcsweepobj[1] = J->gcoldobj;
+		J->gcsweepstr[1] = J->gcoldstr;
+		J->gcoldenv = NULL;
+		J->gcoldfun = NULL;
+		J->gcoldobj = NULL;
+		J->gcoldstr = NULL;
+		J->gcoldcount = 0;
+	}
+
+	J->gcstate = JS_GCSWEEP;
+}
+
+/* Finalizers may allocate and write to old objects while this runs */
+static int jsG_sweep(js_State *J, int work)
+{
+	int k;
+	for (k = 0; k < 2; ++k) {
+		work = jsG_sweepenvironments(J, &J->gcsweepenv[k], work);
+		work = jsG_sweepfunctions(J, &J->gcsweepfun[k], work);
+		work = jsG_sweepobjects(J, &J->gcsweepobj[k], work);
+		work = jsG_sweepstrings(J, &J->gcsweepstr[k], work);
+	}
+
+	/* freed objects and environments may be reused by inline cache keys */
+	++J->propversion;
+
+	return work > 0;
+}
+
+static void jsG_endcycle(js_State *J, int report)
+{
+	J->gcstate = JS_GCIDLE;
+
+	if (J->gcfull) {
+		J->gcoldlimit = J->gcoldcount * JS_GCGROWTH;
+		if (J->gcoldlimit < JS_GCLIMIT)
+			J->gcoldlimit = JS_GCLIMIT;
+		js_slabrelease(J);
 	}
 
 	if (report) {
 		char buf[256];
-		snprintf(buf, sizeof buf, "garbage collected: %d/%d envs, %d/%d funs, %d/%d objs, %d/%d strs, %d/%d frozen",
-			genv, nenv, gfun, nfun, gobj, nobj, gstr, nstr, frozen, sum);
+		snprintf(buf, sizeof buf, "garbage collected (%s): %d/%d envs, %d/%d funs, %d/%d objs, %d/%d strs, %d/%d frozen, paused %.0f us",
+			J->gcfull == 2 ? "incremental" : J->gcfull ? "full" : "young",
+			J->gcfreed[0], J->gcswept[0], J->gcfreed[1], J->gcswept[1],
+			J->gcfreed[2], J->gcswept[2], J->gcfreed[3], J->gcswept[3],
+			J->gcfrozen, J->gcswept[0] + J->gcswept[1] + J->gcswept[2] + J->gcswept[3],
+			J->gctime);
 		js_report(J, buf);
 	}
 }
+
+static void jsG_collect(js_State *J, double start, int full, int report)
+{
+	jsG_beginmark(J, full);
+	jsG_finishmark(J);
+	jsG_sweep(J, INT_MAX);
+	J->gctime = jsG_clock() - start;
+	jsG_endcycle(J, report);
+}
+
+/* Run an incremental collection until the time budget from start is spent */
+static void jsG_step(js_State *J, double start, int report)
+{
+	double stop = start + J->gcbudget;
+
+	if (J->gcstate == JS_GCMARK) {
+		while (!jsG_mark(J, JS_GCWORK)) {
+			if (jsG_clock() >= stop) {
+				jsG_keepscopes(J);
+				J->gctime += jsG_clock() - start;
+				return;
+			}
+		}
+		jsG_finishmark(J);
+	}
+
+	while (!jsG_sweep(J, JS_GCWORK)) {
+		if (jsG_clock() >= stop) {
+			J->gctime += jsG_clock() - start;
+			return;
+		}
+	}
+
+	J->gctime += jsG_clock() - start;
+	jsG_endcycle(J, report);
+}
+
+/* Run an interrupted collection to the end */
+static void jsG_finish(js_State *J)
+{
+	if (J->gcstate == JS_GCMARK)
+		jsG_finishmark(J);
+	if (J->gcstate == JS_GCSWEEP) {
+		jsG_sweep(J, INT_MAX);
+		jsG_endcycle(J, 0);
+	}
+}
+
+/*
+	Called when enough has been allocated. Collect the young generation, or
+	the old one too when it has grown enough, incrementally if there is a
+	time budget. Steps of an incremental collection come every JS_GCSTEP
+	allocations until it is done.
+*/
+void jsG_gc(js_State *J, int report)
+{
+	double start = jsG_clock();
+	int full;
+
+	if (J->gcpause) {
+		if (report)
+			js_report(J, "garbage collector is paused");
+		return;
+	}
+
+	J->gccounter = 0;
+
+	if (J->gcstate == JS_GCIDLE) {
+		full = J->gcoldcount >= J->gcoldlimit || J->gcmark == JS_OBJ_FROZEN;
+		if (!full || J->gcbudget <= 0 || J->gcmark == JS_OBJ_FROZEN) {
+			jsG_collect(J, start, full, report);
+			return;
+		}
+		jsG_beginmark(J, 2);
+	}
+
+	jsG_step(J, start, report);
+
+	if (J->gcstate != JS_GCIDLE)
+		J->gccounter = JS_GCLIMIT - JS_GCSTEP;
+}
+
+void js_gc(js_State *J, int report)
+{
+	double start;
+	if (J->gcpause) {
+		if (report)
+			js_report(J, "garbage collector is paused");
+		return;
+	}
+	start = jsG_clock();
+	J->gccounter = 0;
+	jsG_finish(J);
+	jsG_collect(J, start, 1, report);
+}
+
+void js_setgcbudget(js_State *J, int microseconds)
+{
+	J->gcbudget = microseconds > 0 ? microseconds : 0;
+}
+
+void js_setgcthreads(js_State *J, int n)
+{
+	J->gcthreads = n > 1 ? n : 1;
+}
+
 void js_frozen_all(js_State *J) {
-    int mark = J->gcmark;
+    int mark;
+    jsG_finish(J);
+    mark = J->gcmark;
     J->gcmark = JS_OBJ_FROZEN;
     js_gc(J, 1);
     J->gcmark = mark;
 }
 void js_frozen(js_State *J, int idx) {
     js_Value* v = js_tovalue(J, idx);
-    if(v && v->type == JS_TOBJECT && v->u.object) {
-        v->u.object->gcmark = JS_OBJ_FROZEN;
+    if(v && JSV_TYPE(*v) == JS_TOBJECT && JSV_OBJECT(*v)) {
+        JSV_OBJECT(*v)->gcmark = JS_OBJ_FROZEN;
     }
 }
+static int jsG_unlinkobject(js_Object **prevnextobj, js_Object *target) {
+    js_Object *obj;
+    for (obj = *prevnextobj; obj; obj = obj->gcnext) {
+        if(obj == target) {
+            *prevnextobj = obj->gcnext;
+            return 1;
+        }
+        prevnextobj = &obj->gcnext;
+    }
+    return 0;
+}
 void js_dispose(js_State *J, int idx) {
-    js_Object *obj, *nextobj, **prevnextobj;
     js_Value* v = js_tovalue(J, idx);
-    if(v && v->type == JS_TOBJECT && v->u.object->gcmark != JS_OBJ_FROZEN) {
-        prevnextobj = &J->gcobj;
-        for (obj = J->gcobj; obj; obj = nextobj) {
-            nextobj = obj->gcnext;
-            if(obj == v->u.object) {
-                *prevnextobj = nextobj;
-                jsG_freeobject(J, obj);
-                v->u.object = NULL;
-                break;
-            } else {
-                prevnextobj = &obj->gcnext;
+    int i;
+    jsG_finish(J);
+    if(v && JSV_TYPE(*v) == JS_TOBJECT && JSV_OBJECT(*v)->gcmark != JS_OBJ_FROZEN) {
+        js_Object *obj = JSV_OBJECT(*v);
+        if(jsG_unlinkobject(&J->gcobj, obj) || jsG_unlinkobject(&J->gcoldobj, obj)) {
+            if(obj->gcmark == JS_OBJ_REMEMBERED) {
+                for (i = 0; i < J->gcremtop; ++i) {
+                    if(J->gcrem[i] == obj) {
+                        J->gcrem[i] = J->gcrem[--J->gcremtop];
+                        break;
+                    }
+                }
             }
+            jsG_freeobject(J, obj);
+            JSV_SETOBJECT(*v, NULL);
         }
     }
 }
@@ -302,6 +1006,7 @@ void js_freestate(js_State *J)
 	js_Object *obj, *nextobj;
 	js_Environment *env, *nextenv;
 	js_String *str, *nextstr;
+	int k;
 
 	if (!J)
 		return;
@@ -320,12 +1025,63 @@ void js_freestate(js_State *J)
     }
     for (str = J->gcstr; str; str = nextstr) {
         nextstr = str->gcnext;
-        js_free(J, str);
+        jsG_freestring(J, str);
+    }
+    for (env = J->gcoldenv; env; env = nextenv) {
+        nextenv = env->gcnext;
+        jsG_freeenvironment(J, env);
+    }
+    for (fun = J->gcoldfun; fun; fun = nextfun) {
+        nextfun = fun->gcnext;
+        jsG_freefunction(J, fun);
+    }
+    for (obj = J->gcoldobj; obj; obj = nextobj) {
+        nextobj = obj->gcnext;
+        jsG_freeobject(J, obj);
+    }
+    for (str = J->gcoldstr; str; str = nextstr) {
+        nextstr = str->gcnext;
+        jsG_freestring(J, str);
     }
+    for (k = 0; k < 2; ++k) {
+        for (env = J->gcsweepenv[k]; env; env = nextenv) {
+            nextenv = env->gcnext;
+            jsG_freeenvironment(J, env);
+        }
+        for (fun = J->gcsweepfun[k]; fun; fun = nextfun) {
+            nextfun = fun->gcnext;
+            jsG_freefunction(J, fun);
+        }
+        for (obj = J->gcsweepobj[k]; obj; obj = nextobj) {
+            nextobj = obj->gcnext;
+            jsG_freeobject(J, obj);
+        }
+        for (str = J->gcsweepstr[k]; str; str = nextstr) {
+            nextstr = str->gcnext;
+            jsG_freestring(J, str);
+        }
+    }
+
+	if (J->rootshape)
+		jsG_freeshape(J, J->rootshape);
 
 	jsS_freestrings(J);
+	js_slabfreeall(J);
 
 	js_free(J, J->lexbuf.text);
+	while (J->oldstacklen > 0)
+		J->alloc(J->actx, J->oldstack[--J->oldstacklen], 0);
 	J->alloc(J->actx, J->stack, 0);
+	while (J->poollen > 0)
+		J->alloc(J->actx, J->envpool[--J->poollen], 0);
+	J->alloc(J->actx, J->envpool, 0);
+	J->alloc(J->actx, J->envstack, 0);
+	J->alloc(J->actx, J->gcrem, 0);
+	J->alloc(J->actx, J->gcscope, 0);
+	J->alloc(J->actx, J->gcgray, 0);
+	J->alloc(J->actx, J->trace, 0);
+	J->alloc(J->actx, J->frame, 0);
+	J->alloc(J->actx, J->trybuf, 0);
+	J->alloc(J->actx, (void*)J->aot, 0);
 	J->alloc(J->actx, J, 0);
 }
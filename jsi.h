@@ -12,8 +12,10 @@
 #include <math.h>
 #include <float.h>
 #include <limits.h>
+#include <stdint.h>
 
 #define JS_OBJ_FROZEN  -1
+#define JS_OBJ_REMEMBERED -2
 
 /* Microsoft Visual C */
 #ifdef _MSC_VER
@@ -59,24 +61,56 @@ void *js_realloc(js_State *J, void *ptr, int size);
 void js_free(js_State *J, void *ptr);
 void js_stacktrace(js_State *J);
 
+typedef struct js_Slab js_Slab;
+
+void *js_slaballoc(js_State *J, int size);
+void js_slabfree(js_State *J, void *ptr, int size);
+void js_slabrelease(js_State *J);
+void js_slabfreeall(js_State *J);
+
 typedef struct js_Regexp js_Regexp;
 typedef struct js_Value js_Value;
 typedef struct js_Object js_Object;
 typedef struct js_String js_String;
 typedef struct js_Ast js_Ast;
 typedef struct js_Function js_Function;
+typedef struct js_LineInfo js_LineInfo;
+typedef struct js_TryRange js_TryRange;
+typedef struct js_SwitchTable js_SwitchTable;
 typedef struct js_Environment js_Environment;
+typedef struct js_Shape js_Shape;
+typedef struct js_PropCache js_PropCache;
 typedef struct js_StringNode js_StringNode;
 typedef struct js_Jumpbuf js_Jumpbuf;
 typedef struct js_StackTrace js_StackTrace;
+typedef struct js_Frame js_Frame;
+typedef struct js_AotFunction js_AotFunction;
+typedef struct js_AotScript js_AotScript;
 
 /* Limits */
 
-#define JS_STACKSIZE 256	/* value stack size */
-#define JS_ENVLIMIT 64		/* environment stack size */
-#define JS_TRYLIMIT 64		/* exception stack size */
+#define JS_STACKSIZE 256	/* initial value stack size */
+#define JS_STACKLIMIT 65536	/* default max value stack size */
+#define JS_ENVSIZE 64		/* initial environment and call stack size */
+#define JS_ENVLIMIT 1024	/* default max call depth */
+#define JS_TRYSIZE 16		/* initial exception stack size */
+#define JS_TRYLIMIT 1024	/* default max nested try blocks */
+#define JS_OLDSTACKS 32		/* max number of times the value stack can grow in one call from C */
 #define JS_GCLIMIT 10000	/* run gc cycle every N allocations */
+#define JS_GCGROWTH 2		/* collect the old generation too when it has grown by this factor */
+#define JS_GCSTEP 1000		/* allocations between the steps of an incremental collection */
+#define JS_SLABSIZE 16384	/* bytes in each slab of small objects */
+#define JS_SLABMAX 256		/* largest allocation made from slabs, in size classes of 16 bytes */
 #define JS_ASTLIMIT 100		/* max nested expressions */
+#define JS_NESTLIMIT 1000	/* max nested arrays and objects in JSON and repr */
+#define JS_SHAPELIMIT 8192	/* max number of object shapes */
+#define JS_SHAPEPROPS 32	/* max properties in an object before it becomes a dictionary */
+#define JS_ARRAYGAP 64		/* max holes left by a write before a dense array may turn sparse */
+#define JS_CACHEWAYS 4		/* inline cache entries per property access instruction */
+#define JS_DEOPTLIMIT 64	/* max quickened opcodes a function reverts before it stops quickening */
+#define JS_JITHOT 1000		/* calls and backward jumps before a function is compiled to machine code */
+#define JS_SWITCHCASES 4	/* min constant cases for a switch to jump through a table */
+#define JS_INLINESIZE 16	/* max code length and locals of a leaf function that is run at its call sites */
 
 /* instruction size -- change to int if you get integer overflow syntax errors */
 typedef unsigned short js_Instruction;
@@ -94,6 +128,25 @@ void js_fmtexp(char *p, int e);
 int js_grisu2(double v, char *buffer, int *K);
 double js_strtod(const char *as, char **aas);
 
+/* Native code for scripts compiled ahead of time by mujs-aot */
+
+typedef void (*js_NativeCode)(js_State *J, int pc);
+
+struct js_AotFunction
+{
+	int codelen;
+	unsigned int checksum; /* of the bytecode the native code was made from */
+	js_NativeCode run; /* NULL if the function stays in the interpreter */
+};
+
+struct js_AotScript
+{
+	int count; /* functions in compile order, the script itself first */
+	const js_AotFunction *funs;
+};
+
+void js_registeraot(js_State *J, const js_AotScript *script);
+
 /* Private stack functions */
 
 void js_newarguments(js_State *J);
@@ -120,12 +173,29 @@ void js_dup1rot4(js_State *J);
 void js_RegExp_prototype_exec(js_State *J, js_Regexp *re, const char *text);
 
 void js_trap(js_State *J, int pc); /* dump stack and environment to stdout */
+int js_traceline(js_State *J, int n); /* line number of stack trace entry */
 
 struct js_StackTrace
 {
 	const char *name;
 	const char *file;
 	int line;
+	js_Function *fun;
+	js_Instruction *pc; /* saved by the interpreter; line is looked up lazily */
+};
+
+/* Activation record of a bytecode function running in the interpreter */
+
+struct js_Frame
+{
+	js_Function *F;
+	js_Environment *E; /* own environment, or the closure scope if lightweight */
+	js_Instruction *pc; /* return address while calling another function, or handler */
+	js_Object *newobj; /* object to return instead of a primitive when constructing */
+	int savebot, savestrict;
+	int bot, base; /* stack bottom, and stack top before the first statement */
+	int tracetop, envtop;
+	jmp_buf *catchbuf; /* where the interpreter running the frame resumes at a handler */
 };
 
 /* Exception handling */
@@ -136,16 +206,11 @@ struct js_Jumpbuf
 	js_Environment *E;
 	int envtop;
 	int tracetop;
+	int frametop;
 	int top, bot;
 	int strict;
-	js_Instruction *pc;
 };
 
-void *js_savetrypc(js_State *J, js_Instruction *pc);
-
-#define js_trypc(J, PC) \
-	setjmp(js_savetrypc(J, PC))
-
 /* String buffer */
 
 typedef struct js_Buffer { int n, m; char s[64]; } js_Buffer;
@@ -217,8 +282,16 @@ struct js_State
 	/* execution stack */
 	int top, bot;
 	js_Value *stack;
+	int stacksize, stacklimit;
+
+	/*
+	 * Strings returned by js_tostring may point into the stack, so a block
+	 * the stack has grown out of is kept until the outermost call returns.
+	 */
+	int oldstacklen;
+	js_Value *oldstack[JS_OLDSTACKS];
 
-	/* garbage collector list */
+	/* garbage collector lists; new allocations are the young generation */
 	int gcpause;
 	int gcmark;
 	int gccounter;
@@ -227,17 +300,67 @@ struct js_State
 	js_Object *gcobj;
 	js_String *gcstr;
 
+	/* survivors of a collection, and when to collect them again */
+	js_Environment *gcoldenv;
+	js_Function *gcoldfun;
+	js_Object *gcoldobj;
+	js_String *gcoldstr;
+	int gcoldcount, gcoldlimit;
+
+	/* old objects and environments that may point to young ones */
+	int gcremtop, gcremcap;
+	js_Object **gcrem;
+	int gcscopetop, gcscopecap;
+	js_Environment **gcscope;
+
+	/* collection in progress: marked objects left to scan, and lists left to sweep */
+	int gcstate, gcfull, gcbudget;
+	int gcgraytop, gcgraycap, gcgrayoverflow;
+	js_Object **gcgray;
+	js_Environment *gcsweepenv[2];
+	js_Function *gcsweepfun[2];
+	js_Object *gcsweepobj[2];
+	js_String *gcsweepstr[2];
+	int gcswept[4], gcfreed[4], gcfrozen;
+	double gctime;
+
+	/* threads that mark a full collection (with JS_PARALLELGC) */
+	int gcthreads;
+
+	/* slabs of small objects, and the free chunks of each size class */
+	js_Slab **slabs;
+	int slabcount, slabcap;
+	void *slabfree[JS_SLABMAX / 16];
+
+	/* object shapes */
+	js_Shape *rootshape;
+	int shapecount;
+	unsigned int propversion; /* bumped when a watched property table changes */
+	unsigned int gversion; /* bumped when properties are added to or deleted from the global object */
+
 	/* environments on the call stack but currently not in scope */
-	int envtop;
-	js_Environment *envstack[JS_ENVLIMIT];
+	int envtop, envcap, envlimit;
+	js_Environment **envstack;
+
+	/* environments of calls that can not outlive them, reused in call order */
+	int pooltop, poollen, poolcap;
+	js_Environment **envpool;
 
 	/* debug info stack trace */
-	int tracetop;
-	js_StackTrace trace[JS_ENVLIMIT];
+	int tracetop, tracecap;
+	js_StackTrace *trace;
+
+	/* interpreter activation records; one per bytecode function on the trace */
+	int frametop;
+	js_Frame *frame;
 
 	/* exception stack */
-	int trytop;
-	js_Jumpbuf trybuf[JS_TRYLIMIT];
+	int trytop, trycap, trylimit;
+	js_Jumpbuf *trybuf;
+
+	/* scripts with native code registered by js_registeraot */
+	int aotlen, aotcap;
+	const js_AotScript **aot;
 };
 
 #endif
@@ -0,0 +1,582 @@
+#include "jsi.h"
+#include "jscompile.h"
+#include "jsvalue.h"
+#include "jsrun.h"
+
+#ifdef JS_JIT
+
+/*
+ * Baseline compiler from bytecode to x86-64 machine code.
+ *
+ * Every instruction becomes a fixed template: inline code for the common
+ * cases of locals, constants and int32 arithmetic, comparisons and jumps,
+ * and a call to a runtime helper in jsrun.c for everything else. Values
+ * stay on the value stack and only J is kept in a register, so the code
+ * can be entered at any instruction, and the collector and exceptions
+ * need not know about it. Functions with exception handlers, eval, with
+ * or debugger statements stay in the interpreter.
+ */
+
+#if defined(__x86_64__) && defined(__unix__)
+
+#include <sys/mman.h>
+
+enum { RAX = 0, RCX = 1, RDX = 2, RBX = 3, RSI = 6, RDI = 7 };
+enum { CC_O = 0x0, CC_E = 0x4, CC_NE = 0x5, CC_A = 0x7, CC_S = 0x8, CC_L = 0xC, CC_GE = 0xD, CC_LE = 0xE, CC_G = 0xF };
+
+#define VS ((int)sizeof(js_Value))
+#define VSHIFT (sizeof(js_Value) == 16 ? 4 : 3)
+#define JOFS(field) ((int)offsetof(js_State, field))
+#define FN(f) ((uint64_t)(uintptr_t)(f))
+
+/* The code is emitted twice: first to find its size and the offset of each instruction, then for real */
+struct jit
+{
+	unsigned char *buf; /* NULL while sizing */
+	int len;
+	int *map;
+};
+
+static void jitbyte(struct jit *B, int c)
+{
+	if (B->buf)
+		B->buf[B->len] = c;
+	++B->len;
+}
+
+static void jitlong(struct jit *B, unsigned int v)
+{
+	jitbyte(B, v & 0xFF);
+	jitbyte(B, v >> 8 & 0xFF);
+	jitbyte(B, v >> 16 & 0xFF);
+	jitbyte(B, v >> 24 & 0xFF);
+}
+
+/* op reg, [base+disp] with an optional REX.W prefix; reg is the opcode extension for group opcodes */
+static void jitins(struct jit *B, int rexw, int op, int reg, int base, int disp)
+{
+	if (rexw)
+		jitbyte(B, 0x48);
+	jitbyte(B, op);
+	jitbyte(B, 0x80 | reg << 3 | base);
+	jitlong(B, disp);
+}
+
+/* mov reg, imm64 */
+static void jitimm(struct jit *B, int reg, uint64_t v)
+{
+	jitbyte(B, 0x48);
+	jitbyte(B, 0xB8 + reg);
+	jitlong(B, (unsigned int)v);
+	jitlong(B, (unsigned int)(v >> 32));
+}
+
+/* add dword [J->field], n */
+static void jitaddfield(struct jit *B, int field, int n)
+{
+	jitins(B, 0, 0x81, 0, RBX, field);
+	jitlong(B, n);
+}
+
+/* Jump (cc < 0) or jump if cc to an offset in the code, and return where the displacement is */
+static int jitjump(struct jit *B, int cc, int target)
+{
+	if (cc < 0) {
+		jitbyte(B, 0xE9);
+	} else {
+		jitbyte(B, 0x0F);
+		jitbyte(B, 0x80 | cc);
+	}
+	jitlong(B, target - (B->len + 4));
+	return B->len - 4;
+}
+
+/* Point the jump with its displacement at 'at' here */
+static void jitlabel(struct jit *B, int at)
+{
+	int rel = B->len - (at + 4);
+	if (B->buf) {
+		B->buf[at] = rel & 0xFF;
+		B->buf[at+1] = rel >> 8 & 0xFF;
+		B->buf[at+2] = rel >> 16 & 0xFF;
+		B->buf[at+3] = rel >> 24 & 0xFF;
+	}
+}
+
+/* Call a runtime helper with J and the operands of the instruction */
+static void jitcall(struct jit *B, uint64_t fn, js_Instruction *pc)
+{
+	jitbyte(B, 0x48); jitbyte(B, 0x89); jitbyte(B, 0xDF); /* mov rdi, rbx */
+	jitimm(B, RSI, FN(pc));
+	jitimm(B, RAX, fn);
+	jitbyte(B, 0xFF); jitbyte(B, 0xD0); /* call rax */
+}
+
+/* reg = &STACK[TOP] or &STACK[BOT] */
+static void jitslots(struct jit *B, int reg, int field)
+{
+	jitins(B, 1, 0x63, reg, RBX, field); /* movsxd */
+	jitbyte(B, 0x48); jitbyte(B, 0xC1); jitbyte(B, 0xE0 | reg); jitbyte(B, VSHIFT); /* shl */
+	jitins(B, 1, 0x03, reg, RBX, JOFS(stack));
+}
+
+static void jitcopy(struct jit *B, int dst, int ddisp, int src, int sdisp)
+{
+	int i;
+	for (i = 0; i < VS; i += 8) {
+		jitins(B, 1, 0x8B, RAX, src, sdisp + i);
+		jitins(B, 1, 0x89, RAX, dst, ddisp + i);
+	}
+}
+
+static void jitconst(struct jit *B, int base, int disp, js_Value *v)
+{
+	uint64_t w;
+	int i;
+	for (i = 0; i < VS; i += 8) {
+		memcpy(&w, (char *)v + i, 8);
+		jitimm(B, RAX, w);
+		jitins(B, 1, 0x89, RAX, base, disp + i);
+	}
+}
+
+/* Jump to a label to be placed later unless [base+disp] holds an integer */
+static int jitnotint(struct jit *B, int base, int disp)
+{
+#ifdef JS_NANBOX
+	jitins(B, 0, 0x81, 7, base, disp + 4);
+	jitlong(B, JSV_INTTAG >> 32);
+#else
+	jitins(B, 0, 0x80, 7, base, disp + (int)offsetof(js_Value, type));
+	jitbyte(B, JS_TINTEGER);
+#endif
+	return jitjump(B, CC_NE, 0);
+}
+
+/* Jump to a label to be placed later unless [base+disp] holds a boolean, else load it in eax */
+static int jitnotbool(struct jit *B, int base, int disp)
+{
+#ifdef JS_NANBOX
+	jitins(B, 1, 0x8B, RAX, base, disp);
+	jitimm(B, RDX, JSV_TAG(JS_TBOOLEAN));
+	jitbyte(B, 0x48); jitbyte(B, 0x31); jitbyte(B, 0xD0); /* xor rax, rdx */
+	jitbyte(B, 0x48); jitbyte(B, 0x83); jitbyte(B, 0xF8); jitbyte(B, 1); /* cmp rax, 1 */
+	return jitjump(B, CC_A, 0);
+#else
+	int slow;
+	jitins(B, 0, 0x80, 7, base, disp + (int)offsetof(js_Value, type));
+	jitbyte(B, JS_TBOOLEAN);
+	slow = jitjump(B, CC_NE, 0);
+	jitins(B, 0, 0x8B, RAX, base, disp);
+	return slow;
+#endif
+}
+
+/* Store the boolean in eax to [base+disp] */
+static void jitsetbool(struct jit *B, int base, int disp)
+{
+#ifdef JS_NANBOX
+	jitimm(B, RDX, JSV_TAG(JS_TBOOLEAN));
+	jitbyte(B, 0x48); jitbyte(B, 0x09); jitbyte(B, 0xD0); /* or rax, rdx */
+	jitins(B, 1, 0x89, RAX, base, disp);
+#else
+	jitins(B, 0, 0x89, RAX, base, disp);
+	jitins(B, 0, 0xC6, 0, base, disp + (int)offsetof(js_Value, type));
+	jitbyte(B, JS_TBOOLEAN);
+#endif
+}
+
+/* rdx = the slots of the environment of the topmost activation record, as LT in the interpreter */
+static void jitflatenv(struct jit *B)
+{
+	jitins(B, 1, 0x63, RAX, RBX, JOFS(frametop));
+	jitbyte(B, 0x48); jitbyte(B, 0x69); jitbyte(B, 0xC0); jitlong(B, sizeof(js_Frame)); /* imul rax, rax, imm32 */
+	jitins(B, 1, 0x03, RAX, RBX, JOFS(frame));
+	jitins(B, 1, 0x8B, RDX, RAX, (int)offsetof(js_Frame, E) - (int)sizeof(js_Frame));
+	jitins(B, 1, 0x8B, RDX, RDX, (int)offsetof(js_Environment, slots));
+	jitbyte(B, 0x48); jitbyte(B, 0x83); jitbyte(B, 0xEA); jitbyte(B, VS); /* sub rdx, imm8 */
+}
+
+/* Make room for one value, and point rcx at it */
+static void jitpush(struct jit *B, js_Instruction *pc)
+{
+	int ok;
+	jitins(B, 0, 0x8B, RAX, RBX, JOFS(top));
+	jitbyte(B, 0x83); jitbyte(B, 0xC0); jitbyte(B, 1); /* add eax, 1 */
+	jitins(B, 0, 0x3B, RAX, RBX, JOFS(stacksize));
+	ok = jitjump(B, CC_L, 0);
+	jitcall(B, FN(jsR_jitcheckstack), pc);
+	jitlabel(B, ok);
+	jitslots(B, RCX, JOFS(top));
+}
+
+static void jitsafepoint(struct jit *B, js_Instruction *pc)
+{
+	int skip;
+	jitins(B, 0, 0x81, 7, RBX, JOFS(gccounter));
+	jitlong(B, JS_GCLIMIT);
+	skip = jitjump(B, CC_LE, 0);
+	jitcall(B, FN(jsR_jitsafepoint), pc);
+	jitlabel(B, skip);
+}
+
+static void jitinstruction(struct jit *B, js_Function *F, int k)
+{
+	js_Instruction *pc = F->code + k + 1;
+	int op = jsC_genericop(F->code[k]);
+	int slow1, slow2, slow3, done, cc, d;
+	js_Value v;
+
+	switch (op) {
+	case OP_POP:
+		jitaddfield(B, JOFS(top), -1);
+		break;
+
+	case OP_DUP:
+		jitpush(B, pc);
+		jitcopy(B, RCX, 0, RCX, -VS);
+		jitaddfield(B, JOFS(top), 1);
+		break;
+
+	case OP_INTEGER:
+	case OP_UNDEF:
+	case OP_NULL:
+	case OP_TRUE:
+	case OP_FALSE:
+		memset(&v, 0, sizeof v);
+		switch (op) {
+		case OP_INTEGER: JSV_SETINTEGER(v, *pc - 32768); break;
+		case OP_UNDEF: JSV_SETUNDEFINED(v); break;
+		case OP_NULL: JSV_SETNULL(v); break;
+		default: JSV_SETBOOLEAN(v, op == OP_TRUE); break;
+		}
+		jitpush(B, pc);
+		jitconst(B, RCX, 0, &v);
+		jitaddfield(B, JOFS(top), 1);
+		break;
+
+	case OP_GETLOCAL:
+		if (!F->lightweight && !F->flatenv)
+			goto local;
+		jitpush(B, pc);
+		if (F->lightweight)
+			jitslots(B, RDX, JOFS(bot));
+		else
+			jitflatenv(B);
+		jitcopy(B, RCX, 0, RDX, *pc * VS);
+		jitaddfield(B, JOFS(top), 1);
+		break;
+
+	case OP_SETLOCAL:
+		if (!F->lightweight && !F->flatenv)
+			goto local;
+		jitslots(B, RCX, JOFS(top));
+		if (F->lightweight)
+			jitslots(B, RDX, JOFS(bot));
+		else
+			jitflatenv(B);
+		jitcopy(B, RDX, *pc * VS, RCX, -VS);
+		break;
+
+	case OP_DELLOCAL:
+	case OP_ARGUMENTS:
+	case OP_GETARG:
+	case OP_ARGLEN:
+	case OP_GETUPVAL:
+	case OP_SETUPVAL:
+	local:
+		jitcall(B, FN(jsR_jitlocal), pc);
+		break;
+
+	case OP_SETLOCAL_POP:
+		jitaddfield(B, JOFS(top), -1);
+		jitslots(B, RCX, JOFS(top));
+		jitslots(B, RDX, JOFS(bot));
+		jitcopy(B, RDX, *pc * VS, RCX, 0);
+		break;
+
+	case OP_INC_LOCAL:
+	case OP_DEC_LOCAL:
+		d = *pc * VS;
+		jitslots(B, RDX, JOFS(bot));
+		slow1 = jitnotint(B, RDX, d);
+		jitins(B, 0, 0x8B, RAX, RDX, d);
+		jitbyte(B, 0x05); jitlong(B, op == OP_INC_LOCAL ? 1 : -1); /* add eax, imm32 */
+		slow2 = jitjump(B, CC_O, 0);
+		jitins(B, 0, 0x89, RAX, RDX, d);
+		done = jitjump(B, -1, 0);
+		jitlabel(B, slow1);
+		jitlabel(B, slow2);
+		jitcall(B, FN(jsR_jitstep), pc);
+		jitlabel(B, done);
+		break;
+
+	case OP_ADD:
+	case OP_SUB:
+		jitslots(B, RCX, JOFS(top));
+		slow1 = jitnotint(B, RCX, -2*VS);
+		slow2 = jitnotint(B, RCX, -VS);
+		jitins(B, 0, 0x8B, RAX, RCX, -2*VS);
+		jitins(B, 0, op == OP_ADD ? 0x03 : 0x2B, RAX, RCX, -VS);
+		slow3 = jitjump(B, CC_O, 0);
+		jitins(B, 0, 0x89, RAX, RCX, -2*VS);
+		jitaddfield(B, JOFS(top), -1);
+		done = jitjump(B, -1, 0);
+		jitlabel(B, slow1);
+		jitlabel(B, slow2);
+		jitlabel(B, slow3);
+		jitcall(B, FN(jsR_jitstep), pc);
+		jitlabel(B, done);
+		break;
+
+	case OP_ADD_INTEGER:
+		jitslots(B, RCX, JOFS(top));
+		slow1 = jitnotint(B, RCX, -VS);
+		jitins(B, 0, 0x8B, RAX, RCX, -VS);
+		jitbyte(B, 0x05); jitlong(B, *pc - 32768);
+		slow2 = jitjump(B, CC_O, 0);
+		jitins(B, 0, 0x89, RAX, RCX, -VS);
+		done = jitjump(B, -1, 0);
+		jitlabel(B, slow1);
+		jitlabel(B, slow2);
+		jitcall(B, FN(jsR_jitstep), pc);
+		jitlabel(B, done);
+		break;
+
+	case OP_LT:
+	case OP_GT:
+	case OP_LE:
+	case OP_GE:
+	case OP_EQ:
+	case OP_NE:
+	case OP_STRICTEQ:
+	case OP_STRICTNE:
+		switch (op) {
+		case OP_LT: cc = CC_L; break;
+		case OP_GT: cc = CC_G; break;
+		case OP_LE: cc = CC_LE; break;
+		case OP_GE: cc = CC_GE; break;
+		case OP_EQ: case OP_STRICTEQ: cc = CC_E; break;
+		default: cc = CC_NE; break;
+		}
+		jitslots(B, RCX, JOFS(top));
+		slow1 = jitnotint(B, RCX, -2*VS);
+		slow2 = jitnotint(B, RCX, -VS);
+		jitins(B, 0, 0x8B, RAX, RCX, -2*VS);
+		jitins(B, 0, 0x3B, RAX, RCX, -VS);
+		jitbyte(B, 0x0F); jitbyte(B, 0x90 | cc); jitbyte(B, 0xC0); /* setcc al */
+		jitbyte(B, 0x0F); jitbyte(B, 0xB6); jitbyte(B, 0xC0); /* movzx eax, al */
+		jitsetbool(B, RCX, -2*VS);
+		jitaddfield(B, JOFS(top), -1);
+		done = jitjump(B, -1, 0);
+		jitlabel(B, slow1);
+		jitlabel(B, slow2);
+		jitcall(B, FN(jsR_jitstep), pc);
+		jitlabel(B, done);
+		break;
+
+	case OP_LT_JFALSE:
+	case OP_GT_JFALSE:
+	case OP_LE_JFALSE:
+	case OP_GE_JFALSE:
+		if (*pc <= k)
+			jitsafepoint(B, pc);
+		switch (op) {
+		case OP_LT_JFALSE: cc = CC_GE; break;
+		case OP_GT_JFALSE: cc = CC_LE; break;
+		case OP_LE_JFALSE: cc = CC_G; break;
+		default: cc = CC_L; break;
+		}
+		jitslots(B, RCX, JOFS(top));
+		slow1 = jitnotint(B, RCX, -2*VS);
+		slow2 = jitnotint(B, RCX, -VS);
+		jitaddfield(B, JOFS(top), -2);
+		jitins(B, 0, 0x8B, RAX, RCX, -2*VS);
+		jitins(B, 0, 0x3B, RAX, RCX, -VS);
+		jitjump(B, cc, B->map[*pc]);
+		done = jitjump(B, -1, 0);
+		jitlabel(B, slow1);
+		jitlabel(B, slow2);
+		jitcall(B, FN(jsR_jitbranch), pc);
+		jitbyte(B, 0x85); jitbyte(B, 0xC0); /* test eax, eax */
+		jitjump(B, CC_NE, B->map[*pc]);
+		jitlabel(B, done);
+		break;
+
+	case OP_JUMP:
+		if (*pc <= k)
+			jitsafepoint(B, pc);
+		jitjump(B, -1, B->map[*pc]);
+		break;
+
+	case OP_JTRUE:
+	case OP_JFALSE:
+		if (*pc <= k)
+			jitsafepoint(B, pc);
+		jitslots(B, RCX, JOFS(top));
+		slow1 = jitnotbool(B, RCX, -VS);
+		jitaddfield(B, JOFS(top), -1);
+		jitbyte(B, 0x85); jitbyte(B, 0xC0);
+		jitjump(B, op == OP_JTRUE ? CC_NE : CC_E, B->map[*pc]);
+		done = jitjump(B, -1, 0);
+		jitlabel(B, slow1);
+		jitcall(B, FN(jsR_jitbranch), pc);
+		jitbyte(B, 0x85); jitbyte(B, 0xC0);
+		jitjump(B, CC_NE, B->map[*pc]);
+		jitlabel(B, done);
+		break;
+
+	case OP_JCASE:
+		if (*pc <= k)
+			jitsafepoint(B, pc);
+		jitcall(B, FN(jsR_jitbranch), pc);
+		jitbyte(B, 0x85); jitbyte(B, 0xC0); /* test eax, eax */
+		jitjump(B, CC_NE, B->map[*pc]);
+		break;
+
+	case OP_SWITCH:
+		/* jump to the machine code of the clause, through the instruction map */
+		jitcall(B, FN(jsR_jitswitch), pc);
+		jitbyte(B, 0x85); jitbyte(B, 0xC0); /* test eax, eax */
+		done = jitjump(B, CC_S, 0);
+		jitbyte(B, 0x89); jitbyte(B, 0xC0); /* mov eax, eax */
+		jitimm(B, RDX, (uint64_t)(uintptr_t)B->map);
+		jitbyte(B, 0x48); jitbyte(B, 0x63); jitbyte(B, 0x04); jitbyte(B, 0x82); /* movsxd rax, [rdx+rax*4] */
+		jitimm(B, RDX, (uint64_t)(uintptr_t)B->buf);
+		jitbyte(B, 0x48); jitbyte(B, 0x01); jitbyte(B, 0xD0); /* add rax, rdx */
+		jitbyte(B, 0xFF); jitbyte(B, 0xE0); /* jmp rax */
+		jitlabel(B, done);
+		break;
+
+	case OP_RETURN:
+		jitbyte(B, 0x5B); /* pop rbx */
+		jitbyte(B, 0xC3); /* ret */
+		break;
+
+	case OP_GETPROP: jitcall(B, FN(jsR_jitgetprop), pc); break;
+	case OP_SETPROP: jitcall(B, FN(jsR_jitsetprop), pc); break;
+	case OP_GETPROP_S: jitcall(B, FN(jsR_jitgetprop_s), pc); break;
+	case OP_GETLOCAL_GETPROP_S: jitcall(B, FN(jsR_jitgetprop_s), pc); break;
+	case OP_SETPROP_S: jitcall(B, FN(jsR_jitsetprop_s), pc); break;
+	case OP_GETGLOBAL: jitcall(B, FN(jsR_jitgetglobal), pc); break;
+	case OP_SETGLOBAL: jitcall(B, FN(jsR_jitsetglobal), pc); break;
+	case OP_CALL: jitcall(B, FN(jsR_jitcall), pc); break;
+	case OP_NEW: jitcall(B, FN(jsR_jitcall), pc); break;
+
+	default:
+		jitcall(B, FN(jsR_jitstep), pc);
+		break;
+	}
+}
+
+static void jitfunction(struct jit *B, js_Function *F)
+{
+	int pc;
+
+	/* the entry point: save rbx, keep J in it, and jump to the instruction we enter at */
+	jitbyte(B, 0x53); /* push rbx */
+	jitbyte(B, 0x48); jitbyte(B, 0x89); jitbyte(B, 0xFB); /* mov rbx, rdi */
+	jitbyte(B, 0xFF); jitbyte(B, 0xE6); /* jmp rsi */
+
+	for (pc = 0; pc < F->codelen; pc += jsC_oplength(F->code[pc])) {
+		B->map[pc] = B->len;
+		jitinstruction(B, F, pc);
+	}
+}
+
+static int jitsupported(js_Function *F)
+{
+	int pc;
+	if (F->trylen > 0)
+		return 0;
+	for (pc = 0; pc < F->codelen; pc += jsC_oplength(F->code[pc])) {
+		switch (F->code[pc]) {
+		case OP_EVAL:
+		case OP_CATCH:
+		case OP_ENDCATCH:
+		case OP_WITH:
+		case OP_ENDWITH:
+		case OP_DEBUGGER:
+			return 0;
+		}
+	}
+	return 1;
+}
+
+int jsJ_compile(js_State *J, js_Function *F)
+{
+	struct jit B;
+	void *code;
+
+	if (!jitsupported(F)) {
+		F->hotness = INT_MIN;
+		return 0;
+	}
+
+	B.buf = NULL;
+	B.len = 0;
+	B.map = js_malloc(J, F->codelen * sizeof *B.map);
+	memset(B.map, 0, F->codelen * sizeof *B.map);
+	jitfunction(&B, F);
+
+	code = mmap(NULL, B.len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (code == MAP_FAILED) {
+		js_free(J, B.map);
+		F->hotness = INT_MIN;
+		return 0;
+	}
+
+	B.buf = code;
+	B.len = 0;
+	jitfunction(&B, F);
+	if (mprotect(code, B.len, PROT_READ | PROT_EXEC) < 0) {
+		munmap(code, B.len);
+		js_free(J, B.map);
+		F->hotness = INT_MIN;
+		return 0;
+	}
+
+	F->jitcode = code;
+	F->jitmap = B.map;
+	F->jitsize = B.len;
+	F->native = jsJ_run;
+	return 1;
+}
+
+void jsJ_run(js_State *J, int pc)
+{
+	js_Function *F = J->frame[J->frametop-1].F;
+	union { void *p; void (*run)(js_State *J, void *entry); } code;
+	code.p = F->jitcode;
+	code.run(J, (char *)F->jitcode + F->jitmap[pc]);
+}
+
+void jsJ_free(js_State *J, js_Function *F)
+{
+	if (F->jitcode) {
+		munmap(F->jitcode, F->jitsize);
+		js_free(J, F->jitmap);
+	}
+}
+
+#else
+
+/* No code generator for this machine; everything stays in the interpreter */
+
+int jsJ_compile(js_State *J, js_Function *F)
+{
+	F->hotness = INT_MIN;
+	return 0;
+}
+
+void jsJ_run(js_State *J, int pc)
+{
+}
+
+void jsJ_free(js_State *J, js_Function *F)
+{
+}
+
+#endif
+
+#endif
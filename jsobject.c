@@ -62,7 +62,13 @@ static void Op_hasOwnProperty(js_State *J)
 {
 	js_Object *self = js_toobject(J, 0);
 	const char *name = js_tostring(J, 1);
-	js_Property *ref = jsV_getownproperty(J, self, name);
+	js_Property *ref;
+	int k;
+	if (self->dense && jsV_isindex(name, &k)) {
+		js_pushboolean(J, jsV_getelement(self, k) != NULL);
+		return;
+	}
+	ref = jsV_getownproperty(J, self, name);
 	js_pushboolean(J, ref != NULL);
 }
 
@@ -138,14 +144,13 @@ static void O_getOwnPropertyDescriptor(js_State *J)
 	}
 }
 
-static int O_getOwnPropertyNames_walk(js_State *J, js_Property *ref, int i)
+static int O_getOwnPropertyNames_walk(js_State *J, js_Object *obj, int i)
 {
-	if (ref->left->level)
-		i = O_getOwnPropertyNames_walk(J, ref->left, i);
-	js_pushliteral(J, ref->name);
-	js_setindex(J, -2, i++);
-	if (ref->right->level)
-		i = O_getOwnPropertyNames_walk(J, ref->right, i);
+	js_Property *ref;
+	for (ref = jsV_nextproperty(J, obj, NULL); ref; ref = jsV_nextproperty(J, obj, ref->name)) {
+		js_pushliteral(J, ref->name);
+		js_setindex(J, -2, i++);
+	}
 	return i;
 }
 
@@ -161,10 +166,7 @@ static void O_getOwnPropertyNames(js_State *J)
 
 	js_newarray(J);
 
-	if (obj->properties->level)
-		i = O_getOwnPropertyNames_walk(J, obj->properties, 0);
-	else
-		i = 0;
+	i = O_getOwnPropertyNames_walk(J, obj, 0);
 
 	if (obj->type == JS_CARRAY) {
 		js_pushliteral(J, "length");
@@ -255,17 +257,18 @@ static void O_defineProperty(js_State *J)
 	js_copy(J, 1);
 }
 
-static void O_defineProperties_walk(js_State *J, js_Property *ref)
+static void O_defineProperties_walk(js_State *J, js_Object *props)
 {
-	if (ref->left->level)
-		O_defineProperties_walk(J, ref->left);
-	if (!(ref->atts & JS_DONTENUM)) {
-		js_pushvalue(J, ref->value);
-		ToPropertyDescriptor(J, js_toobject(J, 1), ref->name, js_toobject(J, -1));
-		js_pop(J, 1);
+	js_Property *ref = jsV_nextproperty(J, props, NULL);
+	while (ref) {
+		const char *name = ref->name;
+		if (!(ref->atts & JS_DONTENUM)) {
+			js_pushvalue(J, ref->value);
+			ToPropertyDescriptor(J, js_toobject(J, 1), name, js_toobject(J, -1));
+			js_pop(J, 1);
+		}
+		ref = jsV_nextproperty(J, props, name);
 	}
-	if (ref->right->level)
-		O_defineProperties_walk(J, ref->right);
 }
 
 static void O_defineProperties(js_State *J)
@@ -276,23 +279,23 @@ static void O_defineProperties(js_State *J)
 	if (!js_isobject(J, 2)) js_typeerror(J, "not an object");
 
 	props = js_toobject(J, 2);
-	if (props->properties->level)
-		O_defineProperties_walk(J, props->properties);
+	O_defineProperties_walk(J, props);
 
 	js_copy(J, 1);
 }
 
-static void O_create_walk(js_State *J, js_Object *obj, js_Property *ref)
+static void O_create_walk(js_State *J, js_Object *obj, js_Object *props)
 {
-	if (ref->left->level)
-		O_create_walk(J, obj, ref->left);
-	if (!(ref->atts & JS_DONTENUM)) {
-		if (ref->value.type != JS_TOBJECT)
-			js_typeerror(J, "not an object");
-		ToPropertyDescriptor(J, obj, ref->name, ref->value.u.object);
+	js_Property *ref = jsV_nextproperty(J, props, NULL);
+	while (ref) {
+		const char *name = ref->name;
+		if (!(ref->atts & JS_DONTENUM)) {
+			if (JSV_TYPE(ref->value) != JS_TOBJECT)
+				js_typeerror(J, "not an object");
+			ToPropertyDescriptor(J, obj, name, JSV_OBJECT(ref->value));
+		}
+		ref = jsV_nextproperty(J, props, name);
 	}
-	if (ref->right->level)
-		O_create_walk(J, obj, ref->right);
 }
 
 static void O_create(js_State *J)
@@ -315,21 +318,19 @@ static void O_create(js_State *J)
 		if (!js_isobject(J, 2))
 			js_typeerror(J, "not an object");
 		props = js_toobject(J, 2);
-		if (props->properties->level)
-			O_create_walk(J, obj, props->properties);
+		O_create_walk(J, obj, props);
 	}
 }
 
-static int O_keys_walk(js_State *J, js_Property *ref, int i)
+static int O_keys_walk(js_State *J, js_Object *obj, int i)
 {
-	if (ref->left->level)
-		i = O_keys_walk(J, ref->left, i);
-	if (!(ref->atts & JS_DONTENUM)) {
-		js_pushliteral(J, ref->name);
-		js_setindex(J, -2, i++);
+	js_Property *ref;
+	for (ref = jsV_nextproperty(J, obj, NULL); ref; ref = jsV_nextproperty(J, obj, ref->name)) {
+		if (!(ref->atts & JS_DONTENUM)) {
+			js_pushliteral(J, ref->name);
+			js_setindex(J, -2, i++);
+		}
 	}
-	if (ref->right->level)
-		i = O_keys_walk(J, ref->right, i);
 	return i;
 }
 
@@ -344,10 +345,7 @@ static void O_keys(js_State *J)
 
 	js_newarray(J);
 
-	if (obj->properties->level)
-		i = O_keys_walk(J, obj->properties, 0);
-	else
-		i = 0;
+	i = O_keys_walk(J, obj, 0);
 
 	if (obj->type == JS_CSTRING) {
 		for (k = 0; k < obj->u.s.length; ++k) {
@@ -372,13 +370,11 @@ static void O_isExtensible(js_State *J)
 	js_pushboolean(J, js_toobject(J, 1)->extensible);
 }
 
-static void O_seal_walk(js_State *J, js_Property *ref)
+static void O_seal_walk(js_State *J, js_Object *obj)
 {
-	if (ref->left->level)
-		O_seal_walk(J, ref->left);
-	ref->atts |= JS_DONTCONF;
-	if (ref->right->level)
-		O_seal_walk(J, ref->right);
+	js_Property *ref;
+	for (ref = jsV_nextproperty(J, obj, NULL); ref; ref = jsV_nextproperty(J, obj, ref->name))
+		ref->atts |= JS_DONTCONF;
 }
 
 static void O_seal(js_State *J)
@@ -391,21 +387,16 @@ static void O_seal(js_State *J)
 	obj = js_toobject(J, 1);
 	obj->extensible = 0;
 
-	if (obj->properties->level)
-		O_seal_walk(J, obj->properties);
+	O_seal_walk(J, obj);
 
 	js_copy(J, 1);
 }
 
-static int O_isSealed_walk(js_State *J, js_Property *ref)
+static int O_isSealed_walk(js_State *J, js_Object *obj)
 {
-	if (ref->left->level)
-		if (!O_isSealed_walk(J, ref->left))
-			return 0;
-	if (!(ref->atts & JS_DONTCONF))
-		return 0;
-	if (ref->right->level)
-		if (!O_isSealed_walk(J, ref->right))
+	js_Property *ref;
+	for (ref = jsV_nextproperty(J, obj, NULL); ref; ref = jsV_nextproperty(J, obj, ref->name))
+		if (!(ref->atts & JS_DONTCONF))
 			return 0;
 	return 1;
 }
@@ -423,19 +414,14 @@ static void O_isSealed(js_State *J)
 		return;
 	}
 
-	if (obj->properties->level)
-		js_pushboolean(J, O_isSealed_walk(J, obj->properties));
-	else
-		js_pushboolean(J, 1);
+	js_pushboolean(J, O_isSealed_walk(J, obj));
 }
 
-static void O_freeze_walk(js_State *J, js_Property *ref)
+static void O_freeze_walk(js_State *J, js_Object *obj)
 {
-	if (ref->left->level)
-		O_freeze_walk(J, ref->left);
-	ref->atts |= JS_READONLY | JS_DONTCONF;
-	if (ref->right->level)
-		O_freeze_walk(J, ref->right);
+	js_Property *ref;
+	for (ref = jsV_nextproperty(J, obj, NULL); ref; ref = jsV_nextproperty(J, obj, ref->name))
+		ref->atts |= JS_READONLY | JS_DONTCONF;
 }
 
 static void O_freeze(js_State *J)
@@ -448,24 +434,20 @@ static void O_freeze(js_State *J)
 	obj = js_toobject(J, 1);
 	obj->extensible = 0;
 
-	if (obj->properties->level)
-		O_freeze_walk(J, obj->properties);
+	O_freeze_walk(J, obj);
 
 	js_copy(J, 1);
 }
 
-static int O_isFrozen_walk(js_State *J, js_Property *ref)
+static int O_isFrozen_walk(js_State *J, js_Object *obj)
 {
-	if (ref->left->level)
-		if (!O_isFrozen_walk(J, ref->left))
+	js_Property *ref;
+	for (ref = jsV_nextproperty(J, obj, NULL); ref; ref = jsV_nextproperty(J, obj, ref->name)) {
+		if (!(ref->atts & JS_READONLY))
 			return 0;
-	if (!(ref->atts & JS_READONLY))
-		return 0;
-	if (!(ref->atts & JS_DONTCONF))
-		return 0;
-	if (ref->right->level)
-		if (!O_isFrozen_walk(J, ref->right))
+		if (!(ref->atts & JS_DONTCONF))
 			return 0;
+	}
 	return 1;
 }
 
@@ -478,11 +460,9 @@ static void O_isFrozen(js_State *J)
 
 	obj = js_toobject(J, 1);
 
-	if (obj->properties->level) {
-		if (!O_isFrozen_walk(J, obj->properties)) {
-			js_pushboolean(J, 0);
-			return;
-		}
+	if (!O_isFrozen_walk(J, obj)) {
+		js_pushboolean(J, 0);
+		return;
 	}
 
 	js_pushboolean(J, !obj->extensible);
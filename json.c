@@ -26,11 +26,14 @@ static void jsonexpect(js_State *J, int t)
 				jsY_tokenstring(J->lookahead), jsY_tokenstring(t));
 }
 
-static void jsonvalue(js_State *J)
+static void jsonvalue(js_State *J, int level)
 {
 	int i;
 	const char *name;
 
+	if (level > JS_NESTLIMIT)
+		js_rangeerror(J, "JSON: too much recursion");
+
 	switch (J->lookahead) {
 	case TK_STRING:
 		js_pushstring(J, J->text);
@@ -53,7 +56,7 @@ static void jsonvalue(js_State *J)
 			name = J->text;
 			jsonnext(J);
 			jsonexpect(J, ':');
-			jsonvalue(J);
+			jsonvalue(J, level + 1);
 			js_setproperty(J, -2, name);
 		} while (jsonaccept(J, ','));
 		jsonexpect(J, '}');
@@ -66,7 +69,7 @@ static void jsonvalue(js_State *J)
 		if (jsonaccept(J, ']'))
 			return;
 		do {
-			jsonvalue(J);
+			jsonvalue(J, level + 1);
 			js_setindex(J, -2, i++);
 		} while (jsonaccept(J, ','));
 		jsonexpect(J, ']');
@@ -92,11 +95,14 @@ static void jsonvalue(js_State *J)
 	}
 }
 
-static void jsonrevive(js_State *J, const char *name)
+static void jsonrevive(js_State *J, const char *name, int level)
 {
 	const char *key;
 	char buf[32];
 
+	if (level > JS_NESTLIMIT)
+		js_rangeerror(J, "JSON: too much recursion");
+
 	/* revive is in 2 */
 	/* holder is in -1 */
 
@@ -107,7 +113,7 @@ static void jsonrevive(js_State *J, const char *name)
 			int i = 0;
 			int n = js_getlength(J, -1);
 			for (i = 0; i < n; ++i) {
-				jsonrevive(J, js_itoa(buf, i));
+				jsonrevive(J, js_itoa(buf, i), level + 1);
 				if (js_isundefined(J, -1)) {
 					js_pop(J, 1);
 					js_delproperty(J, -1, buf);
@@ -119,7 +125,7 @@ static void jsonrevive(js_State *J, const char *name)
 			js_pushiterator(J, -1, 1);
 			while ((key = js_nextiterator(J, -1))) {
 				js_rot2(J);
-				jsonrevive(J, key);
+				jsonrevive(J, key, level + 1);
 				if (js_isundefined(J, -1)) {
 					js_pop(J, 1);
 					js_delproperty(J, -1, key);
@@ -148,11 +154,11 @@ static void JSON_parse(js_State *J)
 
 	if (js_iscallable(J, 2)) {
 		js_newobject(J);
-		jsonvalue(J);
+		jsonvalue(J, 0);
 		js_defproperty(J, -2, "", 0);
-		jsonrevive(J, "");
+		jsonrevive(J, "", 0);
 	} else {
-		jsonvalue(J);
+		jsonvalue(J, 0);
 	}
 }
 
@@ -212,6 +218,9 @@ static void fmtobject(js_State *J, js_Buffer **sb, js_Object *obj, const char *g
 	int save;
 	int i, n;
 
+	if (level > JS_NESTLIMIT)
+		js_rangeerror(J, "JSON: too much recursion");
+
 	n = js_gettop(J) - 1;
 	for (i = 4; i < n; ++i)
 		if (js_isobject(J, i))
@@ -246,6 +255,9 @@ static void fmtarray(js_State *J, js_Buffer **sb, const char *gap, int level)
 	int n, i;
 	char buf[32];
 
+	if (level > JS_NESTLIMIT)
+		js_rangeerror(J, "JSON: too much recursion");
+
 	n = js_gettop(J) - 1;
 	for (i = 4; i < n; ++i)
 		if (js_isobject(J, i))
@@ -324,7 +336,8 @@ static void JSON_stringify(js_State *J)
 {
 	js_Buffer *sb = NULL;
 	char buf[12];
-	const char *s, *gap;
+	const char *s;
+	const char * volatile gap;
 	int n;
 
 	gap = NULL;
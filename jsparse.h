@@ -132,6 +132,7 @@ struct js_Ast
 	const char *string;
 	js_JumpList *jumps; /* list of break/continue jumps to patch */
 	int casejump; /* for switch case clauses */
+	int tryrange; /* open handler range of a try statement */
 	js_Ast *gcnext; /* next in alloc list */
 };
 
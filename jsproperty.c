@@ -1,5 +1,6 @@
 #include "jsi.h"
 #include "jsvalue.h"
+#include "jsrun.h"
 
 /*
 	Use an AA-tree to quickly look up properties in objects:
@@ -18,35 +19,37 @@
 	split() fixes consecutive right horizontal links.
 */
 
-static js_Property sentinel = {
-	"",
+static js_PropertyNode sentinel = {
+	{ "", 0, JSV_INITUNDEFINED, NULL, NULL },
 	&sentinel, &sentinel,
-	0, 0,
-	{ {0}, {0}, JS_TUNDEFINED },
-	NULL, NULL
+	0
 };
 
-static js_Property *newproperty(js_State *J, js_Object *obj, const char *name)
+static void initproperty(js_Property *prop, const char *name)
 {
-	js_Property *node = js_malloc(J, sizeof *node);
-	node->name = js_intern(J, name);
+	prop->name = name;
+	prop->atts = 0;
+	JSV_SETUNDEFINED(prop->value);
+	prop->getter = NULL;
+	prop->setter = NULL;
+}
+
+static js_PropertyNode *newproperty(js_State *J, js_Object *obj, const char *name)
+{
+	js_PropertyNode *node = js_slaballoc(J, sizeof *node);
+	initproperty(&node->prop, js_intern(J, name));
 	node->left = node->right = &sentinel;
 	node->level = 1;
-	node->atts = 0;
-	node->value.type = JS_TUNDEFINED;
-	node->value.u.number = 0;
-	node->getter = NULL;
-	node->setter = NULL;
 	++obj->count;
 	return node;
 }
 
-static js_Property *lookup(js_Property *node, const char *name)
+static js_Property *lookup(js_PropertyNode *node, const char *name)
 {
 	while (node != &sentinel) {
-		int c = strcmp(name, node->name);
+		int c = strcmp(name, node->prop.name);
 		if (c == 0)
-			return node;
+			return &node->prop;
 		else if (c < 0)
 			node = node->left;
 		else
@@ -55,10 +58,10 @@ static js_Property *lookup(js_Property *node, const char *name)
 	return NULL;
 }
 
-static js_Property *skew(js_Property *node)
+static js_PropertyNode *skew(js_PropertyNode *node)
 {
 	if (node->left->level == node->level) {
-		js_Property *temp = node;
+		js_PropertyNode *temp = node;
 		node = node->left;
 		temp->left = node->right;
 		node->right = temp;
@@ -66,10 +69,10 @@ static js_Property *skew(js_Property *node)
 	return node;
 }
 
-static js_Property *split(js_Property *node)
+static js_PropertyNode *split(js_PropertyNode *node)
 {
 	if (node->right->right->level == node->level) {
-		js_Property *temp = node;
+		js_PropertyNode *temp = node;
 		node = node->right;
 		temp->right = node->left;
 		node->left = temp;
@@ -78,35 +81,39 @@ static js_Property *split(js_Property *node)
 	return node;
 }
 
-static js_Property *insert(js_State *J, js_Object *obj, js_Property *node, const char *name, js_Property **result)
+static js_PropertyNode *insert(js_State *J, js_Object *obj, js_PropertyNode *node, const char *name, js_Property **result)
 {
 	if (node != &sentinel) {
-		int c = strcmp(name, node->name);
+		int c = strcmp(name, node->prop.name);
 		if (c < 0)
 			node->left = insert(J, obj, node->left, name, result);
 		else if (c > 0)
 			node->right = insert(J, obj, node->right, name, result);
-		else
-			return *result = node;
+		else {
+			*result = &node->prop;
+			return node;
+		}
 		node = skew(node);
 		node = split(node);
 		return node;
 	}
-	return *result = newproperty(J, obj, name);
+	node = newproperty(J, obj, name);
+	*result = &node->prop;
+	return node;
 }
 
-static void freeproperty(js_State *J, js_Object *obj, js_Property *node)
+static void freeproperty(js_State *J, js_Object *obj, js_PropertyNode *node)
 {
-	js_free(J, node);
+	js_slabfree(J, node, sizeof *node);
 	--obj->count;
 }
 
-static js_Property *delete(js_State *J, js_Object *obj, js_Property *node, const char *name)
+static js_PropertyNode *delete(js_State *J, js_Object *obj, js_PropertyNode *node, const char *name)
 {
-	js_Property *temp, *succ;
+	js_PropertyNode *temp, *succ;
 
 	if (node != &sentinel) {
-		int c = strcmp(name, node->name);
+		int c = strcmp(name, node->prop.name);
 		if (c < 0) {
 			node->left = delete(J, obj, node->left, name);
 		} else if (c > 0) {
@@ -124,10 +131,8 @@ static js_Property *delete(js_State *J, js_Object *obj, js_Property *node, const
 				succ = node->right;
 				while (succ->left != &sentinel)
 					succ = succ->left;
-				node->name = succ->name;
-				node->atts = succ->atts;
-				node->value = succ->value;
-				node->right = delete(J, obj, node->right, succ->name);
+				node->prop = succ->prop;
+				node->right = delete(J, obj, node->right, succ->prop.name);
 			}
 		}
 
@@ -146,32 +151,127 @@ static js_Property *delete(js_State *J, js_Object *obj, js_Property *node, const
 	return node;
 }
 
+/* Shapes: transitions from a shape to the next when a property is added */
+
+static js_Shape *newshape(js_State *J, js_Shape *parent, const char *name)
+{
+	js_Shape *shape = js_malloc(J, sizeof *shape);
+	shape->parent = parent;
+	shape->kids = NULL;
+	shape->sibling = NULL;
+	shape->name = name;
+	shape->count = 0;
+	if (parent) {
+		shape->count = parent->count + 1;
+		shape->sibling = parent->kids;
+		parent->kids = shape;
+	}
+	++J->shapecount;
+	return shape;
+}
+
+static js_Shape *transition(js_State *J, js_Shape *shape, const char *name)
+{
+	js_Shape *kid;
+	if (shape->count >= JS_SHAPEPROPS)
+		return NULL;
+	for (kid = shape->kids; kid; kid = kid->sibling)
+		if (kid->name == name)
+			return kid;
+	if (J->shapecount >= JS_SHAPELIMIT)
+		return NULL;
+	return newshape(J, shape, name);
+}
+
+static js_Property *lookupslot(js_Object *obj, const char *name)
+{
+	js_Property *slot = obj->slots;
+	js_Property *end = slot + obj->count;
+	for (; slot < end; ++slot)
+		if (slot->name == name || (slot->name[0] == name[0] && !strcmp(slot->name, name)))
+			return slot;
+	return NULL;
+}
+
+static js_Property *addslot(js_State *J, js_Object *obj, js_Shape *shape, const char *name)
+{
+	js_Property *slot;
+	if (obj->count >= obj->slotcap) {
+		obj->slotcap = obj->slotcap ? obj->slotcap * 2 : 4;
+		obj->slots = js_realloc(J, obj->slots, obj->slotcap * sizeof *obj->slots);
+	}
+	slot = &obj->slots[obj->count++];
+	initproperty(slot, name);
+	obj->shape = shape;
+	return slot;
+}
+
+/* Move the properties of a shaped object into a property tree */
+static void todictionary(js_State *J, js_Object *obj)
+{
+	js_Property *slots = obj->slots;
+	js_Property *ref;
+	int i, n = obj->count;
+
+	obj->shape = NULL;
+	obj->slots = NULL;
+	obj->slotcap = 0;
+	obj->count = 0;
+	for (i = 0; i < n; ++i) {
+		obj->properties = insert(J, obj, obj->properties, slots[i].name, &ref);
+		*ref = slots[i];
+	}
+	js_free(J, slots);
+}
+
+static js_Property *getownproperty(js_Object *obj, const char *name)
+{
+	if (obj->shape)
+		return lookupslot(obj, name);
+	return lookup(obj->properties, name);
+}
+
 js_Object *jsV_newobject(js_State *J, enum js_Class type, js_Object *prototype)
 {
-	js_Object *obj = js_malloc(J, sizeof *obj);
+	js_Object *obj = js_slaballoc(J, sizeof *obj);
 	memset(obj, 0, sizeof *obj);
-	obj->gcmark = J->gcmark;
 	obj->gcnext = J->gcobj;
 	J->gcobj = obj;
 	++J->gccounter;
 
+	if (!J->rootshape)
+		J->rootshape = newshape(J, NULL, NULL);
+
 	obj->type = type;
+	obj->shape = J->rootshape;
 	obj->properties = &sentinel;
+	obj->dense = (type == JS_CARRAY || type == JS_CARGUMENTS);
 	obj->prototype = prototype;
 	obj->extensible = 1;
 	return obj;
 }
 
+/* Lookups by name only see the elements of a dense object after making it sparse */
+static void checkdense(js_State *J, js_Object *obj, const char *name)
+{
+	int k;
+	if (obj->dense && jsV_isindex(name, &k))
+		jsV_tosparse(J, obj);
+}
+
 js_Property *jsV_getownproperty(js_State *J, js_Object *obj, const char *name)
 {
-	return lookup(obj->properties, name);
+	checkdense(J, obj, name);
+	return getownproperty(obj, name);
 }
 
 js_Property *jsV_getpropertyx(js_State *J, js_Object *obj, const char *name, int *own)
 {
 	*own = 1;
 	do {
-		js_Property *ref = lookup(obj->properties, name);
+		js_Property *ref;
+		checkdense(J, obj, name);
+		ref = getownproperty(obj, name);
 		if (ref)
 			return ref;
 		obj = obj->prototype;
@@ -183,7 +283,9 @@ js_Property *jsV_getpropertyx(js_State *J, js_Object *obj, const char *name, int
 js_Property *jsV_getproperty(js_State *J, js_Object *obj, const char *name)
 {
 	do {
-		js_Property *ref = lookup(obj->properties, name);
+		js_Property *ref;
+		checkdense(J, obj, name);
+		ref = getownproperty(obj, name);
 		if (ref)
 			return ref;
 		obj = obj->prototype;
@@ -191,65 +293,353 @@ js_Property *jsV_getproperty(js_State *J, js_Object *obj, const char *name)
 	return NULL;
 }
 
-static js_Property *jsV_getenumproperty(js_State *J, js_Object *obj, const char *name)
+static int hasproperty(js_State *J, js_Object *obj, const char *name)
 {
+	int k;
 	do {
-		js_Property *ref = lookup(obj->properties, name);
-		if (ref && !(ref->atts & JS_DONTENUM))
-			return ref;
+		if (obj->dense && jsV_isindex(name, &k)) {
+			if (jsV_getelement(obj, k))
+				return 1;
+		} else if (getownproperty(obj, name)) {
+			return 1;
+		}
 		obj = obj->prototype;
 	} while (obj);
-	return NULL;
+	return 0;
+}
+
+static int hasenumproperty(js_State *J, js_Object *obj, const char *name)
+{
+	int k;
+	do {
+		if (obj->dense && jsV_isindex(name, &k)) {
+			if (jsV_getelement(obj, k))
+				return 1;
+		} else {
+			js_Property *ref = getownproperty(obj, name);
+			if (ref && !(ref->atts & JS_DONTENUM))
+				return 1;
+		}
+		obj = obj->prototype;
+	} while (obj);
+	return 0;
+}
+
+/* Adding or deleting a property may move the others; drop the caches that point into obj */
+static void invalidate(js_State *J, js_Object *obj)
+{
+	if (obj->watched)
+		++J->propversion;
+	if (obj == J->G)
+		++J->gversion;
 }
 
 js_Property *jsV_setproperty(js_State *J, js_Object *obj, const char *name)
 {
 	js_Property *result;
+	js_Shape *shape;
+	int count;
+
+	checkdense(J, obj, name);
 
 	if (!obj->extensible) {
-		result = lookup(obj->properties, name);
+		result = getownproperty(obj, name);
 		if (J->strict && !result)
 			js_typeerror(J, "object is non-extensible");
 		return result;
 	}
 
+	if (obj->shape) {
+		result = lookupslot(obj, name);
+		if (result)
+			return result;
+		name = js_intern(J, name);
+		invalidate(J, obj);
+		shape = transition(J, obj->shape, name);
+		if (shape)
+			return addslot(J, obj, shape, name);
+		todictionary(J, obj);
+	}
+
+	count = obj->count;
 	obj->properties = insert(J, obj, obj->properties, name, &result);
+	if (obj->count != count)
+		invalidate(J, obj);
 
 	return result;
 }
 
+/* Add the property that leads from the object's shape to the given shape */
+js_Property *jsV_addproperty(js_State *J, js_Object *obj, js_Shape *shape)
+{
+	invalidate(J, obj);
+	return addslot(J, obj, shape, shape->name);
+}
+
 void jsV_delproperty(js_State *J, js_Object *obj, const char *name)
 {
+	checkdense(J, obj, name);
+	if (obj->shape) {
+		if (!lookupslot(obj, name))
+			return;
+		todictionary(J, obj);
+	}
+	invalidate(J, obj);
 	obj->properties = delete(J, obj, obj->properties, name);
 }
 
+/*
+	Inline caches.
+
+	Filling a cache entry marks the objects whose property tables it depends
+	on as watched. Adding or deleting properties of a watched object bumps
+	J->propversion, which invalidates every entry that is not an own slot of
+	a shaped object. So does a garbage collection, since a freed object can
+	come back at the same address.
+*/
+
+static js_Property *watchproperty(js_Object *obj, const char *name, js_Object **holder)
+{
+	js_Property *ref;
+	do {
+		obj->watched = 1;
+		ref = getownproperty(obj, name);
+		if (ref)
+			break;
+		obj = obj->prototype;
+	} while (obj);
+	*holder = obj;
+	return ref;
+}
+
+static js_PropCache *newcache(js_State *J, js_PropCache *cache)
+{
+	int i;
+	for (i = JS_CACHEWAYS - 1; i > 0; --i)
+		cache[i] = cache[i - 1];
+	memset(cache, 0, sizeof *cache);
+	cache->version = J->propversion;
+	cache->slot = -1;
+	return cache;
+}
+
+js_PropCache *jsV_probecache(js_State *J, js_PropCache *cache, js_Object *obj)
+{
+	js_PropCache *c = cache, *end = cache + JS_CACHEWAYS;
+	for (; c < end; ++c) {
+		if (c->type != obj->type)
+			continue;
+		if (obj->shape) {
+			if (c->shape == obj->shape) {
+				if (c->slot >= 0)
+					return c;
+				if (c->obj == obj->prototype && c->version == J->propversion)
+					return c;
+			}
+		} else {
+			if (c->obj == obj && c->version == J->propversion)
+				return c;
+		}
+	}
+	return NULL;
+}
+
+js_PropCache *jsV_fillcache(js_State *J, js_PropCache *cache, js_Object *obj, const char *name, int store)
+{
+	js_PropCache *c = newcache(J, cache);
+	js_Property *ref;
+
+	c->type = obj->type;
+	c->shape = obj->shape;
+	if (obj->shape) {
+		c->obj = obj->prototype;
+		ref = lookupslot(obj, name);
+		if (ref) {
+			c->holder = obj;
+			c->ref = ref;
+			c->slot = ref - obj->slots;
+			return c;
+		}
+		if (obj->prototype)
+			c->ref = watchproperty(obj->prototype, name, &c->holder);
+		if (store && !c->ref && obj->extensible)
+			c->next = transition(J, obj->shape, js_intern(J, name));
+	} else {
+		c->obj = obj;
+		c->ref = watchproperty(obj, name, &c->holder);
+	}
+	return c;
+}
+
+js_PropCache *jsV_probevarcache(js_State *J, js_PropCache *cache, js_Environment *E)
+{
+	js_PropCache *c = cache, *end = cache + JS_CACHEWAYS;
+	for (; c < end; ++c)
+		if (c->scope == E && c->version == J->propversion)
+			return c;
+	return NULL;
+}
+
+js_PropCache *jsV_fillvarcache(js_State *J, js_PropCache *cache, js_Environment *E, js_Environment *key, const char *name)
+{
+	js_PropCache *c = newcache(J, cache);
+	c->scope = key;
+	do {
+		if (E->slots) {
+			/* slots hold no properties to cache; a slotted environment never gains names */
+			if (jsR_findslot(E, name) >= 0) {
+				c->scope = NULL;
+				return NULL;
+			}
+		} else {
+			c->ref = watchproperty(E->variables, name, &c->holder);
+			if (c->ref) {
+				c->obj = E->variables;
+				break;
+			}
+		}
+		E = E->outer;
+	} while (E);
+	return c;
+}
+
+/* Find the own property that comes after name in sorted order (or the first if name is NULL) */
+js_Property *jsV_nextproperty(js_State *J, js_Object *obj, const char *name)
+{
+	js_Property *best = NULL;
+	if (obj->dense && obj->elemlen > 0)
+		jsV_tosparse(J, obj);
+	if (obj->shape) {
+		js_Property *slot = obj->slots;
+		js_Property *end = slot + obj->count;
+		for (; slot < end; ++slot)
+			if (!name || strcmp(slot->name, name) > 0)
+				if (!best || strcmp(slot->name, best->name) < 0)
+					best = slot;
+	} else {
+		js_PropertyNode *node = obj->properties;
+		while (node != &sentinel) {
+			if (!name || strcmp(node->prop.name, name) > 0) {
+				best = &node->prop;
+				node = node->left;
+			} else {
+				node = node->right;
+			}
+		}
+	}
+	return best;
+}
+
 /* Flatten hierarchy of enumerable properties into an iterator object */
 
-static js_Iterator *itwalk(js_State *J, js_Iterator *iter, js_Property *prop, js_Object *seen)
+static js_Iterator *itadd(js_State *J, js_Iterator *iter, js_Property *prop, js_Object *seen)
 {
-	if (prop->right != &sentinel)
-		iter = itwalk(J, iter, prop->right, seen);
 	if (!(prop->atts & JS_DONTENUM)) {
-		if (!seen || !jsV_getenumproperty(J, seen, prop->name)) {
-			js_Iterator *head = js_malloc(J, sizeof *head);
+		if (!seen || !hasenumproperty(J, seen, prop->name)) {
+			js_Iterator *head = js_slaballoc(J, sizeof *head);
 			head->name = prop->name;
 			head->next = iter;
 			iter = head;
 		}
 	}
-	if (prop->left != &sentinel)
-		iter = itwalk(J, iter, prop->left, seen);
 	return iter;
 }
 
+static js_Iterator *itwalk(js_State *J, js_Iterator *iter, js_PropertyNode *node, js_Object *seen)
+{
+	if (node->right != &sentinel)
+		iter = itwalk(J, iter, node->right, seen);
+	iter = itadd(J, iter, &node->prop, seen);
+	if (node->left != &sentinel)
+		iter = itwalk(J, iter, node->left, seen);
+	return iter;
+}
+
+static js_Iterator *itwalkslots(js_State *J, js_Iterator *iter, js_Object *obj, js_Object *seen)
+{
+	js_Property *order[JS_SHAPEPROPS];
+	js_Property *slot;
+	int i, k, n = obj->count;
+
+	/* sort by name, to match the order of the dictionary mode */
+	for (i = 0; i < n; ++i) {
+		slot = &obj->slots[i];
+		for (k = i; k > 0 && strcmp(order[k-1]->name, slot->name) > 0; --k)
+			order[k] = order[k-1];
+		order[k] = slot;
+	}
+
+	while (n > 0)
+		iter = itadd(J, iter, order[--n], seen);
+	return iter;
+}
+
+static js_Iterator *itpropwalk(js_State *J, js_Iterator *iter, js_Object *obj, js_Object *seen)
+{
+	if (obj->shape)
+		return itwalkslots(J, iter, obj, seen);
+	if (obj->properties != &sentinel)
+		return itwalk(J, iter, obj->properties, seen);
+	return iter;
+}
+
+static int cmpname(const void *a, const void *b)
+{
+	return strcmp(*(const char **)a, *(const char **)b);
+}
+
+/* Merge the element names into the sorted list of own property names */
+static js_Iterator *itwalkelements(js_State *J, js_Iterator *iter, js_Object *obj, js_Object *seen)
+{
+	char buf[32];
+	const char **names;
+	const char *name;
+	js_Iterator *own, *head, *node, **tail;
+	int i, n = 0;
+
+	names = js_malloc(J, obj->elemlen * sizeof *names);
+	for (i = 0; i < obj->elemlen; ++i) {
+		if (JSV_TYPE(obj->elements[i]) != JS_THOLE) {
+			name = js_intern(J, js_itoa(buf, i));
+			if (!seen || !hasenumproperty(J, seen, name))
+				names[n++] = name;
+		}
+	}
+	qsort(names, n, sizeof *names, cmpname);
+
+	own = itpropwalk(J, NULL, obj, seen);
+	tail = &head;
+	i = 0;
+	while (own || i < n) {
+		if (own && (i == n || strcmp(own->name, names[i]) < 0)) {
+			node = own;
+			own = own->next;
+		} else {
+			node = js_slaballoc(J, sizeof *node);
+			node->name = names[i++];
+		}
+		*tail = node;
+		tail = &node->next;
+	}
+	*tail = iter;
+
+	js_free(J, names);
+	return head;
+}
+
+static js_Iterator *itownwalk(js_State *J, js_Iterator *iter, js_Object *obj, js_Object *seen)
+{
+	if (obj->dense && obj->elemlen > 0)
+		return itwalkelements(J, iter, obj, seen);
+	return itpropwalk(J, iter, obj, seen);
+}
+
 static js_Iterator *itflatten(js_State *J, js_Object *obj)
 {
 	js_Iterator *iter = NULL;
 	if (obj->prototype)
 		iter = itflatten(J, obj->prototype);
-	if (obj->properties != &sentinel)
-		iter = itwalk(J, iter, obj->properties, obj->prototype);
-	return iter;
+	return itownwalk(J, iter, obj, obj->prototype);
 }
 
 js_Object *jsV_newiterator(js_State *J, js_Object *obj, int own)
@@ -259,9 +649,7 @@ js_Object *jsV_newiterator(js_State *J, js_Object *obj, int own)
 	js_Object *io = jsV_newobject(J, JS_CITERATOR, NULL);
 	io->u.iter.target = obj;
 	if (own) {
-		io->u.iter.head = NULL;
-		if (obj->properties != &sentinel)
-			io->u.iter.head = itwalk(J, io->u.iter.head, obj->properties, NULL);
+		io->u.iter.head = itownwalk(J, NULL, obj, NULL);
 	} else {
 		io->u.iter.head = itflatten(J, obj);
 	}
@@ -272,8 +660,8 @@ js_Object *jsV_newiterator(js_State *J, js_Object *obj, int own)
 				tail = tail->next;
 		for (k = 0; k < obj->u.s.length; ++k) {
 			js_itoa(buf, k);
-			if (!jsV_getenumproperty(J, obj, buf)) {
-				js_Iterator *node = js_malloc(J, sizeof *node);
+			if (!hasenumproperty(J, obj, buf)) {
+				js_Iterator *node = js_slaballoc(J, sizeof *node);
 				node->name = js_intern(J, js_itoa(buf, k));
 				node->next = NULL;
 				if (!tail)
@@ -296,9 +684,9 @@ const char *jsV_nextiterator(js_State *J, js_Object *io)
 	while (io->u.iter.head) {
 		js_Iterator *next = io->u.iter.head->next;
 		const char *name = io->u.iter.head->name;
-		js_free(J, io->u.iter.head);
+		js_slabfree(J, io->u.iter.head, sizeof *io->u.iter.head);
 		io->u.iter.head = next;
-		if (jsV_getproperty(J, io->u.iter.target, name))
+		if (hasproperty(J, io->u.iter.target, name))
 			return name;
 		if (io->u.iter.target->type == JS_CSTRING)
 			if (js_isarrayindex(J, name, &k) && k < io->u.iter.target->u.s.length)
@@ -307,6 +695,87 @@ const char *jsV_nextiterator(js_State *J, js_Object *io)
 	return NULL;
 }
 
+/* Dense element storage */
+
+int jsV_isindex(const char *p, int *k)
+{
+	int n = 0;
+	if (*p < '0' || *p > '9' || (p[0] == '0' && p[1]))
+		return 0;
+	while (*p >= '0' && *p <= '9') {
+		if (n >= INT_MAX / 10)
+			return 0;
+		n = n * 10 + (*p++ - '0');
+	}
+	if (*p)
+		return 0;
+	*k = n;
+	return 1;
+}
+
+static void trimelements(js_Object *obj)
+{
+	while (obj->elemlen > 0 && JSV_TYPE(obj->elements[obj->elemlen-1]) == JS_THOLE)
+		--obj->elemlen;
+}
+
+js_Value *jsV_getelement(js_Object *obj, int k)
+{
+	if (obj->dense && k >= 0 && k < obj->elemlen && JSV_TYPE(obj->elements[k]) != JS_THOLE)
+		return &obj->elements[k];
+	return NULL;
+}
+
+/* Store an element of a dense object. Returns 0 if the object turned sparse instead. */
+int jsV_setelement(js_State *J, js_Object *obj, int k, js_Value *value)
+{
+	if (k >= obj->elemlen || JSV_TYPE(obj->elements[k]) == JS_THOLE) {
+		if (!obj->extensible || (k > obj->elemlen + JS_ARRAYGAP && k / 2 >= obj->elemlen)) {
+			jsV_tosparse(J, obj);
+			return 0;
+		}
+	}
+	if (k >= obj->elemcap) {
+		int cap = obj->elemcap ? obj->elemcap : 8;
+		while (cap <= k)
+			cap *= 2;
+		obj->elements = js_realloc(J, obj->elements, cap * sizeof *obj->elements);
+		obj->elemcap = cap;
+	}
+	while (obj->elemlen <= k)
+		JSV_SETHOLE(obj->elements[obj->elemlen++]);
+	JSG_BARRIER(J, obj, *value);
+	obj->elements[k] = *value;
+	return 1;
+}
+
+void jsV_delelement(js_State *J, js_Object *obj, int k)
+{
+	if (k >= 0 && k < obj->elemlen) {
+		JSV_SETHOLE(obj->elements[k]);
+		trimelements(obj);
+	}
+}
+
+/* Move the elements of a dense object into ordinary properties */
+void jsV_tosparse(js_State *J, js_Object *obj)
+{
+	char buf[32];
+	js_Value *elements = obj->elements;
+	int extensible = obj->extensible;
+	int k, n = obj->elemlen;
+
+	obj->dense = 0;
+	obj->elements = NULL;
+	obj->elemlen = obj->elemcap = 0;
+	obj->extensible = 1;
+	for (k = 0; k < n; ++k)
+		if (JSV_TYPE(elements[k]) != JS_THOLE)
+			jsV_setproperty(J, obj, js_itoa(buf, k))->value = elements[k];
+	obj->extensible = extensible;
+	js_free(J, elements);
+}
+
 /* Walk all the properties and delete them one by one for arrays */
 
 void jsV_resizearray(js_State *J, js_Object *obj, int newlen)
@@ -314,7 +783,12 @@ void jsV_resizearray(js_State *J, js_Object *obj, int newlen)
 	char buf[32];
 	const char *s;
 	int k;
-	if (newlen < obj->u.a.length) {
+	if (obj->dense) {
+		if (newlen < obj->elemlen) {
+			obj->elemlen = newlen;
+			trimelements(obj);
+		}
+	} else if (newlen < obj->u.a.length) {
 		if (obj->u.a.length > obj->count * 2) {
 			js_Object *it = jsV_newiterator(J, obj, 1);
 			while ((s = jsV_nextiterator(J, it))) {
@@ -5,7 +5,7 @@
 #include "utf.h"
 #include "jscompile.h"
 
-static void reprvalue(js_State *J, js_Buffer **sb);
+static void reprvalue(js_State *J, js_Buffer **sb, int level);
 
 static void reprnum(js_State *J, js_Buffer **sb, double n)
 {
@@ -68,11 +68,14 @@ static void reprident(js_State *J, js_Buffer **sb, const char *name)
 		reprstr(J, sb, name);
 }
 
-static void reprobject(js_State *J, js_Buffer **sb)
+static void reprobject(js_State *J, js_Buffer **sb, int level)
 {
 	const char *key;
 	int i, n;
 
+	if (level > JS_NESTLIMIT)
+		js_rangeerror(J, "too much recursion");
+
 	n = js_gettop(J) - 1;
 	for (i = 0; i < n; ++i) {
 		if (js_isobject(J, i)) {
@@ -92,17 +95,20 @@ static void reprobject(js_State *J, js_Buffer **sb)
 		reprident(J, sb, key);
 		js_puts(J, sb, ": ");
 		js_getproperty(J, -2, key);
-		reprvalue(J, sb);
+		reprvalue(J, sb, level + 1);
 		js_pop(J, 1);
 	}
 	js_pop(J, 1);
 	js_putc(J, sb, '}');
 }
 
-static void reprarray(js_State *J, js_Buffer **sb)
+static void reprarray(js_State *J, js_Buffer **sb, int level)
 {
 	int n, i;
 
+	if (level > JS_NESTLIMIT)
+		js_rangeerror(J, "too much recursion");
+
 	n = js_gettop(J) - 1;
 	for (i = 0; i < n; ++i) {
 		if (js_isobject(J, i)) {
@@ -119,7 +125,7 @@ static void reprarray(js_State *J, js_Buffer **sb)
 		if (i > 0)
 			js_puts(J, sb, ", ");
 		if (js_hasindex(J, -1, i)) {
-			reprvalue(J, sb);
+			reprvalue(J, sb, level + 1);
 			js_pop(J, 1);
 		}
 	}
@@ -140,7 +146,7 @@ static void reprfun(js_State *J, js_Buffer **sb, js_Function *fun)
 	js_puts(J, sb, ") { [byte code] }");
 }
 
-static void reprvalue(js_State *J, js_Buffer **sb)
+static void reprvalue(js_State *J, js_Buffer **sb, int level)
 {
 	if (js_isundefined(J, -1))
 		js_puts(J, sb, "undefined");
@@ -156,10 +162,10 @@ static void reprvalue(js_State *J, js_Buffer **sb)
 		js_Object *obj = js_toobject(J, -1);
 		switch (obj->type) {
 		default:
-			reprobject(J, sb);
+			reprobject(J, sb, level);
 			break;
 		case JS_CARRAY:
-			reprarray(J, sb);
+			reprarray(J, sb, level);
 			break;
 		case JS_CFUNCTION:
 		case JS_CSCRIPT:
@@ -241,7 +247,7 @@ void js_repr(js_State *J, int idx)
 
 	savebot = J->bot;
 	J->bot = J->top - 1;
-	reprvalue(J, &sb);
+	reprvalue(J, &sb, 0);
 	J->bot = savebot;
 
 	js_pop(J, 1);
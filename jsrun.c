@@ -5,7 +5,8 @@
 
 #include "utf.h"
 
-static void jsR_run(js_State *J, js_Function *F);
+static void jsR_run(js_State *J, js_Function *fun);
+static int js_hasvar(js_State *J, const char *name);
 
 /* Push values on stack */
 
@@ -15,16 +16,22 @@ static void jsR_run(js_State *J, js_Function *F);
 
 static void js_stackoverflow(js_State *J)
 {
-	STACK[TOP].type = JS_TLITSTR;
-	STACK[TOP].u.litstr = "stack overflow";
+	JSV_SETLITSTR(STACK[TOP], "stack overflow");
+	++TOP;
+	js_throw(J);
+}
+
+/* Making an Error object needs a try level of its own, so throw a string */
+static void js_tryoverflow(js_State *J)
+{
+	JSV_SETLITSTR(STACK[TOP], "try: exception stack overflow");
 	++TOP;
 	js_throw(J);
 }
 
 static void js_outofmemory(js_State *J)
 {
-	STACK[TOP].type = JS_TLITSTR;
-	STACK[TOP].u.litstr = "out of memory";
+	JSV_SETLITSTR(STACK[TOP], "out of memory");
 	++TOP;
 	js_throw(J);
 }
@@ -58,19 +65,91 @@ void js_free(js_State *J, void *ptr)
 	J->alloc(J->actx, ptr, 0);
 }
 
-js_String *jsV_newmemstring(js_State *J, const char *s, int n)
+static js_String *jsR_allocmemstring(js_State *J, int n)
 {
-	js_String *v = js_malloc(J, soffsetof(js_String, p) + n + 1);
-	memcpy(v->p, s, n);
+	int size = soffsetof(js_String, p) + n + 1;
+	js_String *v;
+	if (size <= UCHAR_MAX) {
+		v = js_slaballoc(J, size);
+		v->size = size;
+	} else {
+		v = js_malloc(J, size);
+		v->size = 0;
+	}
 	v->p[n] = 0;
-	v->gcmark = J->gcmark;
+	v->gcmark = 0;
 	v->gcnext = J->gcstr;
 	J->gcstr = v;
 	++J->gccounter;
 	return v;
 }
 
-#define CHECKSTACK(n) if (TOP + n >= JS_STACKSIZE) js_stackoverflow(J)
+js_String *jsV_newmemstring(js_State *J, const char *s, int n)
+{
+	js_String *v = jsR_allocmemstring(J, n);
+	memcpy(v->p, s, n);
+	return v;
+}
+
+/*
+ * The value stack grows by doubling, up to the limit of the state. The
+ * engine finds its values again by index after anything that may call back
+ * into script, but strings returned by js_tostring can point into the old
+ * block, so it is kept until the outermost call returns; see js_State.
+ */
+static void jsR_resizestack(js_State *J, int size)
+{
+	js_Value *stack;
+
+	if (J->oldstacklen == JS_OLDSTACKS)
+		js_stackoverflow(J);
+
+	stack = js_malloc(J, size * sizeof *stack);
+	memcpy(stack, STACK, TOP * sizeof *stack);
+	J->oldstack[J->oldstacklen++] = STACK;
+	STACK = stack;
+	J->stacksize = size;
+}
+
+/* Free the old blocks once no C function that may point into them is running */
+static void jsR_freestacks(js_State *J)
+{
+	while (J->oldstacklen > 0)
+		js_free(J, J->oldstack[--J->oldstacklen]);
+}
+
+static void jsR_growstack(js_State *J, int n)
+{
+	int size = J->stacksize;
+
+	while (TOP + n >= size && size < J->stacklimit)
+		size *= 2;
+	if (size > J->stacklimit)
+		size = J->stacklimit;
+	if (TOP + n >= size)
+		js_stackoverflow(J);
+
+	jsR_resizestack(J, size);
+}
+
+void js_setlimits(js_State *J, int stacksize, int stacklimit, int calldepth, int trydepth)
+{
+	if (stacklimit > 0)
+		J->stacklimit = stacklimit < J->stacksize ? J->stacksize : stacklimit;
+	if (calldepth > 0)
+		J->envlimit = calldepth < J->envcap ? J->envcap : calldepth;
+	if (J->envlimit < J->tracecap)
+		J->envlimit = J->tracecap;
+	if (trydepth > 0)
+		J->trylimit = trydepth < J->trycap ? J->trycap : trydepth;
+	if (stacksize > J->stacksize) {
+		if (J->stacklimit < stacksize)
+			J->stacklimit = stacksize;
+		jsR_resizestack(J, stacksize);
+	}
+}
+
+#define CHECKSTACK(n) if (TOP + n >= J->stacksize) jsR_growstack(J, n)
 
 void js_pushvalue(js_State *J, js_Value v)
 {
@@ -82,77 +161,79 @@ void js_pushvalue(js_State *J, js_Value v)
 void js_pushundefined(js_State *J)
 {
 	CHECKSTACK(1);
-	STACK[TOP].type = JS_TUNDEFINED;
+	JSV_SETUNDEFINED(STACK[TOP]);
 	++TOP;
 }
 
 void js_pushnull(js_State *J)
 {
 	CHECKSTACK(1);
-	STACK[TOP].type = JS_TNULL;
+	JSV_SETNULL(STACK[TOP]);
 	++TOP;
 }
 
 void js_pushboolean(js_State *J, int v)
 {
 	CHECKSTACK(1);
-	STACK[TOP].type = JS_TBOOLEAN;
-	STACK[TOP].u.boolean = !!v;
+	JSV_SETBOOLEAN(STACK[TOP], v);
 	++TOP;
 }
 
 void js_pushnumber(js_State *J, double v)
 {
 	CHECKSTACK(1);
-	STACK[TOP].type = JS_TNUMBER;
-	STACK[TOP].u.number = v;
+	JSV_SETNUMBER(STACK[TOP], v);
+	++TOP;
+}
+
+static void jsR_pushinteger(js_State *J, int v)
+{
+	CHECKSTACK(1);
+	JSV_SETINTEGER(STACK[TOP], v);
 	++TOP;
 }
 
+/* Push an integer result, promoting to double if it left the int32 range */
+static void jsR_pushint64(js_State *J, int64_t v)
+{
+	if (v >= INT_MIN && v <= INT_MAX)
+		jsR_pushinteger(J, (int)v);
+	else
+		js_pushnumber(J, (double)v);
+}
+
 void js_pushstring(js_State *J, const char *v)
 {
 	int n = (int)strlen(v);
 	CHECKSTACK(1);
-	if (n <= soffsetof(js_Value, type)) {
-		char *s = STACK[TOP].u.shrstr;
-		while (n--) *s++ = *v++;
-		*s = 0;
-		STACK[TOP].type = JS_TSHRSTR;
-	} else {
-		STACK[TOP].type = JS_TMEMSTR;
-		STACK[TOP].u.memstr = jsV_newmemstring(J, v, n);
-	}
+	if (n <= JSV_SHRSTRMAX)
+		JSV_SETSHRSTR(STACK[TOP], v, n);
+	else
+		JSV_SETMEMSTR(STACK[TOP], jsV_newmemstring(J, v, n));
 	++TOP;
 }
 
 void js_pushlstring(js_State *J, const char *v, int n)
 {
 	CHECKSTACK(1);
-	if (n <= soffsetof(js_Value, type)) {
-		char *s = STACK[TOP].u.shrstr;
-		while (n--) *s++ = *v++;
-		*s = 0;
-		STACK[TOP].type = JS_TSHRSTR;
-	} else {
-		STACK[TOP].type = JS_TMEMSTR;
-		STACK[TOP].u.memstr = jsV_newmemstring(J, v, n);
-	}
+	if (n <= JSV_SHRSTRMAX)
+		JSV_SETSHRSTR(STACK[TOP], v, n);
+	else
+		JSV_SETMEMSTR(STACK[TOP], jsV_newmemstring(J, v, n));
 	++TOP;
 }
 
 void js_pushliteral(js_State *J, const char *v)
 {
 	CHECKSTACK(1);
-	STACK[TOP].type = JS_TLITSTR;
-	STACK[TOP].u.litstr = v;
+	JSV_SETLITSTR(STACK[TOP], v);
 	++TOP;
 }
 
 void js_pushobject(js_State *J, js_Object *v)
 {
 	CHECKSTACK(1);
-	STACK[TOP].type = JS_TOBJECT;
-	STACK[TOP].u.object = v;
+	JSV_SETOBJECT(STACK[TOP], v);
 	++TOP;
 }
 
@@ -172,7 +253,7 @@ void js_currentfunction(js_State *J)
 
 static js_Value *stackidx(js_State *J, int idx)
 {
-	static js_Value undefined = { {0}, {0}, JS_TUNDEFINED };
+	static js_Value undefined = JSV_INITUNDEFINED;
 	idx = idx < 0 ? TOP + idx : BOT + idx;
 	if (idx < 0 || idx >= TOP)
 		return &undefined;
@@ -184,66 +265,67 @@ js_Value *js_tovalue(js_State *J, int idx)
 	return stackidx(J, idx);
 }
 
-int js_isdefined(js_State *J, int idx) { return stackidx(J, idx)->type != JS_TUNDEFINED; }
-int js_isundefined(js_State *J, int idx) { return stackidx(J, idx)->type == JS_TUNDEFINED; }
-int js_isnull(js_State *J, int idx) { return stackidx(J, idx)->type == JS_TNULL; }
-int js_isboolean(js_State *J, int idx) { return stackidx(J, idx)->type == JS_TBOOLEAN; }
-int js_isnumber(js_State *J, int idx) { return stackidx(J, idx)->type == JS_TNUMBER; }
-int js_isstring(js_State *J, int idx) { enum js_Type t = stackidx(J, idx)->type; return t == JS_TSHRSTR || t == JS_TLITSTR || t == JS_TMEMSTR; }
-int js_isprimitive(js_State *J, int idx) { return stackidx(J, idx)->type != JS_TOBJECT; }
-int js_isobject(js_State *J, int idx) { return stackidx(J, idx)->type == JS_TOBJECT; }
-int js_iscoercible(js_State *J, int idx) { js_Value *v = stackidx(J, idx); return v->type != JS_TUNDEFINED && v->type != JS_TNULL; }
+int js_isdefined(js_State *J, int idx) { return JSV_TYPE(*stackidx(J, idx)) != JS_TUNDEFINED; }
+int js_isundefined(js_State *J, int idx) { return JSV_TYPE(*stackidx(J, idx)) == JS_TUNDEFINED; }
+int js_isnull(js_State *J, int idx) { return JSV_TYPE(*stackidx(J, idx)) == JS_TNULL; }
+int js_isboolean(js_State *J, int idx) { return JSV_TYPE(*stackidx(J, idx)) == JS_TBOOLEAN; }
+int js_isnumber(js_State *J, int idx) { return JSV_ISNUMBER(*stackidx(J, idx)); }
+int js_isstring(js_State *J, int idx) { enum js_Type t = JSV_TYPE(*stackidx(J, idx)); return t == JS_TSHRSTR || t == JS_TLITSTR || t == JS_TMEMSTR; }
+int js_isprimitive(js_State *J, int idx) { return JSV_TYPE(*stackidx(J, idx)) != JS_TOBJECT; }
+int js_isobject(js_State *J, int idx) { return JSV_TYPE(*stackidx(J, idx)) == JS_TOBJECT; }
+int js_iscoercible(js_State *J, int idx) { js_Value *v = stackidx(J, idx); return JSV_TYPE(*v) != JS_TUNDEFINED && JSV_TYPE(*v) != JS_TNULL; }
 
 int js_iscallable(js_State *J, int idx)
 {
 	js_Value *v = stackidx(J, idx);
-	if (v->type == JS_TOBJECT)
-		return v->u.object->type == JS_CFUNCTION ||
-			v->u.object->type == JS_CSCRIPT ||
-			v->u.object->type == JS_CCFUNCTION;
+	if (JSV_TYPE(*v) == JS_TOBJECT)
+		return JSV_OBJECT(*v)->type == JS_CFUNCTION ||
+			JSV_OBJECT(*v)->type == JS_CSCRIPT ||
+			JSV_OBJECT(*v)->type == JS_CCFUNCTION;
 	return 0;
 }
 
 int js_isarray(js_State *J, int idx)
 {
 	js_Value *v = stackidx(J, idx);
-	return v->type == JS_TOBJECT && v->u.object->type == JS_CARRAY;
+	return JSV_TYPE(*v) == JS_TOBJECT && JSV_OBJECT(*v)->type == JS_CARRAY;
 }
 
 int js_isregexp(js_State *J, int idx)
 {
 	js_Value *v = stackidx(J, idx);
-	return v->type == JS_TOBJECT && v->u.object->type == JS_CREGEXP;
+	return JSV_TYPE(*v) == JS_TOBJECT && JSV_OBJECT(*v)->type == JS_CREGEXP;
 }
 
 int js_isuserdata(js_State *J, int idx, const char *tag)
 {
 	js_Value *v = stackidx(J, idx);
-	if (v->type == JS_TOBJECT && v->u.object->type == JS_CUSERDATA)
-		return !strcmp(tag, v->u.object->u.user.tag);
+	if (JSV_TYPE(*v) == JS_TOBJECT && JSV_OBJECT(*v)->type == JS_CUSERDATA)
+		return !strcmp(tag, JSV_OBJECT(*v)->u.user.tag);
 	return 0;
 }
 
 int js_iserror(js_State *J, int idx)
 {
 	js_Value *v = stackidx(J, idx);
-	return v->type == JS_TOBJECT && v->u.object->type == JS_CERROR;
+	return JSV_TYPE(*v) == JS_TOBJECT && JSV_OBJECT(*v)->type == JS_CERROR;
 }
 
 const char *js_typeof(js_State *J, int idx)
 {
 	js_Value *v = stackidx(J, idx);
-	switch (v->type) {
+	switch (JSV_TYPE(*v)) {
 	default:
 	case JS_TSHRSTR: return "string";
 	case JS_TUNDEFINED: return "undefined";
 	case JS_TNULL: return "object";
 	case JS_TBOOLEAN: return "boolean";
 	case JS_TNUMBER: return "number";
+	case JS_TINTEGER: return "number";
 	case JS_TLITSTR: return "string";
 	case JS_TMEMSTR: return "string";
 	case JS_TOBJECT:
-		if (v->u.object->type == JS_CFUNCTION || v->u.object->type == JS_CCFUNCTION)
+		if (JSV_OBJECT(*v)->type == JS_CFUNCTION || JSV_OBJECT(*v)->type == JS_CCFUNCTION)
 			return "function";
 		return "object";
 	}
@@ -256,37 +338,43 @@ int js_toboolean(js_State *J, int idx)
 
 double js_tonumber(js_State *J, int idx)
 {
-	return jsV_tonumber(J, stackidx(J, idx));
+	return jsV_tonumber(J, idx);
 }
 
 int js_tointeger(js_State *J, int idx)
 {
-	return jsV_numbertointeger(jsV_tonumber(J, stackidx(J, idx)));
+	return jsV_numbertointeger(jsV_tonumber(J, idx));
 }
 
 int js_toint32(js_State *J, int idx)
 {
-	return jsV_numbertoint32(jsV_tonumber(J, stackidx(J, idx)));
+	js_Value *v = stackidx(J, idx);
+	if (JSV_TYPE(*v) == JS_TINTEGER)
+		return JSV_INTEGER(*v);
+	return jsV_numbertoint32(jsV_tonumber(J, idx));
 }
 
 unsigned int js_touint32(js_State *J, int idx)
 {
-	return jsV_numbertouint32(jsV_tonumber(J, stackidx(J, idx)));
+	js_Value *v = stackidx(J, idx);
+	if (JSV_TYPE(*v) == JS_TINTEGER)
+		return JSV_INTEGER(*v);
+	return jsV_numbertouint32(jsV_tonumber(J, idx));
 }
 
 short js_toint16(js_State *J, int idx)
 {
-	return jsV_numbertoint16(jsV_tonumber(J, stackidx(J, idx)));
+	return jsV_numbertoint16(jsV_tonumber(J, idx));
 }
 
 unsigned short js_touint16(js_State *J, int idx)
 {
-	return jsV_numbertouint16(jsV_tonumber(J, stackidx(J, idx)));
+	return jsV_numbertouint16(jsV_tonumber(J, idx));
 }
 
 const char *js_tostring(js_State *J, int idx)
 {
-	return jsV_tostring(J, stackidx(J, idx));
+	return jsV_tostring(J, idx);
 }
 
 js_Object *js_toobject(js_State *J, int idx)
@@ -296,42 +384,42 @@ js_Object *js_toobject(js_State *J, int idx)
 
 js_Object *js_asobject(js_State *J, int idx) {
     js_Value* v = stackidx(J, idx);
-    if(v && v->type == JS_TOBJECT) {
-        return v->u.object;
+    if(v && JSV_TYPE(*v) == JS_TOBJECT) {
+        return JSV_OBJECT(*v);
     }
     return NULL;
 }
 
 void js_toprimitive(js_State *J, int idx, int hint)
 {
-	jsV_toprimitive(J, stackidx(J, idx), hint);
+	jsV_toprimitive(J, idx, hint);
 }
 
 js_Regexp *js_toregexp(js_State *J, int idx)
 {
 	js_Value *v = stackidx(J, idx);
-	if (v->type == JS_TOBJECT && v->u.object->type == JS_CREGEXP)
-		return &v->u.object->u.r;
+	if (JSV_TYPE(*v) == JS_TOBJECT && JSV_OBJECT(*v)->type == JS_CREGEXP)
+		return &JSV_OBJECT(*v)->u.r;
 	js_typeerror(J, "not a regexp");
 }
 
 void *js_touserdata(js_State *J, int idx, const char *tag)
 {
 	js_Value *v = stackidx(J, idx);
-	if (v->type == JS_TOBJECT && v->u.object->type == JS_CUSERDATA)
-		if (!strcmp(tag, v->u.object->u.user.tag))
-			return v->u.object->u.user.data;
+	if (JSV_TYPE(*v) == JS_TOBJECT && JSV_OBJECT(*v)->type == JS_CUSERDATA)
+		if (!strcmp(tag, JSV_OBJECT(*v)->u.user.tag))
+			return JSV_OBJECT(*v)->u.user.data;
 	js_typeerror(J, "not a %s", tag);
 }
 
 static js_Object *jsR_tofunction(js_State *J, int idx)
 {
 	js_Value *v = stackidx(J, idx);
-	if (v->type == JS_TUNDEFINED || v->type == JS_TNULL)
+	if (JSV_TYPE(*v) == JS_TUNDEFINED || JSV_TYPE(*v) == JS_TNULL)
 		return NULL;
-	if (v->type == JS_TOBJECT)
-		if (v->u.object->type == JS_CFUNCTION || v->u.object->type == JS_CCFUNCTION)
-			return v->u.object;
+	if (JSV_TYPE(*v) == JS_TOBJECT)
+		if (JSV_OBJECT(*v)->type == JS_CFUNCTION || JSV_OBJECT(*v)->type == JS_CCFUNCTION)
+			return JSV_OBJECT(*v);
 	js_typeerror(J, "not a function");
 }
 
@@ -483,14 +571,14 @@ static int jsR_hasproperty(js_State *J, js_Object *obj, const char *name)
 
 	if (obj->type == JS_CARRAY) {
 		if (!strcmp(name, "length")) {
-			js_pushnumber(J, obj->u.a.length);
+			jsR_pushinteger(J, obj->u.a.length);
 			return 1;
 		}
 	}
 
 	else if (obj->type == JS_CSTRING) {
 		if (!strcmp(name, "length")) {
-			js_pushnumber(J, obj->u.s.length);
+			jsR_pushinteger(J, obj->u.s.length);
 			return 1;
 		}
 		if (js_isarrayindex(J, name, &k)) {
@@ -529,7 +617,16 @@ static int jsR_hasproperty(js_State *J, js_Object *obj, const char *name)
 			return 1;
 	}
 
-	ref = jsV_getproperty(J, obj, name);
+	if (obj->dense && jsV_isindex(name, &k)) {
+		js_Value *v = jsV_getelement(obj, k);
+		if (v) {
+			js_pushvalue(J, *v);
+			return 1;
+		}
+		ref = obj->prototype ? jsV_getproperty(J, obj->prototype, name) : NULL;
+	} else {
+		ref = jsV_getproperty(J, obj, name);
+	}
 	if (ref) {
 		if (ref->getter) {
 			js_pushobject(J, ref->getter);
@@ -552,14 +649,14 @@ static void jsR_getproperty(js_State *J, js_Object *obj, const char *name)
 
 static void jsR_setproperty(js_State *J, js_Object *obj, const char *name)
 {
-	js_Value *value = stackidx(J, -1);
+	js_Value value = *stackidx(J, -1); /* a copy, since a callback may move the stack */
 	js_Property *ref;
-	int k;
+	int k, dense = 0;
 	int own;
 
 	if (obj->type == JS_CARRAY) {
 		if (!strcmp(name, "length")) {
-			double rawlen = jsV_tonumber(J, value);
+			double rawlen = jsV_tonumber(J, -1);
 			int newlen = jsV_numbertointeger(rawlen);
 			if (newlen != rawlen || newlen < 0)
 				js_rangeerror(J, "invalid array length");
@@ -585,7 +682,7 @@ static void jsR_setproperty(js_State *J, js_Object *obj, const char *name)
 		if (!strcmp(name, "ignoreCase")) goto readonly;
 		if (!strcmp(name, "multiline")) goto readonly;
 		if (!strcmp(name, "lastIndex")) {
-			obj->u.r.last = jsV_tointeger(J, value);
+			obj->u.r.last = jsV_tointeger(J, -1);
 			return;
 		}
 	}
@@ -595,13 +692,29 @@ static void jsR_setproperty(js_State *J, js_Object *obj, const char *name)
 			return;
 	}
 
+	/* Elements of dense objects are plain values */
+	if (obj->dense && jsV_isindex(name, &k)) {
+		js_Value *v = jsV_getelement(obj, k);
+		if (v) {
+			JSG_BARRIER(J, obj, value);
+			*v = value;
+			return;
+		}
+		dense = 1;
+	}
+
 	/* First try to find a setter in prototype chain */
-	ref = jsV_getpropertyx(J, obj, name, &own);
+	if (dense) {
+		ref = obj->prototype ? jsV_getproperty(J, obj->prototype, name) : NULL;
+		own = 0;
+	} else {
+		ref = jsV_getpropertyx(J, obj, name, &own);
+	}
 	if (ref) {
 		if (ref->setter) {
 			js_pushobject(J, ref->setter);
 			js_pushobject(J, obj);
-			js_pushvalue(J, *value);
+			js_pushvalue(J, value);
 			js_call(J, 1);
 			js_pop(J, 1);
 			return;
@@ -613,14 +726,17 @@ static void jsR_setproperty(js_State *J, js_Object *obj, const char *name)
 	}
 
 	/* Property not found on this object, so create one */
-	if (!ref || !own)
+	if (!ref || !own) {
+		if (dense && jsV_setelement(J, obj, k, &value))
+			return;
 		ref = jsV_setproperty(J, obj, name);
+	}
 
 	if (ref) {
-		if (!(ref->atts & JS_READONLY))
-			ref->value = *value;
-		else
+		if (ref->atts & JS_READONLY)
 			goto readonly;
+		JSG_BARRIER(J, obj, value);
+		ref->value = value;
 	}
 
 	return;
@@ -633,8 +749,15 @@ readonly:
 static void jsR_defproperty(js_State *J, js_Object *obj, const char *name,
 	int atts, js_Value *value, js_Object *getter, js_Object *setter)
 {
+	js_Value copy;
 	js_Property *ref;
 	int k;
+
+	/* the put callback of userdata may move the stack */
+	if (value) {
+		copy = *value;
+		value = &copy;
+	}
     if(strcmp(name, "__esModule") == 0) {
         return;
     }
@@ -665,12 +788,23 @@ static void jsR_defproperty(js_State *J, js_Object *obj, const char *name,
 			return;
 	}
 
+	/* Elements with attributes or accessors make a dense object sparse */
+	if (obj->dense && jsV_isindex(name, &k)) {
+		if (value && !getter && !setter && !atts && jsV_setelement(J, obj, k, value))
+			return;
+		if (obj->dense)
+			jsV_tosparse(J, obj);
+	}
+
 	ref = jsV_setproperty(J, obj, name);
 	if (ref) {
+		if ((getter || setter) && obj->gcmark == J->gcmark)
+			jsG_remember(J, obj);
 		if (value) {
-			if (!(ref->atts & JS_READONLY))
+			if (!(ref->atts & JS_READONLY)) {
+				JSG_BARRIER(J, obj, *value);
 				ref->value = *value;
-			else if (J->strict)
+			} else if (J->strict)
 				js_typeerror(J, "'%s' is read-only", name);
 		}
 		if (getter) {
@@ -726,6 +860,11 @@ static int jsR_delproperty(js_State *J, js_Object *obj, const char *name)
 			return 1;
 	}
 
+	if (obj->dense && jsV_isindex(name, &k)) {
+		jsV_delelement(J, obj, k);
+		return 1;
+	}
+
 	ref = jsV_getownproperty(J, obj, name);
 	if (ref) {
 		if (ref->atts & JS_DONTCONF)
@@ -740,6 +879,313 @@ dontconf:
 	return 0;
 }
 
+/* Element access with a number key on dense objects */
+
+static js_Value *jsR_numberelement(js_Value *o, js_Value *key)
+{
+	double x;
+	int k;
+	if (JSV_TYPE(*o) != JS_TOBJECT)
+		return NULL;
+	if (JSV_TYPE(*key) == JS_TINTEGER)
+		return JSV_INTEGER(*key) >= 0 ? jsV_getelement(JSV_OBJECT(*o), JSV_INTEGER(*key)) : NULL;
+	if (JSV_TYPE(*key) != JS_TNUMBER)
+		return NULL;
+	x = JSV_NUMBER(*key);
+	if (!(x >= 0 && x < INT_MAX))
+		return NULL;
+	k = x;
+	if (k != x)
+		return NULL;
+	return jsV_getelement(JSV_OBJECT(*o), k);
+}
+
+/* Both operands on top of the stack are int32 */
+#define INTOPERANDS() (JSV_TYPE(STACK[TOP-2]) == JS_TINTEGER && JSV_TYPE(STACK[TOP-1]) == JS_TINTEGER)
+
+/* js_compare() with the ToPrimitive steps skipped for numbers */
+static int jsR_compare(js_State *J, int *okay)
+{
+	js_Value *x = &STACK[TOP-2];
+	js_Value *y = &STACK[TOP-1];
+	double a, b;
+	if (INTOPERANDS()) {
+		*okay = 1;
+		return (JSV_INTEGER(*x) > JSV_INTEGER(*y)) - (JSV_INTEGER(*x) < JSV_INTEGER(*y));
+	}
+	if (JSV_ISNUMBER(*x) && JSV_ISNUMBER(*y)) {
+		a = JSV_ASNUMBER(*x);
+		b = JSV_ASNUMBER(*y);
+		*okay = !isnan(a) && !isnan(b);
+		return a < b ? -1 : a > b ? 1 : 0;
+	}
+	return js_compare(J, okay);
+}
+
+/*
+ * The generic arithmetic and comparison opcodes rewrite themselves in
+ * place into a variant for the operand types they see: numbers, or
+ * strings. The variant only checks its guard; when that fails it reverts
+ * to the generic opcode. A function whose sites keep changing types
+ * stops quickening after JS_DEOPTLIMIT reverts.
+ */
+
+#define ISSTRING(v) (JSV_TYPE(v) == JS_TSHRSTR || JSV_TYPE(v) == JS_TLITSTR || JSV_TYPE(v) == JS_TMEMSTR)
+#define NUMOPERANDS() (JSV_ISNUMBER(STACK[TOP-2]) && JSV_ISNUMBER(STACK[TOP-1]))
+#define STROPERANDS() (ISSTRING(STACK[TOP-2]) && ISSTRING(STACK[TOP-1]))
+
+/* The characters of a value known to be a string; nothing is called */
+#define STRINGOF(v) (JSV_TYPE(v) == JS_TSHRSTR ? JSV_SHRSTR(v) : JSV_TYPE(v) == JS_TLITSTR ? JSV_LITSTR(v) : JSV_MEMSTR(v)->p)
+
+/* Compare the two numbers on top of the stack */
+#define NUMCOMPARE(op) (INTOPERANDS() ? \
+	JSV_INTEGER(STACK[TOP-2]) op JSV_INTEGER(STACK[TOP-1]) : \
+	JSV_ASNUMBER(STACK[TOP-2]) op JSV_ASNUMBER(STACK[TOP-1]))
+
+#define STREQUAL() (!strcmp(STRINGOF(STACK[TOP-2]), STRINGOF(STACK[TOP-1])))
+
+/* Replace the two operands on top of the stack with a boolean */
+#define SETBOOLEAN(b) (JSV_SETBOOLEAN(STACK[TOP-2], b), --TOP)
+
+static void jsR_addnumbers(js_State *J)
+{
+	js_Value *x = &STACK[TOP-2];
+	js_Value *y = &STACK[TOP-1];
+	if (INTOPERANDS()) {
+		int64_t v = (int64_t)JSV_INTEGER(*x) + JSV_INTEGER(*y);
+		if (v >= INT_MIN && v <= INT_MAX)
+			JSV_SETINTEGER(*x, (int)v);
+		else
+			JSV_SETNUMBER(*x, (double)v);
+	} else {
+		double v = JSV_ASNUMBER(*x) + JSV_ASNUMBER(*y);
+		JSV_SETNUMBER(*x, v);
+	}
+	--TOP;
+}
+
+/* js_concat() for two strings, without the ToPrimitive steps and the copy */
+static void jsR_addstrings(js_State *J)
+{
+	const char *sa = STRINGOF(STACK[TOP-2]);
+	const char *sb = STRINGOF(STACK[TOP-1]);
+	size_t na = strlen(sa);
+	size_t nb = strlen(sb);
+	js_String *v;
+	if (na + nb <= JSV_SHRSTRMAX) {
+		char buf[JSV_SHRSTRMAX + 1];
+		memcpy(buf, sa, na);
+		memcpy(buf + na, sb, nb);
+		JSV_SETSHRSTR(STACK[TOP-2], buf, (int)(na + nb));
+	} else if (na + nb < INT_MAX) {
+		v = jsR_allocmemstring(J, (int)(na + nb));
+		memcpy(v->p, sa, na);
+		memcpy(v->p + na, sb, nb);
+		JSV_SETMEMSTR(STACK[TOP-2], v);
+	} else {
+		js_concat(J);
+		return;
+	}
+	--TOP;
+}
+
+/* Pop the value of a switch and find the clause for it in the jump table, or -1 */
+static int jsR_switch(js_State *J, js_Function *F, js_SwitchTable *T)
+{
+	js_Value *v = &STACK[TOP-1];
+	const char *str;
+	double x;
+	int k = -1;
+
+	if (T->strings) {
+		if (ISSTRING(*v)) {
+			str = STRINGOF(*v);
+			k = jsC_strhash(str) & (T->len - 1);
+			while (T->jump[k] >= 0 && strcmp(F->strtab[T->key[k]], str))
+				k = (k + 1) & (T->len - 1);
+			k = T->jump[k];
+		}
+	} else if (JSV_ISNUMBER(*v)) {
+		x = JSV_ASNUMBER(*v);
+		if (x >= T->min && x < T->min + T->len && x == (int)x)
+			k = T->jump[(int)x - T->min];
+	}
+
+	--TOP;
+	return k;
+}
+
+/* Property access through inline caches */
+
+static int jsR_cacheable(js_State *J, js_Object *obj, const char *name)
+{
+	int k;
+	switch (obj->type) {
+	case JS_CARRAY:
+	case JS_CSTRING:
+	case JS_CARGUMENTS:
+		return strcmp(name, "length") && !js_isarrayindex(J, name, &k);
+	case JS_CREGEXP:
+	case JS_CUSERDATA:
+		return 0;
+	default:
+		return 1;
+	}
+}
+
+static void jsR_getpropertycache(js_State *J, js_Object *obj, const char *name, js_PropCache *cache)
+{
+	js_PropCache *c = jsV_probecache(J, cache, obj);
+	js_Property *ref;
+
+	if (!c) {
+		if (!jsR_cacheable(J, obj, name)) {
+			jsR_getproperty(J, obj, name);
+			return;
+		}
+		c = jsV_fillcache(J, cache, obj, name, 0);
+	}
+
+	ref = c->slot >= 0 ? &obj->slots[c->slot] : c->ref;
+	if (!ref) {
+		js_pushundefined(J);
+	} else if (ref->getter) {
+		js_pushobject(J, ref->getter);
+		js_pushobject(J, obj);
+		js_call(J, 0);
+	} else {
+		js_pushvalue(J, ref->value);
+	}
+}
+
+static void jsR_setpropertycache(js_State *J, js_Object *obj, const char *name, js_PropCache *cache)
+{
+	js_PropCache *c = jsV_probecache(J, cache, obj);
+	js_Property *ref;
+
+	if (c) {
+		ref = c->slot >= 0 ? &obj->slots[c->slot] : c->ref;
+		if (ref && (c->slot >= 0 || c->holder == obj)) {
+			if (!ref->getter && !ref->setter && !(ref->atts & JS_READONLY)) {
+				JSG_BARRIER(J, obj, *stackidx(J, -1));
+				ref->value = *stackidx(J, -1);
+				return;
+			}
+		} else if (!ref && c->next && obj->extensible) {
+			ref = jsV_addproperty(J, obj, c->next);
+			JSG_BARRIER(J, obj, *stackidx(J, -1));
+			ref->value = *stackidx(J, -1);
+			return;
+		}
+	} else if (jsR_cacheable(J, obj, name)) {
+		jsV_fillcache(J, cache, obj, name, 1);
+	}
+
+	jsR_setproperty(J, obj, name);
+}
+
+static void jsR_getvarcache(js_State *J, const char *name, js_PropCache *cache)
+{
+	js_Environment *key = J->E;
+	js_PropCache *c;
+
+	/*
+	 * Slotted environments on the way are the same functions every time this
+	 * instruction runs, but they may be new or reused memory; key the cache
+	 * on the first environment with a variables object instead.
+	 */
+	while (key->slots)
+		key = key->outer;
+
+	c = jsV_probevarcache(J, cache, key);
+	if (!c)
+		c = jsV_fillvarcache(J, cache, J->E, key, name);
+	if (!c) {
+		/* declared in a slotted environment */
+		if (!js_hasvar(J, name))
+			js_referenceerror(J, "'%s' is not defined", name);
+		return;
+	}
+	if (!c->ref)
+		js_referenceerror(J, "'%s' is not defined", name);
+	if (c->ref->getter) {
+		js_pushobject(J, c->ref->getter);
+		js_pushobject(J, c->obj);
+		js_call(J, 0);
+	} else {
+		js_pushvalue(J, c->ref->value);
+	}
+}
+
+/*
+	Names the compiler proved to be global are cached per instruction as
+	a pointer to the own property of the global object, valid while
+	J->gversion is unchanged. Inherited and undeclared globals take the
+	slow path every time.
+*/
+
+static js_Property *jsR_globalref(js_State *J, const char *name, js_PropCache *c)
+{
+	if (!c->ref || c->version != J->gversion) {
+		c->ref = jsV_getownproperty(J, J->G, name);
+		c->version = J->gversion;
+	}
+	return c->ref;
+}
+
+static void jsR_getglobal(js_State *J, const char *name, js_PropCache *cache)
+{
+	js_Property *ref = jsR_globalref(J, name, cache);
+	if (!ref)
+		ref = jsV_getproperty(J, J->G, name);
+	if (!ref)
+		js_referenceerror(J, "'%s' is not defined", name);
+	if (ref->getter) {
+		js_pushobject(J, ref->getter);
+		js_pushobject(J, J->G);
+		js_call(J, 0);
+	} else {
+		js_pushvalue(J, ref->value);
+	}
+}
+
+/* Write barrier for a property jsV_getpropertyx found on obj, or further up the prototype chain */
+static void jsR_barrierproperty(js_State *J, js_Object *obj, int own, js_Value *v)
+{
+	if (own)
+		JSG_BARRIER(J, obj, *v);
+	else
+		while ((obj = obj->prototype))
+			JSG_BARRIER(J, obj, *v);
+}
+
+static void jsR_setglobal(js_State *J, const char *name, js_PropCache *cache)
+{
+	js_Property *ref = jsR_globalref(J, name, cache);
+	int own = 1;
+	if (!ref)
+		ref = jsV_getpropertyx(J, J->G, name, &own);
+	if (!ref) {
+		if (J->strict)
+			js_referenceerror(J, "assignment to undeclared variable '%s'", name);
+		jsR_setproperty(J, J->G, name);
+		return;
+	}
+	if (ref->setter) {
+		js_pushobject(J, ref->setter);
+		js_pushobject(J, J->G);
+		js_copy(J, -3);
+		js_call(J, 1);
+		js_pop(J, 1);
+		return;
+	}
+	if (!(ref->atts & JS_READONLY)) {
+		jsR_barrierproperty(J, J->G, own, stackidx(J, -1));
+		ref->value = *stackidx(J, -1);
+	} else if (J->strict)
+		js_typeerror(J, "'%s' is read-only", name);
+}
+
 /* Registry, global and object property accessors */
 
 const char *js_ref(js_State *J)
@@ -747,14 +1193,14 @@ const char *js_ref(js_State *J)
 	js_Value *v = stackidx(J, -1);
 	const char *s;
 	char buf[32];
-	switch (v->type) {
+	switch (JSV_TYPE(*v)) {
 	case JS_TUNDEFINED: s = "_Undefined"; break;
 	case JS_TNULL: s = "_Null"; break;
 	case JS_TBOOLEAN:
-		s = v->u.boolean ? "_True" : "_False";
+		s = JSV_BOOLEAN(*v) ? "_True" : "_False";
 		break;
 	case JS_TOBJECT:
-		sprintf(buf, "%p", (void*)v->u.object);
+		sprintf(buf, "%p", (void*)JSV_OBJECT(*v));
 		s = js_intern(J, buf);
 		break;
 	default:
@@ -853,17 +1299,111 @@ const char *js_nextiterator(js_State *J, int idx)
 
 js_Environment *jsR_newenvironment(js_State *J, js_Object *vars, js_Environment *outer)
 {
-	js_Environment *E = js_malloc(J, sizeof *E);
-	E->gcmark = J->gcmark;
+	js_Environment *E;
+	JSG_SCOPE(J, outer);
+	E = js_slaballoc(J, sizeof *E);
+	E->slotcap = 0;
+	E->gcmark = 0;
 	E->gcnext = J->gcenv;
 	J->gcenv = E;
 	++J->gccounter;
 
 	E->outer = outer;
 	E->variables = vars;
+	E->function = NULL;
+	E->slots = NULL;
+	return E;
+}
+
+js_Environment *jsR_newslotenvironment(js_State *J, js_Function *function, js_Environment *outer)
+{
+	js_Environment *E;
+	JSG_SCOPE(J, outer);
+	E = js_slaballoc(J, sizeof *E + function->varlen * sizeof(js_Value));
+	E->slotcap = function->varlen;
+	E->gcmark = 0;
+	E->gcnext = J->gcenv;
+	J->gcenv = E;
+	++J->gccounter;
+
+	E->outer = outer;
+	E->variables = NULL;
+	E->function = function;
+	E->slots = (js_Value*)(E + 1);
+	return E;
+}
+
+/*
+ * The compiler marks functions whose environment can not outlive the call.
+ * They take it from a per-state pool instead of the garbage collector.
+ * Calls nest, so the pool is a stack: an environment goes back when the
+ * scope it was entered from is restored, or when an exception unwinds
+ * past it.
+ */
+static js_Environment *jsR_newpoolenvironment(js_State *J, js_Function *function, js_Environment *outer)
+{
+	js_Environment *E;
+
+	JSG_SCOPE(J, outer);
+
+	if (J->pooltop == J->poollen) {
+		if (J->poollen == J->poolcap) {
+			int cap = J->poolcap ? J->poolcap * 2 : 16;
+			J->envpool = js_realloc(J, J->envpool, cap * sizeof *J->envpool);
+			J->poolcap = cap;
+		}
+		E = js_malloc(J, sizeof *E + function->varlen * sizeof(js_Value));
+		E->slotcap = function->varlen;
+		J->envpool[J->poollen++] = E;
+	} else {
+		E = J->envpool[J->pooltop];
+		if (E->slotcap < function->varlen) {
+			E = js_realloc(J, E, sizeof *E + function->varlen * sizeof(js_Value));
+			E->slotcap = function->varlen;
+			J->envpool[J->pooltop] = E;
+		}
+	}
+	++J->pooltop;
+
+	E->gcmark = 0;
+	E->gcnext = NULL;
+	E->poolmark = J->envtop + 1;
+
+	E->outer = outer;
+	E->variables = NULL;
+	E->function = function;
+	E->slots = (js_Value*)(E + 1);
 	return E;
 }
 
+/* Return the pooled environments of calls that are no longer on the environment stack */
+static void jsR_releasepool(js_State *J)
+{
+	while (J->pooltop > 0 && J->envpool[J->pooltop-1]->poolmark > J->envtop)
+		--J->pooltop;
+}
+
+int jsR_findslot(js_Environment *E, const char *name)
+{
+	const char **VT = E->function->vartab;
+	int i;
+	for (i = E->function->varlen; i > 0; --i)
+		if (!strcmp(VT[i-1], name))
+			return i - 1;
+	return -1;
+}
+
+static js_Value *jsR_upvalue(js_Environment *E, int depth, int k)
+{
+	for (;;) {
+		while (!E->slots)
+			E = E->outer;
+		if (depth-- == 0)
+			return E->slots + k - 1;
+		E = E->outer;
+	}
+}
+
 static void js_initvar(js_State *J, const char *name, int idx)
 {
 	jsR_defproperty(J, J->E->variables, name, JS_DONTENUM | JS_DONTCONF, stackidx(J, idx), NULL, NULL);
@@ -873,7 +1413,17 @@ static int js_hasvar(js_State *J, const char *name)
 {
 	js_Environment *E = J->E;
 	do {
-		js_Property *ref = jsV_getproperty(J, E->variables, name);
+		js_Property *ref;
+		if (E->slots) {
+			int k = jsR_findslot(E, name);
+			if (k >= 0) {
+				js_pushvalue(J, E->slots[k]);
+				return 1;
+			}
+			E = E->outer;
+			continue;
+		}
+		ref = jsV_getproperty(J, E->variables, name);
 		if (ref) {
 			if (ref->getter) {
 				js_pushobject(J, ref->getter);
@@ -893,7 +1443,18 @@ static void js_setvar(js_State *J, const char *name)
 {
 	js_Environment *E = J->E;
 	do {
-		js_Property *ref = jsV_getproperty(J, E->variables, name);
+		js_Property *ref;
+		int own;
+		if (E->slots) {
+			int k = jsR_findslot(E, name);
+			if (k >= 0) {
+				E->slots[k] = *stackidx(J, -1);
+				return;
+			}
+			E = E->outer;
+			continue;
+		}
+		ref = jsV_getpropertyx(J, E->variables, name, &own);
 		if (ref) {
 			if (ref->setter) {
 				js_pushobject(J, ref->setter);
@@ -903,9 +1464,10 @@ static void js_setvar(js_State *J, const char *name)
 				js_pop(J, 1);
 				return;
 			}
-			if (!(ref->atts & JS_READONLY))
+			if (!(ref->atts & JS_READONLY)) {
+				jsR_barrierproperty(J, E->variables, own, stackidx(J, -1));
 				ref->value = *stackidx(J, -1);
-			else if (J->strict)
+			} else if (J->strict)
 				js_typeerror(J, "'%s' is read-only", name);
 			return;
 		}
@@ -920,7 +1482,17 @@ static int js_delvar(js_State *J, const char *name)
 {
 	js_Environment *E = J->E;
 	do {
-		js_Property *ref = jsV_getownproperty(J, E->variables, name);
+		js_Property *ref;
+		if (E->slots) {
+			if (jsR_findslot(E, name) >= 0) {
+				if (J->strict)
+					js_typeerror(J, "'%s' is non-configurable", name);
+				return 0;
+			}
+			E = E->outer;
+			continue;
+		}
+		ref = jsV_getownproperty(J, E->variables, name);
 		if (ref) {
 			if (ref->atts & JS_DONTCONF) {
 				if (J->strict)
@@ -937,63 +1509,145 @@ static int js_delvar(js_State *J, const char *name)
 
 /* Function calls */
 
+/* Double the capacity of a growable array, up to limit */
+static void *jsR_growarray(js_State *J, void *p, int *cap, int limit, int size)
+{
+	int n = *cap * 2 < limit ? *cap * 2 : limit;
+	p = js_realloc(J, p, n * size);
+	*cap = n;
+	return p;
+}
+
 static void jsR_savescope(js_State *J, js_Environment *newE)
 {
-	if (J->envtop + 1 >= JS_ENVLIMIT)
-		js_stackoverflow(J);
+	if (J->envtop + 1 >= J->envcap) {
+		if (J->envcap >= J->envlimit)
+			js_stackoverflow(J);
+		J->envstack = jsR_growarray(J, J->envstack, &J->envcap, J->envlimit, sizeof *J->envstack);
+	}
 	J->envstack[J->envtop++] = J->E;
 	J->E = newE;
+	JSG_SCOPE(J, newE);
 }
 
 static void jsR_restorescope(js_State *J)
 {
 	J->E = J->envstack[--J->envtop];
+	jsR_releasepool(J);
 }
 
-static void jsR_calllwfunction(js_State *J, int n, js_Function *F, js_Environment *scope)
+/* Push a new arguments object holding the n values from STACK[base] */
+static void jsR_newarguments(js_State *J, int base, int n)
 {
-	js_Value v;
 	int i;
+	js_newarguments(J);
+	if (!J->strict) {
+		js_currentfunction(J);
+		js_defproperty(J, -2, "callee", JS_DONTENUM);
+	}
+	jsR_pushinteger(J, n);
+	js_defproperty(J, -2, "length", JS_DONTENUM);
+	for (i = 0; i < n; ++i) {
+		js_pushvalue(J, STACK[base + i]);
+		js_setindex(J, -2, i);
+	}
+}
 
-	jsR_savescope(J, scope);
+/*
+	Functions with an argslot make their arguments object only when it is
+	used as an object. Until then the argument count and the arguments stay
+	on the stack above the locals, at argbase, and the argslot local holds
+	a hole.
+*/
 
-	if (n > F->numparams) {
-		js_pop(J, n - F->numparams);
-		n = F->numparams;
-	}
+#define ARGSLOT(k) (LT ? &LT[k] : &STACK[BOT + (k)])
 
-	for (i = n; i < F->varlen; ++i)
-		js_pushundefined(J);
+static void jsR_keeparguments(js_State *J, int n, int nlocals)
+{
+	int argbase = BOT + nlocals + 1;
+	CHECKSTACK(nlocals + 1);
+	memmove(STACK + argbase + 1, STACK + BOT + 1, n * sizeof *STACK);
+	JSV_SETINTEGER(STACK[argbase], n);
+	TOP = argbase + n + 1;
+}
 
-	jsR_run(J, F);
-	v = *stackidx(J, -1);
-	TOP = --BOT; /* clear stack */
-	js_pushvalue(J, v);
+static void jsR_pusharguments(js_State *J, js_Value *LT, int k, int argbase)
+{
+	if (JSV_TYPE(*ARGSLOT(k)) == JS_THOLE) {
+		jsR_newarguments(J, argbase + 1, JSV_INTEGER(STACK[argbase]));
+		*ARGSLOT(k) = STACK[TOP-1];
+	} else {
+		js_pushvalue(J, *ARGSLOT(k));
+	}
+}
 
-	jsR_restorescope(J);
+/* Index of an arguments element if the key is a non-negative integer, else -1 */
+static int jsR_argindex(js_Value *key)
+{
+	double x;
+	if (JSV_TYPE(*key) == JS_TINTEGER)
+		return JSV_INTEGER(*key) >= 0 ? JSV_INTEGER(*key) : -1;
+	if (JSV_TYPE(*key) != JS_TNUMBER)
+		return -1;
+	x = JSV_NUMBER(*key);
+	if (!(x >= 0 && x < INT_MAX) || (int)x != x)
+		return -1;
+	return x;
 }
 
-static void jsR_callfunction(js_State *J, int n, js_Function *F, js_Environment *scope)
+static void jsR_initlocals(js_State *J, int n, js_Function *F, js_Environment *scope)
 {
-	js_Value v;
 	int i;
 
-	scope = jsR_newenvironment(J, jsV_newobject(J, JS_COBJECT, NULL), scope);
-
 	jsR_savescope(J, scope);
 
-	if (F->arguments) {
-		js_newarguments(J);
-		if (!J->strict) {
-			js_currentfunction(J);
-			js_defproperty(J, -2, "callee", JS_DONTENUM);
-		}
-		js_pushnumber(J, n);
-		js_defproperty(J, -2, "length", JS_DONTENUM);
-		for (i = 0; i < n; ++i) {
-			js_copy(J, i + 1);
-			js_setindex(J, -2, i);
+	if (F->argslot) {
+		jsR_keeparguments(J, n, F->varlen);
+		for (i = n < F->numparams ? n : F->numparams; i < F->varlen; ++i)
+			JSV_SETUNDEFINED(STACK[BOT + 1 + i]);
+		JSV_SETHOLE(STACK[BOT + F->argslot]);
+	} else {
+		if (n > F->numparams) {
+			js_pop(J, n - F->numparams);
+			n = F->numparams;
 		}
+		for (i = n; i < F->varlen; ++i)
+			js_pushundefined(J);
+	}
+}
+
+static void jsR_initslots(js_State *J, int n, js_Function *F, js_Environment *scope)
+{
+	int i;
+
+	if (F->escapes)
+		jsR_savescope(J, jsR_newslotenvironment(J, F, scope));
+	else
+		jsR_savescope(J, jsR_newpoolenvironment(J, F, scope));
+
+	for (i = 0; i < n && i < F->numparams; ++i)
+		J->E->slots[i] = *stackidx(J, i + 1);
+	for (; i < F->varlen; ++i)
+		JSV_SETUNDEFINED(J->E->slots[i]);
+
+	if (F->argslot) {
+		jsR_keeparguments(J, n, 0);
+		JSV_SETHOLE(J->E->slots[F->argslot - 1]);
+	} else {
+		js_pop(J, n);
+	}
+}
+
+static void jsR_initvariables(js_State *J, int n, js_Function *F, js_Environment *scope)
+{
+	int i;
+
+	scope = jsR_newenvironment(J, jsV_newobject(J, JS_COBJECT, NULL), scope);
+
+	jsR_savescope(J, scope);
+
+	if (F->arguments) {
+		jsR_newarguments(J, BOT + 1, n);
 		js_initvar(J, "arguments", -1);
 		js_pop(J, 1);
 	}
@@ -1007,15 +1661,35 @@ static void jsR_callfunction(js_State *J, int n, js_Function *F, js_Environment
 		js_initvar(J, F->vartab[i], -1);
 		js_pop(J, 1);
 	}
+}
 
-	jsR_run(J, F);
-	v = *stackidx(J, -1);
+/* Set up the scope and locals of a function whose arguments are on the stack */
+static void jsR_enterfunction(js_State *J, int n, js_Function *F, js_Environment *scope)
+{
+	if (F->lightweight)
+		jsR_initlocals(J, n, F, scope);
+	else if (F->flatenv)
+		jsR_initslots(J, n, F, scope);
+	else
+		jsR_initvariables(J, n, F, scope);
+}
+
+/* Replace the frame with its return value and restore the caller's scope */
+static void jsR_leavefunction(js_State *J)
+{
+	js_Value v = *stackidx(J, -1);
 	TOP = --BOT; /* clear stack */
 	js_pushvalue(J, v);
-
 	jsR_restorescope(J);
 }
 
+static void jsR_callfunction(js_State *J, int n, js_Function *F, js_Environment *scope)
+{
+	jsR_enterfunction(J, n, F, scope);
+	jsR_run(J, F);
+	jsR_leavefunction(J);
+}
+
 static void jsR_callscript(js_State *J, int n, js_Function *F, js_Environment *scope)
 {
 	js_Value v;
@@ -1058,12 +1732,19 @@ static void jsR_callcfunction(js_State *J, int n, int min, js_CFunction F)
 
 static void jsR_pushtrace(js_State *J, const char *name, const char *file, int line)
 {
-	if (J->tracetop + 1 == JS_ENVLIMIT)
-		js_error(J, "call stack overflow");
+	if (J->tracetop + 1 == J->tracecap) {
+		int cap = J->tracecap;
+		if (cap >= J->envlimit)
+			js_error(J, "call stack overflow");
+		J->frame = jsR_growarray(J, J->frame, &cap, J->envlimit, sizeof *J->frame);
+		J->trace = jsR_growarray(J, J->trace, &J->tracecap, J->envlimit, sizeof *J->trace);
+	}
 	++J->tracetop;
 	J->trace[J->tracetop].name = name;
 	J->trace[J->tracetop].file = file;
 	J->trace[J->tracetop].line = line;
+	J->trace[J->tracetop].fun = NULL;
+	J->trace[J->tracetop].pc = NULL;
 }
 
 void js_call(js_State *J, int n)
@@ -1081,10 +1762,7 @@ void js_call(js_State *J, int n)
 
 	if (obj->type == JS_CFUNCTION) {
 		jsR_pushtrace(J, obj->u.f.function->name, obj->u.f.function->filename, obj->u.f.function->line);
-		if (obj->u.f.function->lightweight)
-			jsR_calllwfunction(J, n, obj->u.f.function, obj->u.f.scope);
-		else
-			jsR_callfunction(J, n, obj->u.f.function, obj->u.f.scope);
+		jsR_callfunction(J, n, obj->u.f.function, obj->u.f.scope);
 		--J->tracetop;
 	} else if (obj->type == JS_CSCRIPT) {
 		jsR_pushtrace(J, obj->u.f.function->name, obj->u.f.function->filename, obj->u.f.function->line);
@@ -1097,12 +1775,36 @@ void js_call(js_State *J, int n)
 	}
 
 	BOT = savebot;
+
+	if (J->tracetop == 0 && J->oldstacklen > 0)
+		jsR_freestacks(J);
+}
+
+/* Create the object for a constructor call and shift it into the 'this' slot */
+static js_Object *jsR_newthis(js_State *J, int n)
+{
+	js_Object *prototype;
+	js_Object *newobj;
+
+	/* extract the function object's prototype property */
+	js_getproperty(J, -n - 1, "prototype");
+	if (js_isobject(J, -1))
+		prototype = js_toobject(J, -1);
+	else
+		prototype = J->Object_prototype;
+	js_pop(J, 1);
+
+	/* create a new object with above prototype */
+	newobj = jsV_newobject(J, JS_COBJECT, prototype);
+	js_pushobject(J, newobj);
+	if (n > 0)
+		js_rot(J, n + 1);
+	return newobj;
 }
 
 void js_construct(js_State *J, int n)
 {
 	js_Object *obj;
-	js_Object *prototype;
 	js_Object *newobj;
 
 	if (!js_iscallable(J, -n-1))
@@ -1123,22 +1825,13 @@ void js_construct(js_State *J, int n)
 		--J->tracetop;
 
 		BOT = savebot;
+
+		if (J->tracetop == 0 && J->oldstacklen > 0)
+			jsR_freestacks(J);
 		return;
 	}
 
-	/* extract the function object's prototype property */
-	js_getproperty(J, -n - 1, "prototype");
-	if (js_isobject(J, -1))
-		prototype = js_toobject(J, -1);
-	else
-		prototype = J->Object_prototype;
-	js_pop(J, 1);
-
-	/* create a new object with above prototype, and shift it into the 'this' slot */
-	newobj = jsV_newobject(J, JS_COBJECT, prototype);
-	js_pushobject(J, newobj);
-	if (n > 0)
-		js_rot(J, n + 1);
+	newobj = jsR_newthis(J, n);
 
 	/* call the function */
 	js_call(J, n);
@@ -1190,31 +1883,20 @@ int js_pcall(js_State *J, int n)
 
 /* Exceptions */
 
-void *js_savetrypc(js_State *J, js_Instruction *pc)
-{
-	if (J->trytop == JS_TRYLIMIT)
-		js_error(J, "try: exception stack overflow");
-	J->trybuf[J->trytop].E = J->E;
-	J->trybuf[J->trytop].envtop = J->envtop;
-	J->trybuf[J->trytop].tracetop = J->tracetop;
-	J->trybuf[J->trytop].top = J->top;
-	J->trybuf[J->trytop].bot = J->bot;
-	J->trybuf[J->trytop].strict = J->strict;
-	J->trybuf[J->trytop].pc = pc;
-	return J->trybuf[J->trytop++].buf;
-}
-
 void *js_savetry(js_State *J)
 {
-	if (J->trytop == JS_TRYLIMIT)
-		js_error(J, "try: exception stack overflow");
+	if (J->trytop == J->trycap) {
+		if (J->trycap >= J->trylimit)
+			js_tryoverflow(J);
+		J->trybuf = jsR_growarray(J, J->trybuf, &J->trycap, J->trylimit, sizeof *J->trybuf);
+	}
 	J->trybuf[J->trytop].E = J->E;
 	J->trybuf[J->trytop].envtop = J->envtop;
 	J->trybuf[J->trytop].tracetop = J->tracetop;
+	J->trybuf[J->trytop].frametop = J->frametop;
 	J->trybuf[J->trytop].top = J->top;
 	J->trybuf[J->trytop].bot = J->bot;
 	J->trybuf[J->trytop].strict = J->strict;
-	J->trybuf[J->trytop].pc = NULL;
 	return J->trybuf[J->trytop++].buf;
 }
 
@@ -1225,14 +1907,72 @@ void js_endtry(js_State *J)
 	--J->trytop;
 }
 
+/*
+ * Look up the handler of the instruction that frame k is running, and if
+ * there is one, unwind the stacks to it and make the frame resume there.
+ */
+static int jsR_catch(js_State *J, int k)
+{
+	js_Frame *fr = &J->frame[k];
+	js_Function *F = fr->F;
+	js_Instruction *pc = J->trace[fr->tracetop].pc;
+	js_TryRange *r = NULL;
+	js_Environment *E, *e;
+	js_Value v;
+	int i, at, depth;
+
+	if (!pc)
+		return 0;
+	at = (int)(pc - F->code) - 1;
+	for (i = F->trylen - 1; i >= 0; --i) {
+		if (F->trytab[i].start <= at && at < F->trytab[i].end) {
+			r = &F->trytab[i];
+			break;
+		}
+	}
+	if (!r)
+		return 0;
+
+	/* the scope of the frame when it called out, if it did */
+	E = J->envtop > fr->envtop ? J->envstack[fr->envtop] : J->E;
+	for (depth = 0, e = E; e && e != fr->E; e = e->outer)
+		++depth;
+
+	while (depth-- > r->scope)
+		E = E->outer;
+
+	v = *stackidx(J, -1);
+	J->E = E;
+	J->envtop = fr->envtop;
+	jsR_releasepool(J);
+	J->tracetop = fr->tracetop;
+	J->frametop = k + 1;
+	J->top = fr->base + r->height;
+	J->bot = fr->bot;
+	J->strict = F->strict;
+	js_pushvalue(J, v);
+	fr->pc = F->code + r->handler;
+	J->trace[fr->tracetop].pc = fr->pc + 1; /* errors in the handler are not caught by it */
+	return 1;
+}
+
 void js_throw(js_State *J)
 {
+	int k, low = J->trytop > 0 ? J->trybuf[J->trytop-1].frametop : 0;
+
+	/* handlers of the interpreter frames above the innermost js_try come first */
+	for (k = J->frametop - 1; k >= low; --k)
+		if (J->frame[k].F->trylen > 0 && jsR_catch(J, k))
+			longjmp(*J->frame[k].catchbuf, 1);
+
 	if (J->trytop > 0) {
 		js_Value v = *stackidx(J, -1);
 		--J->trytop;
 		J->E = J->trybuf[J->trytop].E;
 		J->envtop = J->trybuf[J->trytop].envtop;
+		jsR_releasepool(J);
 		J->tracetop = J->trybuf[J->trytop].tracetop;
+		J->frametop = J->trybuf[J->trytop].frametop;
 		J->top = J->trybuf[J->trytop].top;
 		J->bot = J->trybuf[J->trytop].bot;
 		J->strict = J->trybuf[J->trytop].strict;
@@ -1246,6 +1986,181 @@ void js_throw(js_State *J)
 
 /* Main interpreter loop */
 
+/*
+ * Every bytecode function running in jsR_run has an activation record.
+ * Calls from bytecode to bytecode functions do not recurse into jsR_run:
+ * the callee's frame is set up and its record pushed, and the loop carries
+ * on with the callee's code. OP_RETURN pops the record and resumes the
+ * caller at its saved pc. Native functions, accessors, eval and calls from
+ * C still go through js_call and get a jsR_run of their own.
+ *
+ * The record count is bounded by the stack trace, which is checked on every
+ * call, so the record stack can not overflow.
+ *
+ * Entering a try block costs nothing: js_throw finds the handler in the
+ * function's handler table, unwinds to the frame, and jumps back into its
+ * jsR_run. Each jsR_run sets its jump buffer only once, when it first
+ * runs a function that has handlers.
+ */
+
+static void jsR_pushframe(js_State *J, js_Function *F, js_Object *newobj, int savebot, jmp_buf *catchbuf)
+{
+	js_Frame *fr = &J->frame[J->frametop++];
+	fr->F = F;
+	fr->E = J->E;
+	fr->pc = NULL;
+	fr->newobj = newobj;
+	fr->savebot = savebot;
+	fr->savestrict = J->strict;
+	fr->bot = BOT;
+	fr->base = TOP;
+	fr->tracetop = J->tracetop;
+	fr->envtop = J->envtop;
+	fr->catchbuf = catchbuf;
+	J->strict = F->strict;
+	J->trace[J->tracetop].fun = F;
+}
+
+/* Set up a call to the bytecode function obj with n arguments on the stack */
+static void jsR_entercall(js_State *J, int n, js_Object *obj, js_Object *newobj)
+{
+	js_Function *F = obj->u.f.function;
+	int savebot = BOT;
+	BOT = TOP - n - 1;
+	jsR_pushtrace(J, F->name, F->filename, F->line);
+	jsR_enterfunction(J, n, F, obj->u.f.scope);
+	jsR_pushframe(J, F, newobj, savebot, J->frame[J->frametop-1].catchbuf);
+}
+
+/* Is the value a function that can be called without leaving the interpreter? */
+#define ISBYTECODE(v) (JSV_TYPE(v) == JS_TOBJECT && JSV_OBJECT(v)->type == JS_CFUNCTION)
+
+/*
+ * Small leaf functions (see inlinable in jscompile.c) run at their call
+ * sites without an activation record, trace entry or scope. The body is
+ * evaluated on a scratch stack, and gives up before anything that could
+ * throw, allocate or call out. Nothing has happened by then, so the call
+ * is simply made the usual way.
+ */
+static int jsR_inlinecall(js_State *J, js_Function *F, int n)
+{
+	js_Value local[JS_INLINESIZE], stack[JS_INLINESIZE];
+	js_Value *callee = &STACK[TOP-n-2];
+	js_Instruction *pc = F->code;
+	js_PropCache *cache;
+	js_Property *ref;
+	js_Object *obj;
+	int i, op, top = 0;
+	double x, y;
+	int64_t v;
+
+	local[0] = callee[1];
+	for (i = 1; i <= F->varlen; ++i) {
+		if (i <= n && i <= F->numparams)
+			local[i] = callee[i+1];
+		else
+			JSV_SETUNDEFINED(local[i]);
+	}
+
+	for (;;) {
+		switch (op = jsC_genericop(*pc++)) {
+		case OP_POP: --top; break;
+		case OP_UNDEF: JSV_SETUNDEFINED(stack[top]); ++top; break;
+		case OP_NULL: JSV_SETNULL(stack[top]); ++top; break;
+		case OP_TRUE: JSV_SETBOOLEAN(stack[top], 1); ++top; break;
+		case OP_FALSE: JSV_SETBOOLEAN(stack[top], 0); ++top; break;
+		case OP_INTEGER: JSV_SETINTEGER(stack[top], *pc++ - 32768); ++top; break;
+		case OP_NUMBER: JSV_SETNUMBER(stack[top], F->numtab[*pc++]); ++top; break;
+		case OP_CURRENT: stack[top++] = callee[0]; break;
+
+		case OP_THIS:
+			if (JSV_TYPE(local[0]) != JS_TOBJECT)
+				return 0;
+			stack[top++] = local[0];
+			break;
+
+		case OP_GETLOCAL: stack[top++] = local[*pc++]; break;
+		case OP_SETLOCAL: local[*pc++] = stack[top-1]; break;
+		case OP_SETLOCAL_POP: local[*pc++] = stack[--top]; break;
+
+		case OP_GETLOCAL_GETPROP_S:
+			stack[top++] = local[*pc++];
+			/* fallthrough */
+		case OP_GETPROP_S:
+			if (JSV_TYPE(stack[top-1]) != JS_TOBJECT)
+				return 0;
+			obj = JSV_OBJECT(stack[top-1]);
+			cache = jsV_probecache(J, F->cachetab + pc[1] * JS_CACHEWAYS, obj);
+			if (!cache) {
+				if (!jsR_cacheable(J, obj, F->strtab[pc[0]]))
+					return 0;
+				cache = jsV_fillcache(J, F->cachetab + pc[1] * JS_CACHEWAYS, obj, F->strtab[pc[0]], 0);
+			}
+			ref = cache->slot >= 0 ? &obj->slots[cache->slot] : cache->ref;
+			if (!ref)
+				JSV_SETUNDEFINED(stack[top-1]);
+			else if (ref->getter)
+				return 0;
+			else
+				stack[top-1] = ref->value;
+			pc += 2;
+			break;
+
+		case OP_ADD:
+		case OP_SUB:
+		case OP_MUL:
+		case OP_DIV:
+		case OP_LT:
+		case OP_GT:
+		case OP_LE:
+		case OP_GE:
+		case OP_EQ:
+		case OP_NE:
+		case OP_STRICTEQ:
+		case OP_STRICTNE:
+			if (!JSV_ISNUMBER(stack[top-2]) || !JSV_ISNUMBER(stack[top-1]))
+				return 0;
+			--top;
+			if ((op == OP_ADD || op == OP_SUB) && JSV_TYPE(stack[top-1]) == JS_TINTEGER && JSV_TYPE(stack[top]) == JS_TINTEGER) {
+				if (op == OP_ADD)
+					v = (int64_t)JSV_INTEGER(stack[top-1]) + JSV_INTEGER(stack[top]);
+				else
+					v = (int64_t)JSV_INTEGER(stack[top-1]) - JSV_INTEGER(stack[top]);
+				if (v >= INT_MIN && v <= INT_MAX)
+					JSV_SETINTEGER(stack[top-1], (int)v);
+				else
+					JSV_SETNUMBER(stack[top-1], (double)v);
+				break;
+			}
+			x = JSV_ASNUMBER(stack[top-1]);
+			y = JSV_ASNUMBER(stack[top]);
+			switch (op) {
+			case OP_ADD: JSV_SETNUMBER(stack[top-1], x + y); break;
+			case OP_SUB: JSV_SETNUMBER(stack[top-1], x - y); break;
+			case OP_MUL: JSV_SETNUMBER(stack[top-1], x * y); break;
+			case OP_DIV: JSV_SETNUMBER(stack[top-1], x / y); break;
+			case OP_LT: JSV_SETBOOLEAN(stack[top-1], x < y); break;
+			case OP_GT: JSV_SETBOOLEAN(stack[top-1], x > y); break;
+			case OP_LE: JSV_SETBOOLEAN(stack[top-1], x <= y); break;
+			case OP_GE: JSV_SETBOOLEAN(stack[top-1], x >= y); break;
+			case OP_EQ: case OP_STRICTEQ: JSV_SETBOOLEAN(stack[top-1], x == y); break;
+			default: JSV_SETBOOLEAN(stack[top-1], x != y); break;
+			}
+			break;
+
+		case OP_RETURN:
+			TOP -= n + 1;
+			STACK[TOP-1] = stack[top-1];
+			return 1;
+
+		default:
+			return 0;
+		}
+	}
+}
+
+#define INLINABLE(v) (JSV_OBJECT(v)->u.f.function->inlinable)
+
 static void jsR_dumpstack(js_State *J)
 {
 	int i;
@@ -1262,11 +2177,30 @@ static void jsR_dumpstack(js_State *J)
 static void jsR_dumpenvironment(js_State *J, js_Environment *E, int d)
 {
 	printf("scope %d ", d);
-	js_dumpobject(J, E->variables);
+	if (E->variables) {
+		js_dumpobject(J, E->variables);
+	} else {
+		int i;
+		printf("{\n");
+		for (i = 0; i < E->function->varlen; ++i) {
+			printf("\t%s: ", E->function->vartab[i]);
+			js_dumpvalue(J, E->slots[i]);
+			printf(",\n");
+		}
+		printf("}\n");
+	}
 	if (E->outer)
 		jsR_dumpenvironment(J, E->outer, d+1);
 }
 
+int js_traceline(js_State *J, int n)
+{
+	js_StackTrace *T = &J->trace[n];
+	if (T->fun && T->pc)
+		return jsC_lineat(T->fun, (int)(T->pc - T->fun->code) - 1);
+	return T->line;
+}
+
 void js_stacktrace(js_State *J)
 {
 	int n;
@@ -1274,7 +2208,7 @@ void js_stacktrace(js_State *J)
 	for (n = J->tracetop; n >= 0; --n) {
 		const char *name = J->trace[n].name;
 		const char *file = J->trace[n].file;
-		int line = J->trace[n].line;
+		int line = js_traceline(J, n);
 		if (line > 0) {
 			if (name[0])
 				printf("\tat %s (%s:%d)\n", name, file, line);
@@ -1288,7 +2222,7 @@ void js_stacktrace(js_State *J)
 void js_trap(js_State *J, int pc)
 {
 	if (pc > 0) {
-		js_Function *F = STACK[BOT-1].u.object->u.f.function;
+		js_Function *F = JSV_OBJECT(STACK[BOT-1])->u.f.function;
 		printf("trap at %d in function ", pc);
 		jsC_dumpfunction(J, F);
 	}
@@ -1297,60 +2231,174 @@ void js_trap(js_State *J, int pc)
 	js_stacktrace(J);
 }
 
-static void jsR_run(js_State *J, js_Function *F)
-{
-	js_Function **FT = F->funtab;
-	double *NT = F->numtab;
-	const char **ST = F->strtab;
-	const char **VT = F->vartab-1;
-	int lightweight = F->lightweight;
-	js_Instruction *pcstart = F->code;
-	js_Instruction *pc = F->code;
+/*
+ * With GCC and Clang we dispatch through a table of label addresses
+ * (direct threading) so that every opcode ends in its own indirect jump.
+ * Other compilers, or builds with JS_NOTHREADED defined, use a switch.
+ */
+
+#if defined(__GNUC__) && !defined(JS_NOTHREADED)
+#define JS_THREADED
+#endif
+
+#define vmfetch() (opcode = *pc++)
+
+#ifdef JS_THREADED
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+#define vmdispatch(o) goto *optab[o];
+#define vmcase(l) L_##l:
+#define vmbreak vmfetch(); goto *optab[opcode]
+#else
+#define vmdispatch(o) switch (o)
+#define vmcase(l) case l:
+#define vmbreak break
+#endif
+
+/*
+ * The collector only runs at safepoints: before allocating opcodes, calls,
+ * and backward jumps. Straight-line code between them is bounded by the
+ * size of the function, so garbage can never pile up unchecked.
+ */
+
+/*
+ * Opcodes that may throw or call out to other code save the program counter
+ * in the stack trace, so that the line number can be found when needed.
+ */
+
+#define SAVEPC() (J->trace[J->tracetop].pc = pc)
+
+/*
+ * The saved pc also selects the exception handler, so every path that can
+ * throw must save it first; that includes running out of stack in CHECKPUSH
+ * and running the collector in GCSAFEPOINT. Opcodes that can not throw do
+ * not bother.
+ */
+
+#define CHECKPUSH(n) if (TOP + n >= J->stacksize) { SAVEPC(); jsR_growstack(J, n); }
+
+/* Rewrite the current opcode in place, and dispatch it again */
+#define REWRITE(op) { *--pc = (op); vmbreak; }
+#define QUICKENING() (F->deopts < JS_DEOPTLIMIT)
+#define DEOPTIMIZE(op) { ++F->deopts; REWRITE(op); }
+
+#define GCSAFEPOINT() if (J->gccounter > JS_GCLIMIT) { SAVEPC(); jsG_gc(J, 1); }
+#define BACKEDGE(offset) if (pcstart + (offset) < pc) { SAVEPC(); GCSAFEPOINT(); NATIVELOOP(offset); }
+
+/*
+ * Functions can have native code, made ahead of time by mujs-aot, or by
+ * the JIT once they get hot. We enter it at the start of the function or
+ * at the target of a backward jump. It runs until the function returns,
+ * and we finish the return here.
+ */
+
+static js_Instruction nativereturn[] = { OP_RETURN };
+
+#ifdef JS_JIT
+#define HOT() (++F->hotness > JS_JITHOT && jsJ_compile(J, F))
+#else
+#define HOT() 0
+#endif
+
+#define NATIVEENTER() if (F->native || HOT()) { F->native(J, 0); pc = nativereturn; }
+#define NATIVELOOP(offset) if (F->native || HOT()) { F->native(J, offset); pc = nativereturn; vmbreak; }
+
+/* Load the interpreter state of the function in the topmost activation record */
+#define LOADFRAME() { \
+		F = J->frame[J->frametop-1].F; \
+		FE = J->frame[J->frametop-1].E; \
+		FT = F->funtab; \
+		NT = F->numtab; \
+		ST = F->strtab; \
+		VT = F->vartab-1; \
+		CT = F->cachetab; \
+		lightweight = F->lightweight; \
+		LT = F->flatenv ? FE->slots - 1 : NULL; \
+		argbase = BOT + (lightweight ? F->varlen : 0) + 1; \
+		pcstart = F->code; \
+	}
+
+/* Set the jump buffer for handlers in this jsR_run, and resume at one when we come back */
+#define ARMCATCH() \
+	if (F->trylen > 0 && !armed) { \
+		armed = 1; \
+		if (setjmp(catchbuf)) { \
+			LOADFRAME(); \
+			pc = J->frame[J->frametop-1].pc; \
+		} \
+	}
+
+static void jsR_run(js_State *J, js_Function *fun)
+{
+	/* volatile, since exceptions longjmp back into this frame to be caught */
+	js_Function * volatile F = fun;
+	js_Function ** volatile FT;
+	double * volatile NT;
+	const char ** volatile ST;
+	const char ** volatile VT;
+	js_PropCache * volatile CT;
+	volatile int lightweight;
+	js_Environment * volatile FE; /* own environment, or the closure scope if lightweight */
+	js_Value * volatile LT;
+	volatile int argbase;
+	js_Instruction * volatile pcstart;
+	js_Instruction *pc;
 	enum js_OpCode opcode;
 	int offset;
-	int savestrict;
+	int base = J->frametop;
+	js_Frame *fr;
+	jmp_buf catchbuf;
+	volatile int armed = 0;
 
 	const char *str;
 	js_Object *obj;
+	js_Value *val;
 	double x, y;
 	unsigned int ux, uy;
 	int ix, iy, okay;
 	int b;
 
-	savestrict = J->strict;
-	J->strict = F->strict;
-
-	while (1) {
-		if (J->gccounter > JS_GCLIMIT)
-			js_gc(J, 1);
-
-		J->trace[J->tracetop].line = *pc++;
-
-		opcode = *pc++;
-
-		switch (opcode) {
-		case OP_POP: js_pop(J, 1); break;
-		case OP_DUP: js_dup(J); break;
-		case OP_DUP2: js_dup2(J); break;
-		case OP_ROT2: js_rot2(J); break;
-		case OP_ROT3: js_rot3(J); break;
-		case OP_ROT4: js_rot4(J); break;
-
-		case OP_INTEGER: js_pushnumber(J, *pc++ - 32768); break;
-		case OP_NUMBER: js_pushnumber(J, NT[*pc++]); break;
-		case OP_STRING: js_pushliteral(J, ST[*pc++]); break;
-
-		case OP_CLOSURE: js_newfunction(J, FT[*pc++], J->E); break;
-		case OP_NEWOBJECT: js_newobject(J); break;
-		case OP_NEWARRAY: js_newarray(J); break;
-		case OP_NEWREGEXP: js_newregexp(J, ST[pc[0]], pc[1]); pc += 2; break;
-
-		case OP_UNDEF: js_pushundefined(J); break;
-		case OP_NULL: js_pushnull(J); break;
-		case OP_TRUE: js_pushboolean(J, 1); break;
-		case OP_FALSE: js_pushboolean(J, 0); break;
-
-		case OP_THIS:
+#ifdef JS_THREADED
+	static const void *const optab[] = {
+#include "oplabels.h"
+	};
+#endif
+
+	jsR_pushframe(J, F, NULL, BOT, &catchbuf);
+	LOADFRAME();
+	pc = pcstart;
+	ARMCATCH();
+
+	GCSAFEPOINT();
+	NATIVEENTER();
+
+	for (;;) {
+		vmfetch();
+
+		vmdispatch(opcode) {
+		vmcase(OP_POP) js_pop(J, 1); vmbreak;
+		vmcase(OP_DUP) CHECKPUSH(1); js_dup(J); vmbreak;
+		vmcase(OP_DUP2) CHECKPUSH(2); js_dup2(J); vmbreak;
+		vmcase(OP_ROT2) js_rot2(J); vmbreak;
+		vmcase(OP_ROT3) js_rot3(J); vmbreak;
+		vmcase(OP_ROT4) js_rot4(J); vmbreak;
+
+		vmcase(OP_INTEGER) CHECKPUSH(1); jsR_pushinteger(J, *pc++ - 32768); vmbreak;
+		vmcase(OP_NUMBER) CHECKPUSH(1); js_pushnumber(J, NT[*pc++]); vmbreak;
+		vmcase(OP_STRING) CHECKPUSH(1); js_pushliteral(J, ST[*pc++]); vmbreak;
+
+		vmcase(OP_CLOSURE) SAVEPC(); GCSAFEPOINT(); js_newfunction(J, FT[*pc++], J->E); vmbreak;
+		vmcase(OP_NEWOBJECT) SAVEPC(); GCSAFEPOINT(); js_newobject(J); vmbreak;
+		vmcase(OP_NEWARRAY) SAVEPC(); GCSAFEPOINT(); js_newarray(J); vmbreak;
+		vmcase(OP_NEWREGEXP) SAVEPC(); GCSAFEPOINT(); js_newregexp(J, ST[pc[0]], pc[1]); pc += 2; vmbreak;
+
+		vmcase(OP_UNDEF) CHECKPUSH(1); js_pushundefined(J); vmbreak;
+		vmcase(OP_NULL) CHECKPUSH(1); js_pushnull(J); vmbreak;
+		vmcase(OP_TRUE) CHECKPUSH(1); js_pushboolean(J, 1); vmbreak;
+		vmcase(OP_FALSE) CHECKPUSH(1); js_pushboolean(J, 0); vmbreak;
+
+		vmcase(OP_THIS)
+			CHECKPUSH(1);
 			if (J->strict) {
 				js_copy(J, 0);
 			} else {
@@ -1359,144 +2407,243 @@ static void jsR_run(js_State *J, js_Function *F)
 				else
 					js_pushglobal(J);
 			}
-			break;
+			vmbreak;
 
-		case OP_CURRENT:
+		vmcase(OP_CURRENT)
+			CHECKPUSH(1);
 			js_currentfunction(J);
-			break;
+			vmbreak;
 
-		case OP_GETLOCAL:
+		vmcase(OP_GETLOCAL)
 			if (lightweight) {
-				CHECKSTACK(1);
+				CHECKPUSH(1);
 				STACK[TOP++] = STACK[BOT + *pc++];
+			} else if (LT) {
+				CHECKPUSH(1);
+				STACK[TOP++] = LT[*pc++];
 			} else {
+				SAVEPC();
 				str = VT[*pc++];
 				if (!js_hasvar(J, str))
 					js_referenceerror(J, "'%s' is not defined", str);
 			}
-			break;
+			vmbreak;
 
-		case OP_SETLOCAL:
+		vmcase(OP_SETLOCAL)
 			if (lightweight) {
 				STACK[BOT + *pc++] = STACK[TOP-1];
+			} else if (LT) {
+				LT[*pc++] = STACK[TOP-1];
 			} else {
+				SAVEPC();
 				js_setvar(J, VT[*pc++]);
 			}
-			break;
+			vmbreak;
 
-		case OP_DELLOCAL:
-			if (lightweight) {
+		vmcase(OP_DELLOCAL)
+			if (lightweight || LT) {
 				++pc;
 				js_pushboolean(J, 0);
 			} else {
+				SAVEPC();
 				b = js_delvar(J, VT[*pc++]);
 				js_pushboolean(J, b);
 			}
-			break;
+			vmbreak;
 
-		case OP_GETVAR:
-			str = ST[*pc++];
-			if (!js_hasvar(J, str))
-				js_referenceerror(J, "'%s' is not defined", str);
-			break;
+		vmcase(OP_ARGUMENTS)
+			SAVEPC();
+			jsR_pusharguments(J, LT, *pc++, argbase);
+			vmbreak;
+
+		vmcase(OP_GETARG)
+			ix = jsR_argindex(&STACK[TOP-1]);
+			if (JSV_TYPE(*ARGSLOT(*pc)) == JS_THOLE && ix >= 0 && ix < JSV_INTEGER(STACK[argbase])) {
+				STACK[TOP-1] = STACK[argbase + 1 + ix];
+				++pc;
+			} else {
+				SAVEPC();
+				jsR_pusharguments(J, LT, *pc++, argbase);
+				js_rot2(J);
+				str = js_tostring(J, -1);
+				obj = js_toobject(J, -2);
+				jsR_getproperty(J, obj, str);
+				js_rot3pop2(J);
+			}
+			vmbreak;
 
-		case OP_HASVAR:
+		vmcase(OP_ARGLEN)
+			if (JSV_TYPE(*ARGSLOT(*pc)) == JS_THOLE) {
+				CHECKPUSH(1);
+				STACK[TOP++] = STACK[argbase];
+				++pc;
+			} else {
+				SAVEPC();
+				js_pushvalue(J, *ARGSLOT(*pc));
+				++pc;
+				obj = js_toobject(J, -1);
+				jsR_getproperty(J, obj, "length");
+				js_rot2pop1(J);
+			}
+			vmbreak;
+
+		vmcase(OP_GETUPVAL)
+			CHECKPUSH(1);
+			STACK[TOP++] = *jsR_upvalue(lightweight ? FE : FE->outer, pc[0], pc[1]);
+			pc += 2;
+			vmbreak;
+
+		vmcase(OP_SETUPVAL)
+			*jsR_upvalue(lightweight ? FE : FE->outer, pc[0], pc[1]) = STACK[TOP-1];
+			pc += 2;
+			vmbreak;
+
+		vmcase(OP_GETVAR)
+			SAVEPC();
+			jsR_getvarcache(J, ST[pc[0]], CT + pc[1] * JS_CACHEWAYS);
+			pc += 2;
+			vmbreak;
+
+		vmcase(OP_GETGLOBAL)
+			SAVEPC();
+			jsR_getglobal(J, ST[pc[0]], CT + pc[1] * JS_CACHEWAYS);
+			pc += 2;
+			vmbreak;
+
+		vmcase(OP_SETGLOBAL)
+			SAVEPC();
+			jsR_setglobal(J, ST[pc[0]], CT + pc[1] * JS_CACHEWAYS);
+			pc += 2;
+			vmbreak;
+
+		vmcase(OP_HASVAR)
+			SAVEPC();
 			if (!js_hasvar(J, ST[*pc++]))
 				js_pushundefined(J);
-			break;
+			vmbreak;
 
-		case OP_SETVAR:
+		vmcase(OP_SETVAR)
+			SAVEPC();
 			js_setvar(J, ST[*pc++]);
-			break;
+			vmbreak;
 
-		case OP_DELVAR:
+		vmcase(OP_DELVAR)
+			SAVEPC();
 			b = js_delvar(J, ST[*pc++]);
 			js_pushboolean(J, b);
-			break;
+			vmbreak;
 
-		case OP_IN:
+		vmcase(OP_IN)
+			SAVEPC();
 			str = js_tostring(J, -2);
 			if (!js_isobject(J, -1))
 				js_typeerror(J, "operand to 'in' is not an object");
 			b = js_hasproperty(J, -1, str);
 			js_pop(J, 2 + b);
 			js_pushboolean(J, b);
-			break;
+			vmbreak;
 
-		case OP_INITPROP:
+		vmcase(OP_INITPROP)
+			SAVEPC();
 			obj = js_toobject(J, -3);
 			str = js_tostring(J, -2);
 			jsR_setproperty(J, obj, str);
 			js_pop(J, 2);
-			break;
+			vmbreak;
 
-		case OP_INITGETTER:
+		vmcase(OP_INITGETTER)
+			SAVEPC();
 			obj = js_toobject(J, -3);
 			str = js_tostring(J, -2);
 			jsR_defproperty(J, obj, str, 0, NULL, jsR_tofunction(J, -1), NULL);
 			js_pop(J, 2);
-			break;
+			vmbreak;
 
-		case OP_INITSETTER:
+		vmcase(OP_INITSETTER)
+			SAVEPC();
 			obj = js_toobject(J, -3);
 			str = js_tostring(J, -2);
 			jsR_defproperty(J, obj, str, 0, NULL, NULL, jsR_tofunction(J, -1));
 			js_pop(J, 2);
-			break;
-
-		case OP_GETPROP:
-			str = js_tostring(J, -1);
-			obj = js_toobject(J, -2);
-			jsR_getproperty(J, obj, str);
-			js_rot3pop2(J);
-			break;
+			vmbreak;
+
+		vmcase(OP_GETPROP)
+			SAVEPC();
+			val = jsR_numberelement(&STACK[TOP-2], &STACK[TOP-1]);
+			if (val) {
+				STACK[TOP-2] = *val;
+				--TOP;
+			} else {
+				str = js_tostring(J, -1);
+				obj = js_toobject(J, -2);
+				jsR_getproperty(J, obj, str);
+				js_rot3pop2(J);
+			}
+			vmbreak;
 
-		case OP_GETPROP_S:
-			str = ST[*pc++];
+		vmcase(OP_GETPROP_S)
+			SAVEPC();
 			obj = js_toobject(J, -1);
-			jsR_getproperty(J, obj, str);
+			jsR_getpropertycache(J, obj, ST[pc[0]], CT + pc[1] * JS_CACHEWAYS);
+			pc += 2;
 			js_rot2pop1(J);
-			break;
-
-		case OP_SETPROP:
-			str = js_tostring(J, -2);
-			obj = js_toobject(J, -3);
-			jsR_setproperty(J, obj, str);
+			vmbreak;
+
+		vmcase(OP_SETPROP)
+			SAVEPC();
+			val = jsR_numberelement(&STACK[TOP-3], &STACK[TOP-2]);
+			if (val) {
+				obj = JSV_OBJECT(STACK[TOP-3]);
+				ix = val - obj->elements;
+				if (obj->type == JS_CARRAY && ix >= obj->u.a.length)
+					obj->u.a.length = ix + 1;
+				JSG_BARRIER(J, obj, STACK[TOP-1]);
+				*val = STACK[TOP-1];
+			} else {
+				str = js_tostring(J, -2);
+				obj = js_toobject(J, -3);
+				jsR_setproperty(J, obj, str);
+			}
 			js_rot3pop2(J);
-			break;
+			vmbreak;
 
-		case OP_SETPROP_S:
-			str = ST[*pc++];
+		vmcase(OP_SETPROP_S)
+			SAVEPC();
 			obj = js_toobject(J, -2);
-			jsR_setproperty(J, obj, str);
+			jsR_setpropertycache(J, obj, ST[pc[0]], CT + pc[1] * JS_CACHEWAYS);
+			pc += 2;
 			js_rot2pop1(J);
-			break;
+			vmbreak;
 
-		case OP_DELPROP:
+		vmcase(OP_DELPROP)
+			SAVEPC();
 			str = js_tostring(J, -1);
 			obj = js_toobject(J, -2);
 			b = jsR_delproperty(J, obj, str);
 			js_pop(J, 2);
 			js_pushboolean(J, b);
-			break;
+			vmbreak;
 
-		case OP_DELPROP_S:
+		vmcase(OP_DELPROP_S)
+			SAVEPC();
 			str = ST[*pc++];
 			obj = js_toobject(J, -1);
 			b = jsR_delproperty(J, obj, str);
 			js_pop(J, 1);
 			js_pushboolean(J, b);
-			break;
+			vmbreak;
 
-		case OP_ITERATOR:
+		vmcase(OP_ITERATOR)
+			SAVEPC();
 			if (js_iscoercible(J, -1)) {
 				obj = jsV_newiterator(J, js_toobject(J, -1), 0);
 				js_pop(J, 1);
 				js_pushobject(J, obj);
 			}
-			break;
+			vmbreak;
 
-		case OP_NEXTITER:
+		vmcase(OP_NEXTITER)
+			SAVEPC();
 			if (js_isobject(J, -1)) {
 				obj = js_toobject(J, -1);
 				str = jsV_nextiterator(J, obj);
@@ -1511,160 +2658,316 @@ static void jsR_run(js_State *J, js_Function *F)
 				js_pop(J, 1);
 				js_pushboolean(J, 0);
 			}
-			break;
+			vmbreak;
 
 		/* Function calls */
 
-		case OP_EVAL:
+		vmcase(OP_EVAL)
+			SAVEPC();
+			GCSAFEPOINT();
 			js_eval(J);
-			break;
-
-		case OP_CALL:
-			js_call(J, *pc++);
-			break;
-
-		case OP_NEW:
-			js_construct(J, *pc++);
-			break;
+			vmbreak;
+
+		vmcase(OP_CALL)
+			SAVEPC();
+			GCSAFEPOINT();
+			ix = *pc++;
+			if (ISBYTECODE(STACK[TOP-ix-2])) {
+				if (INLINABLE(STACK[TOP-ix-2]) && jsR_inlinecall(J, JSV_OBJECT(STACK[TOP-ix-2])->u.f.function, ix)) {
+					vmbreak;
+				}
+				J->frame[J->frametop-1].pc = pc;
+				jsR_entercall(J, ix, JSV_OBJECT(STACK[TOP-ix-2]), NULL);
+				LOADFRAME();
+				pc = pcstart;
+				ARMCATCH();
+				GCSAFEPOINT();
+				NATIVEENTER();
+			} else {
+				js_call(J, ix);
+			}
+			vmbreak;
+
+		vmcase(OP_NEW)
+			SAVEPC();
+			GCSAFEPOINT();
+			ix = *pc++;
+			if (ISBYTECODE(STACK[TOP-ix-1])) {
+				obj = jsR_newthis(J, ix);
+				J->frame[J->frametop-1].pc = pc;
+				jsR_entercall(J, ix, JSV_OBJECT(STACK[TOP-ix-2]), obj);
+				LOADFRAME();
+				pc = pcstart;
+				ARMCATCH();
+				GCSAFEPOINT();
+				NATIVEENTER();
+			} else {
+				js_construct(J, ix);
+			}
+			vmbreak;
 
 		/* Unary operators */
 
-		case OP_TYPEOF:
+		vmcase(OP_TYPEOF)
 			str = js_typeof(J, -1);
 			js_pop(J, 1);
 			js_pushliteral(J, str);
-			break;
+			vmbreak;
 
-		case OP_POS:
+		vmcase(OP_POS)
+			SAVEPC();
 			x = js_tonumber(J, -1);
 			js_pop(J, 1);
 			js_pushnumber(J, x);
-			break;
+			vmbreak;
 
-		case OP_NEG:
+		vmcase(OP_NEG)
+			SAVEPC();
 			x = js_tonumber(J, -1);
 			js_pop(J, 1);
 			js_pushnumber(J, -x);
-			break;
+			vmbreak;
 
-		case OP_BITNOT:
+		vmcase(OP_BITNOT)
+			SAVEPC();
 			ix = js_toint32(J, -1);
 			js_pop(J, 1);
-			js_pushnumber(J, ~ix);
-			break;
+			jsR_pushinteger(J, ~ix);
+			vmbreak;
 
-		case OP_LOGNOT:
+		vmcase(OP_LOGNOT)
 			b = js_toboolean(J, -1);
 			js_pop(J, 1);
 			js_pushboolean(J, !b);
-			break;
+			vmbreak;
 
-		case OP_INC:
+		vmcase(OP_INC)
+			SAVEPC();
+			if (JSV_TYPE(STACK[TOP-1]) == JS_TINTEGER) {
+				ix = JSV_INTEGER(STACK[TOP-1]);
+				js_pop(J, 1);
+				jsR_pushint64(J, (int64_t)ix + 1);
+				vmbreak;
+			}
 			x = js_tonumber(J, -1);
 			js_pop(J, 1);
 			js_pushnumber(J, x + 1);
-			break;
+			vmbreak;
 
-		case OP_DEC:
+		vmcase(OP_DEC)
+			SAVEPC();
+			if (JSV_TYPE(STACK[TOP-1]) == JS_TINTEGER) {
+				ix = JSV_INTEGER(STACK[TOP-1]);
+				js_pop(J, 1);
+				jsR_pushint64(J, (int64_t)ix - 1);
+				vmbreak;
+			}
 			x = js_tonumber(J, -1);
 			js_pop(J, 1);
 			js_pushnumber(J, x - 1);
-			break;
+			vmbreak;
 
-		case OP_POSTINC:
+		vmcase(OP_POSTINC)
+			SAVEPC();
+			if (JSV_TYPE(STACK[TOP-1]) == JS_TINTEGER) {
+				ix = JSV_INTEGER(STACK[TOP-1]);
+				js_pop(J, 1);
+				jsR_pushint64(J, (int64_t)ix + 1);
+				jsR_pushinteger(J, ix);
+				vmbreak;
+			}
 			x = js_tonumber(J, -1);
 			js_pop(J, 1);
 			js_pushnumber(J, x + 1);
 			js_pushnumber(J, x);
-			break;
+			vmbreak;
 
-		case OP_POSTDEC:
+		vmcase(OP_POSTDEC)
+			SAVEPC();
+			if (JSV_TYPE(STACK[TOP-1]) == JS_TINTEGER) {
+				ix = JSV_INTEGER(STACK[TOP-1]);
+				js_pop(J, 1);
+				jsR_pushint64(J, (int64_t)ix - 1);
+				jsR_pushinteger(J, ix);
+				vmbreak;
+			}
 			x = js_tonumber(J, -1);
 			js_pop(J, 1);
 			js_pushnumber(J, x - 1);
 			js_pushnumber(J, x);
-			break;
+			vmbreak;
 
 		/* Multiplicative operators */
 
-		case OP_MUL:
+		vmcase(OP_MUL)
+			SAVEPC();
 			x = js_tonumber(J, -2);
 			y = js_tonumber(J, -1);
 			js_pop(J, 2);
 			js_pushnumber(J, x * y);
-			break;
+			vmbreak;
 
-		case OP_DIV:
+		vmcase(OP_DIV)
+			SAVEPC();
 			x = js_tonumber(J, -2);
 			y = js_tonumber(J, -1);
 			js_pop(J, 2);
 			js_pushnumber(J, x / y);
-			break;
+			vmbreak;
 
-		case OP_MOD:
+		vmcase(OP_MOD)
+			SAVEPC();
 			x = js_tonumber(J, -2);
 			y = js_tonumber(J, -1);
 			js_pop(J, 2);
 			js_pushnumber(J, fmod(x, y));
-			break;
+			vmbreak;
 
 		/* Additive operators */
 
-		case OP_ADD:
+		vmcase(OP_ADD)
+			if (QUICKENING()) {
+				if (NUMOPERANDS()) REWRITE(OP_ADD_NUM);
+				if (STROPERANDS()) REWRITE(OP_ADD_STR);
+			}
+			SAVEPC();
+			if (INTOPERANDS()) {
+				ix = JSV_INTEGER(STACK[TOP-2]);
+				iy = JSV_INTEGER(STACK[TOP-1]);
+				js_pop(J, 2);
+				jsR_pushint64(J, (int64_t)ix + iy);
+				vmbreak;
+			}
 			js_concat(J);
-			break;
+			vmbreak;
 
-		case OP_SUB:
+		vmcase(OP_SUB)
+			SAVEPC();
+			if (INTOPERANDS()) {
+				ix = JSV_INTEGER(STACK[TOP-2]);
+				iy = JSV_INTEGER(STACK[TOP-1]);
+				js_pop(J, 2);
+				jsR_pushint64(J, (int64_t)ix - iy);
+				vmbreak;
+			}
 			x = js_tonumber(J, -2);
 			y = js_tonumber(J, -1);
 			js_pop(J, 2);
 			js_pushnumber(J, x - y);
-			break;
+			vmbreak;
 
 		/* Shift operators */
 
-		case OP_SHL:
+		vmcase(OP_SHL)
+			SAVEPC();
 			ix = js_toint32(J, -2);
 			uy = js_touint32(J, -1);
 			js_pop(J, 2);
-			js_pushnumber(J, ix << (uy & 0x1F));
-			break;
+			jsR_pushinteger(J, (int)((unsigned int)ix << (uy & 0x1F)));
+			vmbreak;
 
-		case OP_SHR:
+		vmcase(OP_SHR)
+			SAVEPC();
 			ix = js_toint32(J, -2);
 			uy = js_touint32(J, -1);
 			js_pop(J, 2);
-			js_pushnumber(J, ix >> (uy & 0x1F));
-			break;
+			jsR_pushinteger(J, ix >> (uy & 0x1F));
+			vmbreak;
 
-		case OP_USHR:
+		vmcase(OP_USHR)
+			SAVEPC();
 			ux = js_touint32(J, -2);
 			uy = js_touint32(J, -1);
 			js_pop(J, 2);
-			js_pushnumber(J, ux >> (uy & 0x1F));
-			break;
+			jsR_pushint64(J, ux >> (uy & 0x1F));
+			vmbreak;
 
 		/* Relational operators */
 
-		case OP_LT: b = js_compare(J, &okay); js_pop(J, 2); js_pushboolean(J, okay && b < 0); break;
-		case OP_GT: b = js_compare(J, &okay); js_pop(J, 2); js_pushboolean(J, okay && b > 0); break;
-		case OP_LE: b = js_compare(J, &okay); js_pop(J, 2); js_pushboolean(J, okay && b <= 0); break;
-		case OP_GE: b = js_compare(J, &okay); js_pop(J, 2); js_pushboolean(J, okay && b >= 0); break;
+		vmcase(OP_LT)
+			if (QUICKENING() && NUMOPERANDS()) REWRITE(OP_LT_NUM);
+			SAVEPC();
+			b = jsR_compare(J, &okay);
+			js_pop(J, 2);
+			js_pushboolean(J, okay && b < 0);
+			vmbreak;
+
+		vmcase(OP_GT)
+			if (QUICKENING() && NUMOPERANDS()) REWRITE(OP_GT_NUM);
+			SAVEPC();
+			b = jsR_compare(J, &okay);
+			js_pop(J, 2);
+			js_pushboolean(J, okay && b > 0);
+			vmbreak;
+
+		vmcase(OP_LE)
+			if (QUICKENING() && NUMOPERANDS()) REWRITE(OP_LE_NUM);
+			SAVEPC();
+			b = jsR_compare(J, &okay);
+			js_pop(J, 2);
+			js_pushboolean(J, okay && b <= 0);
+			vmbreak;
+
+		vmcase(OP_GE)
+			if (QUICKENING() && NUMOPERANDS()) REWRITE(OP_GE_NUM);
+			SAVEPC();
+			b = jsR_compare(J, &okay);
+			js_pop(J, 2);
+			js_pushboolean(J, okay && b >= 0);
+			vmbreak;
 
-		case OP_INSTANCEOF:
+		vmcase(OP_INSTANCEOF)
+			SAVEPC();
 			b = js_instanceof(J);
 			js_pop(J, 2);
 			js_pushboolean(J, b);
-			break;
+			vmbreak;
 
 		/* Equality */
 
-		case OP_EQ: b = js_equal(J); js_pop(J, 2); js_pushboolean(J, b); break;
-		case OP_NE: b = js_equal(J); js_pop(J, 2); js_pushboolean(J, !b); break;
-		case OP_STRICTEQ: b = js_strictequal(J); js_pop(J, 2); js_pushboolean(J, b); break;
-		case OP_STRICTNE: b = js_strictequal(J); js_pop(J, 2); js_pushboolean(J, !b); break;
+		vmcase(OP_EQ)
+			if (QUICKENING()) {
+				if (NUMOPERANDS()) REWRITE(OP_EQ_NUM);
+				if (STROPERANDS()) REWRITE(OP_EQ_STR);
+			}
+			SAVEPC();
+			b = js_equal(J);
+			js_pop(J, 2);
+			js_pushboolean(J, b);
+			vmbreak;
+
+		vmcase(OP_NE)
+			if (QUICKENING()) {
+				if (NUMOPERANDS()) REWRITE(OP_NE_NUM);
+				if (STROPERANDS()) REWRITE(OP_NE_STR);
+			}
+			SAVEPC();
+			b = js_equal(J);
+			js_pop(J, 2);
+			js_pushboolean(J, !b);
+			vmbreak;
+
+		vmcase(OP_STRICTEQ)
+			if (QUICKENING()) {
+				if (NUMOPERANDS()) REWRITE(OP_STRICTEQ_NUM);
+				if (STROPERANDS()) REWRITE(OP_STRICTEQ_STR);
+			}
+			b = js_strictequal(J);
+			js_pop(J, 2);
+			js_pushboolean(J, b);
+			vmbreak;
+
+		vmcase(OP_STRICTNE)
+			if (QUICKENING()) {
+				if (NUMOPERANDS()) REWRITE(OP_STRICTNE_NUM);
+				if (STROPERANDS()) REWRITE(OP_STRICTNE_STR);
+			}
+			b = js_strictequal(J);
+			js_pop(J, 2);
+			js_pushboolean(J, !b);
+			vmbreak;
 
-		case OP_JCASE:
+		vmcase(OP_JCASE)
 			offset = *pc++;
 			b = js_strictequal(J);
 			if (b) {
@@ -1673,50 +2976,54 @@ static void jsR_run(js_State *J, js_Function *F)
 			} else {
 				js_pop(J, 1);
 			}
-			break;
+			vmbreak;
+
+		vmcase(OP_SWITCH)
+			offset = jsR_switch(J, F, &F->switchtab[*pc++]);
+			if (offset >= 0)
+				pc = pcstart + offset;
+			vmbreak;
 
 		/* Binary bitwise operators */
 
-		case OP_BITAND:
+		vmcase(OP_BITAND)
+			SAVEPC();
 			ix = js_toint32(J, -2);
 			iy = js_toint32(J, -1);
 			js_pop(J, 2);
-			js_pushnumber(J, ix & iy);
-			break;
+			jsR_pushinteger(J, ix & iy);
+			vmbreak;
 
-		case OP_BITXOR:
+		vmcase(OP_BITXOR)
+			SAVEPC();
 			ix = js_toint32(J, -2);
 			iy = js_toint32(J, -1);
 			js_pop(J, 2);
-			js_pushnumber(J, ix ^ iy);
-			break;
+			jsR_pushinteger(J, ix ^ iy);
+			vmbreak;
 
-		case OP_BITOR:
+		vmcase(OP_BITOR)
+			SAVEPC();
 			ix = js_toint32(J, -2);
 			iy = js_toint32(J, -1);
 			js_pop(J, 2);
-			js_pushnumber(J, ix | iy);
-			break;
+			jsR_pushinteger(J, ix | iy);
+			vmbreak;
 
 		/* Try and Catch */
 
-		case OP_THROW:
+		vmcase(OP_THROW)
+			SAVEPC();
 			js_throw(J);
 
-		case OP_TRY:
-			offset = *pc++;
-			if (js_trypc(J, pc)) {
-				pc = J->trybuf[J->trytop].pc;
-			} else {
-				pc = pcstart + offset;
-			}
-			break;
-
-		case OP_ENDTRY:
-			js_endtry(J);
-			break;
+		vmcase(OP_TRY)
+		vmcase(OP_ENDTRY)
+			SAVEPC();
+			js_error(J, "retired opcode: %s", jsC_opcodestring(opcode));
 
-		case OP_CATCH:
+		vmcase(OP_CATCH)
+			SAVEPC();
+			GCSAFEPOINT();
 			str = ST[*pc++];
 			obj = jsV_newobject(J, JS_COBJECT, NULL);
 			js_pushobject(J, obj);
@@ -1724,53 +3031,845 @@ static void jsR_run(js_State *J, js_Function *F)
 			js_setproperty(J, -2, str);
 			J->E = jsR_newenvironment(J, obj, J->E);
 			js_pop(J, 1);
-			break;
+			vmbreak;
 
-		case OP_ENDCATCH:
+		vmcase(OP_ENDCATCH)
 			J->E = J->E->outer;
-			break;
+			vmbreak;
 
 		/* With */
 
-		case OP_WITH:
+		vmcase(OP_WITH)
+			SAVEPC();
+			GCSAFEPOINT();
 			obj = js_toobject(J, -1);
 			J->E = jsR_newenvironment(J, obj, J->E);
 			js_pop(J, 1);
-			break;
+			vmbreak;
 
-		case OP_ENDWITH:
+		vmcase(OP_ENDWITH)
 			J->E = J->E->outer;
-			break;
+			vmbreak;
 
 		/* Branching */
 
-		case OP_DEBUGGER:
+		vmcase(OP_DEBUGGER)
+			SAVEPC();
 			js_trap(J, (int)(pc - pcstart) - 1);
-			break;
+			vmbreak;
 
-		case OP_JUMP:
-			pc = pcstart + *pc;
-			break;
+		vmcase(OP_JUMP)
+			offset = *pc;
+			BACKEDGE(offset);
+			pc = pcstart + offset;
+			vmbreak;
 
-		case OP_JTRUE:
+		vmcase(OP_JTRUE)
 			offset = *pc++;
 			b = js_toboolean(J, -1);
 			js_pop(J, 1);
-			if (b)
+			if (b) {
+				BACKEDGE(offset);
 				pc = pcstart + offset;
-			break;
+			}
+			vmbreak;
 
-		case OP_JFALSE:
+		vmcase(OP_JFALSE)
 			offset = *pc++;
 			b = js_toboolean(J, -1);
 			js_pop(J, 1);
-			if (!b)
+			if (!b) {
+				BACKEDGE(offset);
 				pc = pcstart + offset;
-			break;
+			}
+			vmbreak;
 
-		case OP_RETURN:
-			J->strict = savestrict;
-			return;
+		vmcase(OP_RETURN)
+			fr = &J->frame[--J->frametop];
+			J->strict = fr->savestrict;
+			if (J->frametop == base)
+				return;
+			jsR_leavefunction(J);
+			--J->tracetop;
+			BOT = fr->savebot;
+			if (fr->newobj && !js_isobject(J, -1)) {
+				js_pop(J, 1);
+				js_pushobject(J, fr->newobj);
+			}
+			LOADFRAME();
+			pc = J->frame[J->frametop-1].pc;
+			vmbreak;
+
+		/* Superinstructions */
+
+		vmcase(OP_GETLOCAL_GETPROP_S)
+			SAVEPC();
+			CHECKPUSH(1);
+			STACK[TOP++] = STACK[BOT + *pc++];
+			obj = js_toobject(J, -1);
+			jsR_getpropertycache(J, obj, ST[pc[0]], CT + pc[1] * JS_CACHEWAYS);
+			pc += 2;
+			js_rot2pop1(J);
+			vmbreak;
+
+		vmcase(OP_SETLOCAL_POP)
+			STACK[BOT + *pc++] = STACK[--TOP];
+			vmbreak;
+
+		vmcase(OP_INC_LOCAL)
+			SAVEPC();
+			ix = *pc++;
+			val = &STACK[BOT + ix];
+			if (JSV_TYPE(*val) == JS_TINTEGER && JSV_INTEGER(*val) != INT_MAX)
+				JSV_SETINTEGER(*val, JSV_INTEGER(*val) + 1);
+			else {
+				/* valueOf may grow the stack, so refetch the slot */
+				x = jsV_tonumber(J, ix) + 1;
+				JSV_SETNUMBER(STACK[BOT + ix], x);
+			}
+			vmbreak;
+
+		vmcase(OP_DEC_LOCAL)
+			SAVEPC();
+			ix = *pc++;
+			val = &STACK[BOT + ix];
+			if (JSV_TYPE(*val) == JS_TINTEGER && JSV_INTEGER(*val) != INT_MIN)
+				JSV_SETINTEGER(*val, JSV_INTEGER(*val) - 1);
+			else {
+				/* valueOf may grow the stack, so refetch the slot */
+				x = jsV_tonumber(J, ix) - 1;
+				JSV_SETNUMBER(STACK[BOT + ix], x);
+			}
+			vmbreak;
+
+		vmcase(OP_ADD_INTEGER)
+			SAVEPC();
+			ix = *pc++ - 32768;
+			if (JSV_TYPE(STACK[TOP-1]) == JS_TINTEGER) {
+				iy = JSV_INTEGER(STACK[TOP-1]);
+				js_pop(J, 1);
+				jsR_pushint64(J, (int64_t)iy + ix);
+			} else if (JSV_TYPE(STACK[TOP-1]) == JS_TNUMBER) {
+				JSV_SETNUMBER(STACK[TOP-1], JSV_NUMBER(STACK[TOP-1]) + ix);
+			} else {
+				js_pushnumber(J, ix);
+				js_concat(J);
+			}
+			vmbreak;
+
+		vmcase(OP_LT_JFALSE)
+			if (QUICKENING() && NUMOPERANDS()) REWRITE(OP_LT_JFALSE_NUM);
+			SAVEPC();
+			offset = *pc++;
+			b = jsR_compare(J, &okay);
+			js_pop(J, 2);
+			if (!(okay && b < 0)) {
+				BACKEDGE(offset);
+				pc = pcstart + offset;
+			}
+			vmbreak;
+
+		vmcase(OP_GT_JFALSE)
+			if (QUICKENING() && NUMOPERANDS()) REWRITE(OP_GT_JFALSE_NUM);
+			SAVEPC();
+			offset = *pc++;
+			b = jsR_compare(J, &okay);
+			js_pop(J, 2);
+			if (!(okay && b > 0)) {
+				BACKEDGE(offset);
+				pc = pcstart + offset;
+			}
+			vmbreak;
+
+		vmcase(OP_LE_JFALSE)
+			if (QUICKENING() && NUMOPERANDS()) REWRITE(OP_LE_JFALSE_NUM);
+			SAVEPC();
+			offset = *pc++;
+			b = jsR_compare(J, &okay);
+			js_pop(J, 2);
+			if (!(okay && b <= 0)) {
+				BACKEDGE(offset);
+				pc = pcstart + offset;
+			}
+			vmbreak;
+
+		vmcase(OP_GE_JFALSE)
+			if (QUICKENING() && NUMOPERANDS()) REWRITE(OP_GE_JFALSE_NUM);
+			SAVEPC();
+			offset = *pc++;
+			b = jsR_compare(J, &okay);
+			js_pop(J, 2);
+			if (!(okay && b >= 0)) {
+				BACKEDGE(offset);
+				pc = pcstart + offset;
+			}
+			vmbreak;
+
+		/* Quickened opcodes */
+
+		vmcase(OP_ADD_NUM)
+			if (!NUMOPERANDS()) DEOPTIMIZE(OP_ADD);
+			jsR_addnumbers(J);
+			vmbreak;
+
+		vmcase(OP_ADD_STR)
+			if (!STROPERANDS()) DEOPTIMIZE(OP_ADD);
+			SAVEPC();
+			jsR_addstrings(J);
+			vmbreak;
+
+		vmcase(OP_LT_NUM)
+			if (!NUMOPERANDS()) DEOPTIMIZE(OP_LT);
+			b = NUMCOMPARE(<);
+			SETBOOLEAN(b);
+			vmbreak;
+
+		vmcase(OP_GT_NUM)
+			if (!NUMOPERANDS()) DEOPTIMIZE(OP_GT);
+			b = NUMCOMPARE(>);
+			SETBOOLEAN(b);
+			vmbreak;
+
+		vmcase(OP_LE_NUM)
+			if (!NUMOPERANDS()) DEOPTIMIZE(OP_LE);
+			b = NUMCOMPARE(<=);
+			SETBOOLEAN(b);
+			vmbreak;
+
+		vmcase(OP_GE_NUM)
+			if (!NUMOPERANDS()) DEOPTIMIZE(OP_GE);
+			b = NUMCOMPARE(>=);
+			SETBOOLEAN(b);
+			vmbreak;
+
+		vmcase(OP_EQ_NUM)
+			if (!NUMOPERANDS()) DEOPTIMIZE(OP_EQ);
+			b = NUMCOMPARE(==);
+			SETBOOLEAN(b);
+			vmbreak;
+
+		vmcase(OP_EQ_STR)
+			if (!STROPERANDS()) DEOPTIMIZE(OP_EQ);
+			b = STREQUAL();
+			SETBOOLEAN(b);
+			vmbreak;
+
+		vmcase(OP_NE_NUM)
+			if (!NUMOPERANDS()) DEOPTIMIZE(OP_NE);
+			b = NUMCOMPARE(==);
+			SETBOOLEAN(!b);
+			vmbreak;
+
+		vmcase(OP_NE_STR)
+			if (!STROPERANDS()) DEOPTIMIZE(OP_NE);
+			b = STREQUAL();
+			SETBOOLEAN(!b);
+			vmbreak;
+
+		vmcase(OP_STRICTEQ_NUM)
+			if (!NUMOPERANDS()) DEOPTIMIZE(OP_STRICTEQ);
+			b = NUMCOMPARE(==);
+			SETBOOLEAN(b);
+			vmbreak;
+
+		vmcase(OP_STRICTEQ_STR)
+			if (!STROPERANDS()) DEOPTIMIZE(OP_STRICTEQ);
+			b = STREQUAL();
+			SETBOOLEAN(b);
+			vmbreak;
+
+		vmcase(OP_STRICTNE_NUM)
+			if (!NUMOPERANDS()) DEOPTIMIZE(OP_STRICTNE);
+			b = NUMCOMPARE(==);
+			SETBOOLEAN(!b);
+			vmbreak;
+
+		vmcase(OP_STRICTNE_STR)
+			if (!STROPERANDS()) DEOPTIMIZE(OP_STRICTNE);
+			b = STREQUAL();
+			SETBOOLEAN(!b);
+			vmbreak;
+
+		vmcase(OP_LT_JFALSE_NUM)
+			if (!NUMOPERANDS()) DEOPTIMIZE(OP_LT_JFALSE);
+			offset = *pc++;
+			b = NUMCOMPARE(<);
+			TOP -= 2;
+			if (!b) {
+				BACKEDGE(offset);
+				pc = pcstart + offset;
+			}
+			vmbreak;
+
+		vmcase(OP_GT_JFALSE_NUM)
+			if (!NUMOPERANDS()) DEOPTIMIZE(OP_GT_JFALSE);
+			offset = *pc++;
+			b = NUMCOMPARE(>);
+			TOP -= 2;
+			if (!b) {
+				BACKEDGE(offset);
+				pc = pcstart + offset;
+			}
+			vmbreak;
+
+		vmcase(OP_LE_JFALSE_NUM)
+			if (!NUMOPERANDS()) DEOPTIMIZE(OP_LE_JFALSE);
+			offset = *pc++;
+			b = NUMCOMPARE(<=);
+			TOP -= 2;
+			if (!b) {
+				BACKEDGE(offset);
+				pc = pcstart + offset;
+			}
+			vmbreak;
+
+		vmcase(OP_GE_JFALSE_NUM)
+			if (!NUMOPERANDS()) DEOPTIMIZE(OP_GE_JFALSE);
+			offset = *pc++;
+			b = NUMCOMPARE(>=);
+			TOP -= 2;
+			if (!b) {
+				BACKEDGE(offset);
+				pc = pcstart + offset;
+			}
+			vmbreak;
+		}
+	}
+}
+
+#ifdef JS_THREADED
+#pragma GCC diagnostic pop
+#endif
+
+/*
+ * Runtime helpers for native code (see jsjit.c and aot.c). Native code keeps
+ * no state of its own between instructions, so each helper finds the function
+ * in the topmost activation record, and gets a pointer to the operands of
+ * its instruction, one past the opcode, like pc in the interpreter.
+ */
+
+/* Instructions on locals, arguments and upvalues that have no template */
+void jsR_jitlocal(js_State *J, js_Instruction *pc)
+{
+	js_Frame *fr = &J->frame[J->frametop-1];
+	js_Function *F = fr->F;
+	const char **VT = F->vartab-1;
+	js_Value *LT = F->flatenv ? fr->E->slots - 1 : NULL;
+	int lightweight = F->lightweight;
+	int argbase = BOT + (lightweight ? F->varlen : 0) + 1;
+	const char *str;
+	js_Object *obj;
+	int ix;
+
+	SAVEPC();
+
+	switch (pc[-1]) {
+	case OP_GETLOCAL:
+		if (lightweight) {
+			CHECKSTACK(1);
+			STACK[TOP++] = STACK[BOT + *pc];
+		} else if (LT) {
+			CHECKSTACK(1);
+			STACK[TOP++] = LT[*pc];
+		} else if (!js_hasvar(J, VT[*pc])) {
+			js_referenceerror(J, "'%s' is not defined", VT[*pc]);
+		}
+		break;
+
+	case OP_SETLOCAL:
+		if (lightweight)
+			STACK[BOT + *pc] = STACK[TOP-1];
+		else if (LT)
+			LT[*pc] = STACK[TOP-1];
+		else
+			js_setvar(J, VT[*pc]);
+		break;
+
+	case OP_DELLOCAL:
+		js_pushboolean(J, lightweight || LT ? 0 : js_delvar(J, VT[*pc]));
+		break;
+
+	case OP_ARGUMENTS:
+		jsR_pusharguments(J, LT, *pc, argbase);
+		break;
+
+	case OP_GETARG:
+		ix = jsR_argindex(&STACK[TOP-1]);
+		if (JSV_TYPE(*ARGSLOT(*pc)) == JS_THOLE && ix >= 0 && ix < JSV_INTEGER(STACK[argbase])) {
+			STACK[TOP-1] = STACK[argbase + 1 + ix];
+		} else {
+			jsR_pusharguments(J, LT, *pc, argbase);
+			js_rot2(J);
+			str = js_tostring(J, -1);
+			obj = js_toobject(J, -2);
+			jsR_getproperty(J, obj, str);
+			js_rot3pop2(J);
+		}
+		break;
+
+	case OP_ARGLEN:
+		if (JSV_TYPE(*ARGSLOT(*pc)) == JS_THOLE) {
+			CHECKSTACK(1);
+			STACK[TOP++] = STACK[argbase];
+		} else {
+			js_pushvalue(J, *ARGSLOT(*pc));
+			obj = js_toobject(J, -1);
+			jsR_getproperty(J, obj, "length");
+			js_rot2pop1(J);
+		}
+		break;
+
+	case OP_GETUPVAL:
+		CHECKSTACK(1);
+		STACK[TOP++] = *jsR_upvalue(lightweight ? fr->E : fr->E->outer, pc[0], pc[1]);
+		break;
+
+	case OP_SETUPVAL:
+		*jsR_upvalue(lightweight ? fr->E : fr->E->outer, pc[0], pc[1]) = STACK[TOP-1];
+		break;
+	}
+}
+
+/* One instruction that has no template or helper of its own */
+void jsR_jitstep(js_State *J, js_Instruction *pc)
+{
+	js_Function *F = J->frame[J->frametop-1].F;
+	const char **ST = F->strtab;
+	const char *str;
+	js_Object *obj;
+	double x, y;
+	unsigned int ux, uy;
+	int ix, iy, b, okay;
+
+	SAVEPC();
+
+	switch (pc[-1]) {
+	case OP_DUP: js_dup(J); break;
+	case OP_DUP2: js_dup2(J); break;
+	case OP_ROT2: js_rot2(J); break;
+	case OP_ROT3: js_rot3(J); break;
+	case OP_ROT4: js_rot4(J); break;
+
+	case OP_NUMBER: js_pushnumber(J, F->numtab[*pc]); break;
+	case OP_STRING: js_pushliteral(J, ST[*pc]); break;
+
+	case OP_CLOSURE: GCSAFEPOINT(); js_newfunction(J, F->funtab[*pc], J->E); break;
+	case OP_NEWOBJECT: GCSAFEPOINT(); js_newobject(J); break;
+	case OP_NEWARRAY: GCSAFEPOINT(); js_newarray(J); break;
+	case OP_NEWREGEXP: GCSAFEPOINT(); js_newregexp(J, ST[pc[0]], pc[1]); break;
+
+	case OP_THIS:
+		if (J->strict || js_iscoercible(J, 0))
+			js_copy(J, 0);
+		else
+			js_pushglobal(J);
+		break;
+
+	case OP_CURRENT:
+		js_currentfunction(J);
+		break;
+
+	case OP_HASVAR:
+		if (!js_hasvar(J, ST[*pc]))
+			js_pushundefined(J);
+		break;
+
+	case OP_GETVAR: jsR_getvarcache(J, ST[pc[0]], F->cachetab + pc[1] * JS_CACHEWAYS); break;
+	case OP_SETVAR: js_setvar(J, ST[*pc]); break;
+	case OP_DELVAR: js_pushboolean(J, js_delvar(J, ST[*pc])); break;
+
+	case OP_IN:
+		str = js_tostring(J, -2);
+		if (!js_isobject(J, -1))
+			js_typeerror(J, "operand to 'in' is not an object");
+		b = js_hasproperty(J, -1, str);
+		js_pop(J, 2 + b);
+		js_pushboolean(J, b);
+		break;
+
+	case OP_INITPROP:
+		obj = js_toobject(J, -3);
+		str = js_tostring(J, -2);
+		jsR_setproperty(J, obj, str);
+		js_pop(J, 2);
+		break;
+
+	case OP_INITGETTER:
+		obj = js_toobject(J, -3);
+		str = js_tostring(J, -2);
+		jsR_defproperty(J, obj, str, 0, NULL, jsR_tofunction(J, -1), NULL);
+		js_pop(J, 2);
+		break;
+
+	case OP_INITSETTER:
+		obj = js_toobject(J, -3);
+		str = js_tostring(J, -2);
+		jsR_defproperty(J, obj, str, 0, NULL, NULL, jsR_tofunction(J, -1));
+		js_pop(J, 2);
+		break;
+
+	case OP_DELPROP:
+		str = js_tostring(J, -1);
+		obj = js_toobject(J, -2);
+		b = jsR_delproperty(J, obj, str);
+		js_pop(J, 2);
+		js_pushboolean(J, b);
+		break;
+
+	case OP_DELPROP_S:
+		obj = js_toobject(J, -1);
+		b = jsR_delproperty(J, obj, ST[*pc]);
+		js_pop(J, 1);
+		js_pushboolean(J, b);
+		break;
+
+	case OP_ITERATOR:
+		if (js_iscoercible(J, -1)) {
+			obj = jsV_newiterator(J, js_toobject(J, -1), 0);
+			js_pop(J, 1);
+			js_pushobject(J, obj);
+		}
+		break;
+
+	case OP_NEXTITER:
+		if (js_isobject(J, -1)) {
+			obj = js_toobject(J, -1);
+			str = jsV_nextiterator(J, obj);
+			if (str) {
+				js_pushliteral(J, str);
+				js_pushboolean(J, 1);
+				break;
+			}
+		}
+		js_pop(J, 1);
+		js_pushboolean(J, 0);
+		break;
+
+	case OP_TYPEOF:
+		str = js_typeof(J, -1);
+		js_pop(J, 1);
+		js_pushliteral(J, str);
+		break;
+
+	case OP_POS: x = js_tonumber(J, -1); js_pop(J, 1); js_pushnumber(J, x); break;
+	case OP_NEG: x = js_tonumber(J, -1); js_pop(J, 1); js_pushnumber(J, -x); break;
+	case OP_BITNOT: ix = js_toint32(J, -1); js_pop(J, 1); jsR_pushinteger(J, ~ix); break;
+	case OP_LOGNOT: b = js_toboolean(J, -1); js_pop(J, 1); js_pushboolean(J, !b); break;
+
+	case OP_INC:
+	case OP_DEC:
+	case OP_POSTINC:
+	case OP_POSTDEC:
+		iy = pc[-1] == OP_INC || pc[-1] == OP_POSTINC ? 1 : -1;
+		if (JSV_TYPE(STACK[TOP-1]) == JS_TINTEGER) {
+			ix = JSV_INTEGER(STACK[TOP-1]);
+			js_pop(J, 1);
+			jsR_pushint64(J, (int64_t)ix + iy);
+			if (pc[-1] == OP_POSTINC || pc[-1] == OP_POSTDEC)
+				jsR_pushinteger(J, ix);
+		} else {
+			x = js_tonumber(J, -1);
+			js_pop(J, 1);
+			js_pushnumber(J, x + iy);
+			if (pc[-1] == OP_POSTINC || pc[-1] == OP_POSTDEC)
+				js_pushnumber(J, x);
+		}
+		break;
+
+	case OP_MUL:
+	case OP_DIV:
+	case OP_MOD:
+		if (NUMOPERANDS()) {
+			x = JSV_ASNUMBER(STACK[TOP-2]);
+			y = JSV_ASNUMBER(STACK[TOP-1]);
+		} else {
+			x = js_tonumber(J, -2);
+			y = js_tonumber(J, -1);
+		}
+		x = pc[-1] == OP_MUL ? x * y : pc[-1] == OP_DIV ? x / y : fmod(x, y);
+		JSV_SETNUMBER(STACK[TOP-2], x);
+		--TOP;
+		break;
+
+	case OP_ADD:
+	case OP_ADD_NUM:
+	case OP_ADD_STR:
+		if (NUMOPERANDS())
+			jsR_addnumbers(J);
+		else if (STROPERANDS())
+			jsR_addstrings(J);
+		else
+			js_concat(J);
+		break;
+
+	case OP_SUB:
+		if (INTOPERANDS()) {
+			ix = JSV_INTEGER(STACK[TOP-2]);
+			iy = JSV_INTEGER(STACK[TOP-1]);
+			js_pop(J, 2);
+			jsR_pushint64(J, (int64_t)ix - iy);
+		} else {
+			x = js_tonumber(J, -2);
+			y = js_tonumber(J, -1);
+			JSV_SETNUMBER(STACK[TOP-2], x - y);
+			--TOP;
+		}
+		break;
+
+	case OP_ADD_INTEGER:
+		ix = *pc - 32768;
+		if (JSV_TYPE(STACK[TOP-1]) == JS_TINTEGER) {
+			iy = JSV_INTEGER(STACK[TOP-1]);
+			js_pop(J, 1);
+			jsR_pushint64(J, (int64_t)iy + ix);
+		} else if (JSV_TYPE(STACK[TOP-1]) == JS_TNUMBER) {
+			JSV_SETNUMBER(STACK[TOP-1], JSV_NUMBER(STACK[TOP-1]) + ix);
+		} else {
+			js_pushnumber(J, ix);
+			js_concat(J);
+		}
+		break;
+
+	case OP_INC_LOCAL:
+	case OP_DEC_LOCAL:
+		iy = pc[-1] == OP_INC_LOCAL ? 1 : -1;
+		ix = JSV_INTEGER(STACK[BOT + *pc]);
+		if (JSV_TYPE(STACK[BOT + *pc]) == JS_TINTEGER && ix != (iy > 0 ? INT_MAX : INT_MIN)) {
+			JSV_SETINTEGER(STACK[BOT + *pc], ix + iy);
+		} else {
+			x = jsV_tonumber(J, *pc) + iy;
+			JSV_SETNUMBER(STACK[BOT + *pc], x);
+		}
+		break;
+
+	case OP_SHL:
+		ix = js_toint32(J, -2);
+		uy = js_touint32(J, -1);
+		js_pop(J, 2);
+		jsR_pushinteger(J, (int)((unsigned int)ix << (uy & 0x1F)));
+		break;
+
+	case OP_SHR:
+		ix = js_toint32(J, -2);
+		uy = js_touint32(J, -1);
+		js_pop(J, 2);
+		jsR_pushinteger(J, ix >> (uy & 0x1F));
+		break;
+
+	case OP_USHR:
+		ux = js_touint32(J, -2);
+		uy = js_touint32(J, -1);
+		js_pop(J, 2);
+		jsR_pushint64(J, ux >> (uy & 0x1F));
+		break;
+
+	case OP_BITAND:
+	case OP_BITXOR:
+	case OP_BITOR:
+		ix = js_toint32(J, -2);
+		iy = js_toint32(J, -1);
+		js_pop(J, 2);
+		jsR_pushinteger(J, pc[-1] == OP_BITAND ? ix & iy : pc[-1] == OP_BITXOR ? ix ^ iy : ix | iy);
+		break;
+
+	case OP_LT: case OP_LT_NUM:
+		if (NUMOPERANDS()) {
+			b = NUMCOMPARE(<);
+		} else {
+			b = jsR_compare(J, &okay);
+			b = okay && b < 0;
+		}
+		SETBOOLEAN(b);
+		break;
+
+	case OP_GT: case OP_GT_NUM:
+		if (NUMOPERANDS()) {
+			b = NUMCOMPARE(>);
+		} else {
+			b = jsR_compare(J, &okay);
+			b = okay && b > 0;
+		}
+		SETBOOLEAN(b);
+		break;
+
+	case OP_LE: case OP_LE_NUM:
+		if (NUMOPERANDS()) {
+			b = NUMCOMPARE(<=);
+		} else {
+			b = jsR_compare(J, &okay);
+			b = okay && b <= 0;
 		}
+		SETBOOLEAN(b);
+		break;
+
+	case OP_GE: case OP_GE_NUM:
+		if (NUMOPERANDS()) {
+			b = NUMCOMPARE(>=);
+		} else {
+			b = jsR_compare(J, &okay);
+			b = okay && b >= 0;
+		}
+		SETBOOLEAN(b);
+		break;
+
+	case OP_INSTANCEOF:
+		b = js_instanceof(J);
+		js_pop(J, 2);
+		js_pushboolean(J, b);
+		break;
+
+	case OP_EQ: case OP_EQ_NUM: case OP_EQ_STR:
+	case OP_NE: case OP_NE_NUM: case OP_NE_STR:
+		b = NUMOPERANDS() ? NUMCOMPARE(==) : js_equal(J);
+		SETBOOLEAN(b == (pc[-1] == OP_EQ || pc[-1] == OP_EQ_NUM || pc[-1] == OP_EQ_STR));
+		break;
+
+	case OP_STRICTEQ: case OP_STRICTEQ_NUM: case OP_STRICTEQ_STR:
+	case OP_STRICTNE: case OP_STRICTNE_NUM: case OP_STRICTNE_STR:
+		b = NUMOPERANDS() ? NUMCOMPARE(==) : js_strictequal(J);
+		SETBOOLEAN(b == (pc[-1] == OP_STRICTEQ || pc[-1] == OP_STRICTEQ_NUM || pc[-1] == OP_STRICTEQ_STR));
+		break;
+
+	case OP_THROW:
+		js_throw(J);
+
+	default:
+		js_error(J, "cannot run opcode %s in compiled code", jsC_opcodestring(pc[-1]));
+	}
+}
+
+/* Conditional jumps: pop the operands, and return whether to take the branch */
+int jsR_jitbranch(js_State *J, js_Instruction *pc)
+{
+	int b, okay;
+
+	switch (pc[-1]) {
+	case OP_JTRUE:
+		b = js_toboolean(J, -1);
+		js_pop(J, 1);
+		return b;
+	case OP_JFALSE:
+		b = js_toboolean(J, -1);
+		js_pop(J, 1);
+		return !b;
+	case OP_JCASE:
+		b = js_strictequal(J);
+		js_pop(J, b ? 2 : 1);
+		return b;
 	}
+
+	SAVEPC();
+	b = jsR_compare(J, &okay);
+	js_pop(J, 2);
+	switch (pc[-1]) {
+	case OP_LT_JFALSE: case OP_LT_JFALSE_NUM: return !(okay && b < 0);
+	case OP_GT_JFALSE: case OP_GT_JFALSE_NUM: return !(okay && b > 0);
+	case OP_LE_JFALSE: case OP_LE_JFALSE_NUM: return !(okay && b <= 0);
+	default: return !(okay && b >= 0);
+	}
+}
+
+/* Switch through a jump table: pop the value, and return the clause to jump to, or -1 */
+int jsR_jitswitch(js_State *J, js_Instruction *pc)
+{
+	js_Function *F = J->frame[J->frametop-1].F;
+	return jsR_switch(J, F, &F->switchtab[*pc]);
+}
+
+void jsR_jitgetprop(js_State *J, js_Instruction *pc)
+{
+	js_Value *val;
+	SAVEPC();
+	val = jsR_numberelement(&STACK[TOP-2], &STACK[TOP-1]);
+	if (val) {
+		STACK[TOP-2] = *val;
+		--TOP;
+	} else {
+		const char *str = js_tostring(J, -1);
+		js_Object *obj = js_toobject(J, -2);
+		jsR_getproperty(J, obj, str);
+		js_rot3pop2(J);
+	}
+}
+
+void jsR_jitsetprop(js_State *J, js_Instruction *pc)
+{
+	js_Value *val;
+	js_Object *obj;
+	SAVEPC();
+	val = jsR_numberelement(&STACK[TOP-3], &STACK[TOP-2]);
+	if (val) {
+		int k;
+		obj = JSV_OBJECT(STACK[TOP-3]);
+		k = val - obj->elements;
+		if (obj->type == JS_CARRAY && k >= obj->u.a.length)
+			obj->u.a.length = k + 1;
+		JSG_BARRIER(J, obj, STACK[TOP-1]);
+		*val = STACK[TOP-1];
+	} else {
+		const char *str = js_tostring(J, -2);
+		obj = js_toobject(J, -3);
+		jsR_setproperty(J, obj, str);
+	}
+	js_rot3pop2(J);
+}
+
+void jsR_jitgetprop_s(js_State *J, js_Instruction *pc)
+{
+	js_Function *F = J->frame[J->frametop-1].F;
+	js_Object *obj;
+	SAVEPC();
+	if (pc[-1] == OP_GETLOCAL_GETPROP_S) {
+		CHECKSTACK(1);
+		STACK[TOP++] = STACK[BOT + *pc++];
+	}
+	obj = js_toobject(J, -1);
+	jsR_getpropertycache(J, obj, F->strtab[pc[0]], F->cachetab + pc[1] * JS_CACHEWAYS);
+	js_rot2pop1(J);
+}
+
+void jsR_jitsetprop_s(js_State *J, js_Instruction *pc)
+{
+	js_Function *F = J->frame[J->frametop-1].F;
+	js_Object *obj;
+	SAVEPC();
+	obj = js_toobject(J, -2);
+	jsR_setpropertycache(J, obj, F->strtab[pc[0]], F->cachetab + pc[1] * JS_CACHEWAYS);
+	js_rot2pop1(J);
+}
+
+void jsR_jitgetglobal(js_State *J, js_Instruction *pc)
+{
+	js_Function *F = J->frame[J->frametop-1].F;
+	SAVEPC();
+	jsR_getglobal(J, F->strtab[pc[0]], F->cachetab + pc[1] * JS_CACHEWAYS);
+}
+
+void jsR_jitsetglobal(js_State *J, js_Instruction *pc)
+{
+	js_Function *F = J->frame[J->frametop-1].F;
+	SAVEPC();
+	jsR_setglobal(J, F->strtab[pc[0]], F->cachetab + pc[1] * JS_CACHEWAYS);
+}
+
+/* Calls from compiled code recurse through the C stack */
+void jsR_jitcall(js_State *J, js_Instruction *pc)
+{
+	SAVEPC();
+	GCSAFEPOINT();
+	if (pc[-1] == OP_NEW)
+		js_construct(J, *pc);
+	else if (!(ISBYTECODE(STACK[TOP-*pc-2]) && INLINABLE(STACK[TOP-*pc-2]) &&
+			jsR_inlinecall(J, JSV_OBJECT(STACK[TOP-*pc-2])->u.f.function, *pc)))
+		js_call(J, *pc);
+}
+
+void jsR_jitcheckstack(js_State *J, js_Instruction *pc)
+{
+	CHECKPUSH(1);
+}
+
+void jsR_jitsafepoint(js_State *J, js_Instruction *pc)
+{
+	GCSAFEPOINT();
 }
@@ -2,11 +2,57 @@
 #define js_run_h
 
 js_Environment *jsR_newenvironment(js_State *J, js_Object *variables, js_Environment *outer);
+js_Environment *jsR_newslotenvironment(js_State *J, js_Function *function, js_Environment *outer);
+int jsR_findslot(js_Environment *E, const char *name);
 
+/*
+	Environment slots are written by the interpreter and native code without
+	a barrier. Instead, an old environment is remembered with its outer
+	scopes whenever code may start running in it (see jsG_scope).
+*/
+#define JSG_SCOPE(J, E) \
+	((E) && (E)->gcmark == (J)->gcmark ? jsG_scope(J, E) : (void)0)
+
+void jsG_scope(js_State *J, js_Environment *E);
+
+#ifdef JS_JIT
+/* Machine code for hot functions (jsjit.c) */
+int jsJ_compile(js_State *J, js_Function *F);
+void jsJ_run(js_State *J, int pc);
+void jsJ_free(js_State *J, js_Function *F);
+#endif
+
+/* Runtime helpers called by native code */
+void jsR_jitstep(js_State *J, js_Instruction *pc);
+void jsR_jitlocal(js_State *J, js_Instruction *pc);
+int jsR_jitbranch(js_State *J, js_Instruction *pc);
+int jsR_jitswitch(js_State *J, js_Instruction *pc);
+void jsR_jitgetprop(js_State *J, js_Instruction *pc);
+void jsR_jitsetprop(js_State *J, js_Instruction *pc);
+void jsR_jitgetprop_s(js_State *J, js_Instruction *pc);
+void jsR_jitsetprop_s(js_State *J, js_Instruction *pc);
+void jsR_jitgetglobal(js_State *J, js_Instruction *pc);
+void jsR_jitsetglobal(js_State *J, js_Instruction *pc);
+void jsR_jitcall(js_State *J, js_Instruction *pc);
+void jsR_jitcheckstack(js_State *J, js_Instruction *pc);
+void jsR_jitsafepoint(js_State *J, js_Instruction *pc);
+
+/*
+	An environment either holds its variables as properties of an object
+	(scripts, catch and with scopes, and functions using eval, with or
+	arguments), or as a flat array of values indexed by the slot numbers
+	the compiler resolved. A slotted environment has no variables object;
+	the names of its slots are the vartab of its function.
+*/
 struct js_Environment
 {
 	js_Environment *outer;
 	js_Object *variables;
+	js_Function *function;
+	js_Value *slots;
+
+	/* slots allocated, and for pooled environments, envtop of the call that owns it */
+	int slotcap, poolmark;
 
 	js_Environment *gcnext;
 	int gcmark;
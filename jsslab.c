@@ -0,0 +1,198 @@
+#include "jsi.h"
+
+/*
+	Small engine objects (objects, property nodes, environments, iterator
+	nodes and short strings) are carved out of slabs, one size class per
+	16 bytes up to JS_SLABMAX, instead of each going through J->alloc.
+	Every class keeps a list of free chunks, threaded through the chunks
+	themselves, which the sweeper refills; the caller says how big a chunk
+	is when it frees it. After a full collection, the slabs that have no
+	chunk in use any more are given back (js_slabrelease).
+*/
+
+#define SLABUNIT 16
+#define SLABCLASSES (JS_SLABMAX / SLABUNIT)
+#define SLABHEAD 16 /* header, rounded up to keep the chunks aligned */
+
+struct js_Slab
+{
+	int sizeclass, nfree;
+};
+
+#if defined(__SANITIZE_ADDRESS__)
+#include <sanitizer/asan_interface.h>
+#define poison(p, n) ASAN_POISON_MEMORY_REGION(p, n)
+#define unpoison(p, n) ASAN_UNPOISON_MEMORY_REGION(p, n)
+#else
+#define poison(p, n) (void)0
+#define unpoison(p, n) (void)0
+#endif
+
+static int chunksize(int c)
+{
+	return (c + 1) * SLABUNIT;
+}
+
+static int chunkcount(int c)
+{
+	return (JS_SLABSIZE - SLABHEAD) / chunksize(c);
+}
+
+/* free chunks are poisoned but for the link to the next one */
+static void *nextchunk(void *chunk)
+{
+	void *next;
+	unpoison(chunk, sizeof next);
+	next = *(void**)chunk;
+	poison(chunk, sizeof next);
+	return next;
+}
+
+static void setnextchunk(void *chunk, void *next)
+{
+	unpoison(chunk, sizeof next);
+	*(void**)chunk = next;
+	poison(chunk, sizeof next);
+}
+
+static void newslab(js_State *J, int c)
+{
+	js_Slab *slab;
+	char *chunk;
+	int i, n = chunkcount(c);
+
+	if (J->slabcount == J->slabcap) {
+		int cap = J->slabcap ? J->slabcap * 2 : 64;
+		J->slabs = js_realloc(J, J->slabs, cap * sizeof *J->slabs);
+		J->slabcap = cap;
+	}
+
+	slab = js_malloc(J, JS_SLABSIZE);
+	slab->sizeclass = c;
+	slab->nfree = 0;
+	J->slabs[J->slabcount++] = slab;
+
+	/* thread the chunks backwards, so they are handed out in address order */
+	chunk = (char*)slab + SLABHEAD;
+	poison(chunk, n * chunksize(c));
+	for (i = n - 1; i >= 0; --i) {
+		setnextchunk(chunk + i * chunksize(c), J->slabfree[c]);
+		J->slabfree[c] = chunk + i * chunksize(c);
+	}
+}
+
+void *js_slaballoc(js_State *J, int size)
+{
+	void *chunk;
+	int c;
+
+	if (size > JS_SLABMAX)
+		return js_malloc(J, size);
+
+	c = (size - 1) / SLABUNIT;
+	if (!J->slabfree[c])
+		newslab(J, c);
+	chunk = J->slabfree[c];
+	J->slabfree[c] = nextchunk(chunk);
+	unpoison(chunk, chunksize(c));
+	return chunk;
+}
+
+void js_slabfree(js_State *J, void *ptr, int size)
+{
+	int c;
+
+	if (size > JS_SLABMAX) {
+		js_free(J, ptr);
+		return;
+	}
+
+	c = (size - 1) / SLABUNIT;
+	poison(ptr, chunksize(c));
+	setnextchunk(ptr, J->slabfree[c]);
+	J->slabfree[c] = ptr;
+}
+
+static int cmpslab(const void *a, const void *b)
+{
+	uintptr_t x = (uintptr_t)*(js_Slab* const*)a;
+	uintptr_t y = (uintptr_t)*(js_Slab* const*)b;
+	return x < y ? -1 : x > y ? 1 : 0;
+}
+
+/* the slab a chunk was carved out of: the last one that starts before it */
+static js_Slab *findslab(js_State *J, void *chunk)
+{
+	int lo = 0, hi = J->slabcount - 1;
+	while (lo < hi) {
+		int mid = (lo + hi + 1) / 2;
+		if ((uintptr_t)J->slabs[mid] <= (uintptr_t)chunk)
+			lo = mid;
+		else
+			hi = mid - 1;
+	}
+	return J->slabs[lo];
+}
+
+static void freeslab(js_State *J, js_Slab *slab)
+{
+	unpoison(slab, JS_SLABSIZE);
+	js_free(J, slab);
+}
+
+static int isempty(js_Slab *slab)
+{
+	return slab->nfree == chunkcount(slab->sizeclass);
+}
+
+/* Give back the slabs whose chunks are all free */
+void js_slabrelease(js_State *J)
+{
+	void *chunk, *next, **prev;
+	int c, i, n;
+
+	if (J->slabcount == 0)
+		return;
+
+	qsort(J->slabs, J->slabcount, sizeof *J->slabs, cmpslab);
+	for (i = 0; i < J->slabcount; ++i)
+		J->slabs[i]->nfree = 0;
+
+	for (c = 0; c < SLABCLASSES; ++c)
+		for (chunk = J->slabfree[c]; chunk; chunk = nextchunk(chunk))
+			++findslab(J, chunk)->nfree;
+
+	/* drop the chunks of empty slabs from the free lists */
+	for (c = 0; c < SLABCLASSES; ++c) {
+		prev = &J->slabfree[c];
+		while ((chunk = *prev)) {
+			if (isempty(findslab(J, chunk)))
+				*prev = nextchunk(chunk);
+			else
+				prev = (void**)chunk;
+			unpoison(prev, sizeof *prev);
+		}
+	}
+
+	for (i = n = 0; i < J->slabcount; ++i) {
+		if (isempty(J->slabs[i]))
+			freeslab(J, J->slabs[i]);
+		else
+			J->slabs[n++] = J->slabs[i];
+	}
+	J->slabcount = n;
+
+	/* leave the links poisoned again */
+	for (c = 0; c < SLABCLASSES; ++c)
+		for (chunk = J->slabfree[c]; chunk; chunk = next) {
+			next = *(void**)chunk;
+			poison(chunk, sizeof next);
+		}
+}
+
+void js_slabfreeall(js_State *J)
+{
+	while (J->slabcount > 0)
+		freeslab(J, J->slabs[--J->slabcount]);
+	js_free(J, J->slabs);
+}
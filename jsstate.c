@@ -95,6 +95,59 @@ int js_tryboolean(js_State *J, int idx, int error)
 	return v;
 }
 
+void js_registeraot(js_State *J, const js_AotScript *script)
+{
+	if (J->aotlen == J->aotcap) {
+		J->aotcap = J->aotcap ? J->aotcap * 2 : 8;
+		J->aot = js_realloc(J, J->aot, J->aotcap * sizeof *J->aot);
+	}
+	J->aot[J->aotlen++] = script;
+}
+
+/* Match the function tree in compile order against the registered bytecode */
+static int js_matchaot(js_Function *F, const js_AotScript *S, int *n)
+{
+	const js_AotFunction *A;
+	int i;
+	if (*n >= S->count)
+		return 0;
+	A = &S->funs[(*n)++];
+	if (A->codelen != F->codelen || A->checksum != jsC_checksum(F))
+		return 0;
+	for (i = 0; i < F->funlen; ++i)
+		if (!js_matchaot(F->funtab[i], S, n))
+			return 0;
+	return 1;
+}
+
+static void js_attachaot(js_Function *F, const js_AotScript *S, int *n)
+{
+	int i;
+	F->native = S->funs[(*n)++].run;
+	for (i = 0; i < F->funlen; ++i)
+		js_attachaot(F->funtab[i], S, n);
+}
+
+static void js_loadaot(js_State *J, js_Function *F)
+{
+	unsigned int checksum;
+	int i, n;
+	if (J->aotlen == 0)
+		return;
+	checksum = jsC_checksum(F);
+	for (i = 0; i < J->aotlen; ++i) {
+		const js_AotScript *S = J->aot[i];
+		if (S->count > 0 && S->funs[0].checksum == checksum) {
+			n = 0;
+			if (js_matchaot(F, S, &n) && n == S->count) {
+				n = 0;
+				js_attachaot(F, S, &n);
+				return;
+			}
+		}
+	}
+}
+
 static void js_loadstringx(js_State *J, const char *filename, const char *source, int iseval)
 {
 	js_Ast *P;
@@ -106,8 +159,9 @@ static void js_loadstringx(js_State *J, const char *filename, const char *source
 	}
 
 	P = jsP_parse(J, filename, source);
-	F = jsC_compilescript(J, P, iseval ? J->strict : J->default_strict);
+	F = jsC_compilescript(J, P, iseval ? J->strict : J->default_strict, iseval);
 	jsP_freeparse(J);
+	js_loadaot(J, F);
 	js_newscript(J, F, iseval ? (J->strict ? J->E : NULL) : J->GE);
 
 	js_endtry(J);
@@ -241,8 +295,12 @@ js_State *js_newstate(js_Alloc alloc, void *actx, int flags)
 {
 	js_State *J;
 
+#ifdef JS_NANBOX
+	assert(sizeof(js_Value) == 8);
+#else
 	assert(sizeof(js_Value) == 16);
 	assert(soffsetof(js_Value, type) == 15);
+#endif
 
 	if (!alloc)
 		alloc = js_defaultalloc;
@@ -257,20 +315,40 @@ js_State *js_newstate(js_Alloc alloc, void *actx, int flags)
 	if (flags & JS_STRICT)
 		J->strict = J->default_strict = 1;
 
-	J->trace[0].name = "-top-";
-	J->trace[0].file = "native";
-	J->trace[0].line = 0;
-
 	J->report = js_defaultreport;
 	J->panic = js_defaultpanic;
 
-	J->stack = alloc(actx, NULL, JS_STACKSIZE * sizeof *J->stack);
-	if (!J->stack) {
-		alloc(actx, NULL, 0);
+	J->stacksize = JS_STACKSIZE;
+	J->stacklimit = JS_STACKLIMIT;
+	J->envcap = J->tracecap = JS_ENVSIZE;
+	J->envlimit = JS_ENVLIMIT;
+	J->trycap = JS_TRYSIZE;
+	J->trylimit = JS_TRYLIMIT;
+
+	J->stack = alloc(actx, NULL, J->stacksize * sizeof *J->stack);
+	J->envstack = alloc(actx, NULL, J->envcap * sizeof *J->envstack);
+	J->trace = alloc(actx, NULL, J->tracecap * sizeof *J->trace);
+	J->frame = alloc(actx, NULL, J->tracecap * sizeof *J->frame);
+	J->trybuf = alloc(actx, NULL, J->trycap * sizeof *J->trybuf);
+	if (!J->stack || !J->envstack || !J->trace || !J->frame || !J->trybuf) {
+		alloc(actx, J->stack, 0);
+		alloc(actx, J->envstack, 0);
+		alloc(actx, J->trace, 0);
+		alloc(actx, J->frame, 0);
+		alloc(actx, J->trybuf, 0);
+		alloc(actx, J, 0);
 		return NULL;
 	}
 
+	J->trace[0].name = "-top-";
+	J->trace[0].file = "native";
+	J->trace[0].line = 0;
+	J->trace[0].fun = NULL;
+	J->trace[0].pc = NULL;
+
 	J->gcmark = 1;
+	J->gcthreads = 1;
+	J->gcoldlimit = JS_GCLIMIT;
 	J->nextref = 0;
 
 	J->R = jsV_newobject(J, JS_COBJECT, NULL);
@@ -4,8 +4,8 @@
 #include "jsvalue.h"
 #include "utf.h"
 
-#define JSV_ISSTRING(v) (v->type==JS_TSHRSTR || v->type==JS_TMEMSTR || v->type==JS_TLITSTR)
-#define JSV_TOSTRING(v) (v->type==JS_TSHRSTR ? v->u.shrstr : v->type==JS_TLITSTR ? v->u.litstr : v->type==JS_TMEMSTR ? v->u.memstr->p : "")
+#define JSV_ISSTRING(v) (JSV_TYPE(*v)==JS_TSHRSTR || JSV_TYPE(*v)==JS_TMEMSTR || JSV_TYPE(*v)==JS_TLITSTR)
+#define JSV_TOSTRING(v) (JSV_TYPE(*v)==JS_TSHRSTR ? JSV_SHRSTR(*v) : JSV_TYPE(*v)==JS_TLITSTR ? JSV_LITSTR(*v) : JSV_TYPE(*v)==JS_TMEMSTR ? JSV_MEMSTR(*v)->p : "")
 
 int jsV_numbertointeger(double n)
 {
@@ -82,28 +82,39 @@ static int jsV_valueOf(js_State *J, js_Object *obj)
 	return 0;
 }
 
+/*
+ * The conversions below take the stack index of the value rather than a
+ * pointer to it: toString and valueOf may grow the stack into a new block,
+ * so the value is found again by its index after they return.
+ */
+
 /* ToPrimitive() on a value */
-void jsV_toprimitive(js_State *J, js_Value *v, int preferred)
+void jsV_toprimitive(js_State *J, int idx, int preferred)
 {
+	js_Value *v = js_tovalue(J, idx);
 	js_Object *obj;
 
-	if (v->type != JS_TOBJECT)
+	if (JSV_TYPE(*v) != JS_TOBJECT)
 		return;
 
-	obj = v->u.object;
+	obj = JSV_OBJECT(*v);
+
+	/* the methods push their result, so count from the bottom */
+	if (idx < 0)
+		idx += J->top - J->bot;
 
 	if (preferred == JS_HNONE)
 		preferred = obj->type == JS_CDATE ? JS_HSTRING : JS_HNUMBER;
 
 	if (preferred == JS_HSTRING) {
 		if (jsV_toString(J, obj) || jsV_valueOf(J, obj)) {
-			*v = *js_tovalue(J, -1);
+			*js_tovalue(J, idx) = *js_tovalue(J, -1);
 			js_pop(J, 1);
 			return;
 		}
 	} else {
 		if (jsV_valueOf(J, obj) || jsV_toString(J, obj)) {
-			*v = *js_tovalue(J, -1);
+			*js_tovalue(J, idx) = *js_tovalue(J, -1);
 			js_pop(J, 1);
 			return;
 		}
@@ -112,23 +123,23 @@ void jsV_toprimitive(js_State *J, js_Value *v, int preferred)
 	if (J->strict)
 		js_typeerror(J, "cannot convert object to primitive");
 
-	v->type = JS_TLITSTR;
-	v->u.litstr = "[object]";
+	JSV_SETLITSTR(*js_tovalue(J, idx), "[object]");
 	return;
 }
 
 /* ToBoolean() on a value */
 int jsV_toboolean(js_State *J, js_Value *v)
 {
-	switch (v->type) {
+	switch (JSV_TYPE(*v)) {
 	default:
-	case JS_TSHRSTR: return v->u.shrstr[0] != 0;
+	case JS_TSHRSTR: return JSV_SHRSTR(*v)[0] != 0;
 	case JS_TUNDEFINED: return 0;
 	case JS_TNULL: return 0;
-	case JS_TBOOLEAN: return v->u.boolean;
-	case JS_TNUMBER: return v->u.number != 0 && !isnan(v->u.number);
-	case JS_TLITSTR: return v->u.litstr[0] != 0;
-	case JS_TMEMSTR: return v->u.memstr->p[0] != 0;
+	case JS_TBOOLEAN: return JSV_BOOLEAN(*v);
+	case JS_TNUMBER: return JSV_NUMBER(*v) != 0 && !isnan(JSV_NUMBER(*v));
+	case JS_TINTEGER: return JSV_INTEGER(*v) != 0;
+	case JS_TLITSTR: return JSV_LITSTR(*v)[0] != 0;
+	case JS_TMEMSTR: return JSV_MEMSTR(*v)->p[0] != 0;
 	case JS_TOBJECT: return 1;
 	}
 }
@@ -206,26 +217,28 @@ double jsV_stringtonumber(js_State *J, const char *s)
 }
 
 /* ToNumber() on a value */
-double jsV_tonumber(js_State *J, js_Value *v)
+double jsV_tonumber(js_State *J, int idx)
 {
-	switch (v->type) {
+	js_Value *v = js_tovalue(J, idx);
+	switch (JSV_TYPE(*v)) {
 	default:
-	case JS_TSHRSTR: return jsV_stringtonumber(J, v->u.shrstr);
+	case JS_TSHRSTR: return jsV_stringtonumber(J, JSV_SHRSTR(*v));
 	case JS_TUNDEFINED: return NAN;
 	case JS_TNULL: return 0;
-	case JS_TBOOLEAN: return v->u.boolean;
-	case JS_TNUMBER: return v->u.number;
-	case JS_TLITSTR: return jsV_stringtonumber(J, v->u.litstr);
-	case JS_TMEMSTR: return jsV_stringtonumber(J, v->u.memstr->p);
+	case JS_TBOOLEAN: return JSV_BOOLEAN(*v);
+	case JS_TNUMBER: return JSV_NUMBER(*v);
+	case JS_TINTEGER: return JSV_INTEGER(*v);
+	case JS_TLITSTR: return jsV_stringtonumber(J, JSV_LITSTR(*v));
+	case JS_TMEMSTR: return jsV_stringtonumber(J, JSV_MEMSTR(*v)->p);
 	case JS_TOBJECT:
-		jsV_toprimitive(J, v, JS_HNUMBER);
-		return jsV_tonumber(J, v);
+		jsV_toprimitive(J, idx, JS_HNUMBER);
+		return jsV_tonumber(J, idx);
 	}
 }
 
-double jsV_tointeger(js_State *J, js_Value *v)
+double jsV_tointeger(js_State *J, int idx)
 {
-	return jsV_numbertointeger(jsV_tonumber(J, v));
+	return jsV_numbertointeger(jsV_tonumber(J, idx));
 }
 
 /* ToString() on a number */
@@ -289,38 +302,39 @@ const char *jsV_numbertostring(js_State *J, char buf[32], double f)
 }
 
 /* ToString() on a value */
-const char *jsV_tostring(js_State *J, js_Value *v)
+const char *jsV_tostring(js_State *J, int idx)
 {
+	js_Value *v = js_tovalue(J, idx);
 	char buf[32];
 	const char *p;
-	switch (v->type) {
+	switch (JSV_TYPE(*v)) {
 	default:
-	case JS_TSHRSTR: return v->u.shrstr;
+	case JS_TSHRSTR: return JSV_SHRSTR(*v);
 	case JS_TUNDEFINED: return "undefined";
 	case JS_TNULL: return "null";
-	case JS_TBOOLEAN: return v->u.boolean ? "true" : "false";
-	case JS_TLITSTR: return v->u.litstr;
-	case JS_TMEMSTR: return v->u.memstr->p;
+	case JS_TBOOLEAN: return JSV_BOOLEAN(*v) ? "true" : "false";
+	case JS_TLITSTR: return JSV_LITSTR(*v);
+	case JS_TMEMSTR: return JSV_MEMSTR(*v)->p;
 	case JS_TNUMBER:
-		p = jsV_numbertostring(J, buf, v->u.number);
+	case JS_TINTEGER:
+		if (JSV_TYPE(*v) == JS_TINTEGER)
+			p = js_itoa(buf, JSV_INTEGER(*v));
+		else
+			p = jsV_numbertostring(J, buf, JSV_NUMBER(*v));
 		if (p == buf) {
 			int n = strlen(p);
-			if (n <= soffsetof(js_Value, type)) {
-				char *s = v->u.shrstr;
-				while (n--) *s++ = *p++;
-				*s = 0;
-				v->type = JS_TSHRSTR;
-				return v->u.shrstr;
+			if (n <= JSV_SHRSTRMAX) {
+				JSV_SETSHRSTR(*v, p, n);
+				return JSV_SHRSTR(*v);
 			} else {
-				v->type = JS_TMEMSTR;
-				v->u.memstr = jsV_newmemstring(J, p, n);
-				return v->u.memstr->p;
+				JSV_SETMEMSTR(*v, jsV_newmemstring(J, p, n));
+				return JSV_MEMSTR(*v)->p;
 			}
 		}
 		return p;
 	case JS_TOBJECT:
-		jsV_toprimitive(J, v, JS_HSTRING);
-		return jsV_tostring(J, v);
+		jsV_toprimitive(J, idx, JS_HSTRING);
+		return jsV_tostring(J, idx);
 	}
 }
 
@@ -351,16 +365,17 @@ static js_Object *jsV_newstring(js_State *J, const char *v)
 /* ToObject() on a value */
 js_Object *jsV_toobject(js_State *J, js_Value *v)
 {
-	switch (v->type) {
+	switch (JSV_TYPE(*v)) {
 	default:
-	case JS_TSHRSTR: return jsV_newstring(J, v->u.shrstr);
+	case JS_TSHRSTR: return jsV_newstring(J, JSV_SHRSTR(*v));
 	case JS_TUNDEFINED: js_typeerror(J, "cannot convert undefined to object");
 	case JS_TNULL: js_typeerror(J, "cannot convert null to object");
-	case JS_TBOOLEAN: return jsV_newboolean(J, v->u.boolean);
-	case JS_TNUMBER: return jsV_newnumber(J, v->u.number);
-	case JS_TLITSTR: return jsV_newstring(J, v->u.litstr);
-	case JS_TMEMSTR: return jsV_newstring(J, v->u.memstr->p);
-	case JS_TOBJECT: return v->u.object;
+	case JS_TBOOLEAN: return jsV_newboolean(J, JSV_BOOLEAN(*v));
+	case JS_TNUMBER: return jsV_newnumber(J, JSV_NUMBER(*v));
+	case JS_TINTEGER: return jsV_newnumber(J, JSV_INTEGER(*v));
+	case JS_TLITSTR: return jsV_newstring(J, JSV_LITSTR(*v));
+	case JS_TMEMSTR: return jsV_newstring(J, JSV_MEMSTR(*v)->p);
+	case JS_TOBJECT: return JSV_OBJECT(*v);
 	}
 }
 
@@ -567,45 +582,45 @@ int js_compare(js_State *J, int *okay)
 
 int js_equal(js_State *J)
 {
-	js_Value *x = js_tovalue(J, -2);
-	js_Value *y = js_tovalue(J, -1);
+	js_Value *x, *y;
 
 retry:
+	x = js_tovalue(J, -2);
+	y = js_tovalue(J, -1);
 	if (JSV_ISSTRING(x) && JSV_ISSTRING(y))
 		return !strcmp(JSV_TOSTRING(x), JSV_TOSTRING(y));
-	if (x->type == y->type) {
-		if (x->type == JS_TUNDEFINED) return 1;
-		if (x->type == JS_TNULL) return 1;
-		if (x->type == JS_TNUMBER) return x->u.number == y->u.number;
-		if (x->type == JS_TBOOLEAN) return x->u.boolean == y->u.boolean;
-		if (x->type == JS_TOBJECT) return x->u.object == y->u.object;
+	if (JSV_ISNUMBER(*x) && JSV_ISNUMBER(*y))
+		return JSV_ASNUMBER(*x) == JSV_ASNUMBER(*y);
+	if (JSV_TYPE(*x) == JSV_TYPE(*y)) {
+		if (JSV_TYPE(*x) == JS_TUNDEFINED) return 1;
+		if (JSV_TYPE(*x) == JS_TNULL) return 1;
+		if (JSV_TYPE(*x) == JS_TBOOLEAN) return JSV_BOOLEAN(*x) == JSV_BOOLEAN(*y);
+		if (JSV_TYPE(*x) == JS_TOBJECT) return JSV_OBJECT(*x) == JSV_OBJECT(*y);
 		return 0;
 	}
 
-	if (x->type == JS_TNULL && y->type == JS_TUNDEFINED) return 1;
-	if (x->type == JS_TUNDEFINED && y->type == JS_TNULL) return 1;
+	if (JSV_TYPE(*x) == JS_TNULL && JSV_TYPE(*y) == JS_TUNDEFINED) return 1;
+	if (JSV_TYPE(*x) == JS_TUNDEFINED && JSV_TYPE(*y) == JS_TNULL) return 1;
 
-	if (x->type == JS_TNUMBER && JSV_ISSTRING(y))
-		return x->u.number == jsV_tonumber(J, y);
-	if (JSV_ISSTRING(x) && y->type == JS_TNUMBER)
-		return jsV_tonumber(J, x) == y->u.number;
+	if (JSV_ISNUMBER(*x) && JSV_ISSTRING(y))
+		return JSV_ASNUMBER(*x) == jsV_tonumber(J, -1);
+	if (JSV_ISSTRING(x) && JSV_ISNUMBER(*y))
+		return jsV_tonumber(J, -2) == JSV_ASNUMBER(*y);
 
-	if (x->type == JS_TBOOLEAN) {
-		x->type = JS_TNUMBER;
-		x->u.number = x->u.boolean;
+	if (JSV_TYPE(*x) == JS_TBOOLEAN) {
+		JSV_SETNUMBER(*x, JSV_BOOLEAN(*x));
 		goto retry;
 	}
-	if (y->type == JS_TBOOLEAN) {
-		y->type = JS_TNUMBER;
-		y->u.number = y->u.boolean;
+	if (JSV_TYPE(*y) == JS_TBOOLEAN) {
+		JSV_SETNUMBER(*y, JSV_BOOLEAN(*y));
 		goto retry;
 	}
-	if ((JSV_ISSTRING(x) || x->type == JS_TNUMBER) && y->type == JS_TOBJECT) {
-		jsV_toprimitive(J, y, JS_HNONE);
+	if ((JSV_ISSTRING(x) || JSV_ISNUMBER(*x)) && JSV_TYPE(*y) == JS_TOBJECT) {
+		jsV_toprimitive(J, -1, JS_HNONE);
 		goto retry;
 	}
-	if (x->type == JS_TOBJECT && (JSV_ISSTRING(y) || y->type == JS_TNUMBER)) {
-		jsV_toprimitive(J, x, JS_HNONE);
+	if (JSV_TYPE(*x) == JS_TOBJECT && (JSV_ISSTRING(y) || JSV_ISNUMBER(*y))) {
+		jsV_toprimitive(J, -2, JS_HNONE);
 		goto retry;
 	}
 
@@ -619,12 +634,13 @@ int js_strictequal(js_State *J)
 
 	if (JSV_ISSTRING(x) && JSV_ISSTRING(y))
 		return !strcmp(JSV_TOSTRING(x), JSV_TOSTRING(y));
-
-	if (x->type != y->type) return 0;
-	if (x->type == JS_TUNDEFINED) return 1;
-	if (x->type == JS_TNULL) return 1;
-	if (x->type == JS_TNUMBER) return x->u.number == y->u.number;
-	if (x->type == JS_TBOOLEAN) return x->u.boolean == y->u.boolean;
-	if (x->type == JS_TOBJECT) return x->u.object == y->u.object;
+	if (JSV_ISNUMBER(*x) && JSV_ISNUMBER(*y))
+		return JSV_ASNUMBER(*x) == JSV_ASNUMBER(*y);
+
+	if (JSV_TYPE(*x) != JSV_TYPE(*y)) return 0;
+	if (JSV_TYPE(*x) == JS_TUNDEFINED) return 1;
+	if (JSV_TYPE(*x) == JS_TNULL) return 1;
+	if (JSV_TYPE(*x) == JS_TBOOLEAN) return JSV_BOOLEAN(*x) == JSV_BOOLEAN(*y);
+	if (JSV_TYPE(*x) == JS_TOBJECT) return JSV_OBJECT(*x) == JSV_OBJECT(*y);
 	return 0;
 }
@@ -2,6 +2,7 @@
 #define js_value_h
 
 typedef struct js_Property js_Property;
+typedef struct js_PropertyNode js_PropertyNode;
 typedef struct js_Iterator js_Iterator;
 
 /* Hint to ToPrimitive() */
@@ -16,10 +17,12 @@ enum js_Type {
 	JS_TUNDEFINED,
 	JS_TNULL,
 	JS_TBOOLEAN,
-	JS_TNUMBER,
 	JS_TLITSTR,
 	JS_TMEMSTR,
 	JS_TOBJECT,
+	JS_THOLE, /* missing element in dense array storage, never on the stack */
+	JS_TNUMBER, /* last, so the others fit in the NaN-box tag */
+	JS_TINTEGER, /* int32 fast path, a JS_TNUMBER as far as scripts can tell */
 };
 
 enum js_Class {
@@ -42,16 +45,76 @@ enum js_Class {
 };
 
 /*
-	Short strings abuse the js_Value struct. By putting the type tag in the
-	last byte, and using 0 as the tag for short strings, we can use the
-	entire js_Value as string storage by letting the type tag serve double
-	purpose as the string zero terminator.
+	Values are only accessed through the JSV_ macros below, so the layout
+	can be chosen at build time.
+
+	In the default layout, short strings abuse the js_Value struct. By
+	putting the type tag in the last byte, and using 0 as the tag for short
+	strings, we can use the entire js_Value as string storage by letting
+	the type tag serve double purpose as the string zero terminator.
+
+	With JS_NANBOX, a value is a single 64-bit word. Numbers are stored as
+	plain doubles, with every NaN folded into one canonical quiet NaN. That
+	frees the negative quiet NaN space 0xFFF8... to 0xFFFF..., where the top
+	16 bits hold the type and the low 48 bits hold a pointer or boolean.
+	Int32 values use the positive quiet NaN prefix 0x7FF9 instead.
+	Short strings of up to 5 bytes live in the low 6 bytes of the word,
+	zero padded, so on a little-endian machine the value itself is still a
+	zero-terminated string. Longer strings become memstrs.
 */
 
+#ifdef JS_NANBOX
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "JS_NANBOX short strings need a little-endian target"
+#endif
+
+struct js_Value
+{
+	union {
+		uint64_t bits;
+		double number;
+		char shrstr[8];
+	} u;
+};
+
+#define JSV_NANBASE 0xFFF8000000000000ULL
+#define JSV_NAN 0x7FF8000000000000ULL
+#define JSV_INTTAG 0x7FF9000000000000ULL
+#define JSV_TAG(t) (JSV_NANBASE | (uint64_t)(t) << 48)
+#define JSV_PAYLOAD(v) ((v).u.bits & 0xFFFFFFFFFFFFULL)
+
+#define JSV_SHRSTRMAX 5
+#define JSV_INITUNDEFINED { { JSV_TAG(JS_TUNDEFINED) } }
+
+#define JSV_TYPE(v) ((v).u.bits >= JSV_NANBASE ? (enum js_Type)((v).u.bits >> 48 & 7) : \
+	((v).u.bits >> 32) == (JSV_INTTAG >> 32) ? JS_TINTEGER : JS_TNUMBER)
+#define JSV_BOOLEAN(v) ((int)((v).u.bits & 1))
+#define JSV_NUMBER(v) ((v).u.number)
+#define JSV_INTEGER(v) ((int)(uint32_t)(v).u.bits)
+#define JSV_SHRSTR(v) ((v).u.shrstr)
+#define JSV_LITSTR(v) ((const char *)(uintptr_t)JSV_PAYLOAD(v))
+#define JSV_MEMSTR(v) ((js_String *)(uintptr_t)JSV_PAYLOAD(v))
+#define JSV_OBJECT(v) ((js_Object *)(uintptr_t)JSV_PAYLOAD(v))
+
+#define JSV_SETUNDEFINED(v) ((v).u.bits = JSV_TAG(JS_TUNDEFINED))
+#define JSV_SETNULL(v) ((v).u.bits = JSV_TAG(JS_TNULL))
+#define JSV_SETHOLE(v) ((v).u.bits = JSV_TAG(JS_THOLE))
+#define JSV_SETBOOLEAN(v, x) ((v).u.bits = JSV_TAG(JS_TBOOLEAN) | !!(x))
+#define JSV_SETNUMBER(v, x) ((v).u.number = (x), (v).u.number != (v).u.number ? ((v).u.bits = JSV_NAN) : 0)
+#define JSV_SETINTEGER(v, x) ((v).u.bits = JSV_INTTAG | (uint32_t)(x))
+#define JSV_SETSHRSTR(v, s, n) ((v).u.bits = JSV_TAG(JS_TSHRSTR), memcpy((v).u.shrstr, (s), (n)))
+#define JSV_SETLITSTR(v, x) ((v).u.bits = JSV_TAG(JS_TLITSTR) | (uintptr_t)(x))
+#define JSV_SETMEMSTR(v, x) ((v).u.bits = JSV_TAG(JS_TMEMSTR) | (uintptr_t)(x))
+#define JSV_SETOBJECT(v, x) ((v).u.bits = JSV_TAG(JS_TOBJECT) | (uintptr_t)(x))
+
+#else
+
 struct js_Value
 {
 	union {
 		int boolean;
+		int integer;
 		double number;
 		char shrstr[8];
 		const char *litstr;
@@ -62,10 +125,39 @@ struct js_Value
 	char type; /* type tag and zero terminator for shrstr */
 };
 
+#define JSV_SHRSTRMAX soffsetof(js_Value, type)
+#define JSV_INITUNDEFINED { {0}, {0}, JS_TUNDEFINED }
+
+#define JSV_TYPE(v) ((enum js_Type)(v).type)
+#define JSV_BOOLEAN(v) ((v).u.boolean)
+#define JSV_NUMBER(v) ((v).u.number)
+#define JSV_INTEGER(v) ((v).u.integer)
+#define JSV_SHRSTR(v) ((v).u.shrstr)
+#define JSV_LITSTR(v) ((v).u.litstr)
+#define JSV_MEMSTR(v) ((v).u.memstr)
+#define JSV_OBJECT(v) ((v).u.object)
+
+#define JSV_SETUNDEFINED(v) ((v).type = JS_TUNDEFINED)
+#define JSV_SETNULL(v) ((v).type = JS_TNULL)
+#define JSV_SETHOLE(v) ((v).type = JS_THOLE)
+#define JSV_SETBOOLEAN(v, x) ((v).type = JS_TBOOLEAN, (v).u.boolean = !!(x))
+#define JSV_SETNUMBER(v, x) ((v).type = JS_TNUMBER, (v).u.number = (x))
+#define JSV_SETINTEGER(v, x) ((v).type = JS_TINTEGER, (v).u.integer = (x))
+#define JSV_SETSHRSTR(v, s, n) (memcpy(&(v), (s), (n)), ((char *)&(v))[n] = 0, (v).type = JS_TSHRSTR)
+#define JSV_SETLITSTR(v, x) ((v).type = JS_TLITSTR, (v).u.litstr = (x))
+#define JSV_SETMEMSTR(v, x) ((v).type = JS_TMEMSTR, (v).u.memstr = (x))
+#define JSV_SETOBJECT(v, x) ((v).type = JS_TOBJECT, (v).u.object = (x))
+
+#endif
+
+#define JSV_ISNUMBER(v) (JSV_TYPE(v) == JS_TNUMBER || JSV_TYPE(v) == JS_TINTEGER)
+#define JSV_ASNUMBER(v) (JSV_TYPE(v) == JS_TINTEGER ? (double)JSV_INTEGER(v) : JSV_NUMBER(v))
+
 struct js_String
 {
 	js_String *gcnext;
 	char gcmark;
+	unsigned char size; /* bytes allocated, when short enough to come from a slab */
 	char p[1];
 };
 
@@ -77,12 +169,33 @@ struct js_Regexp
 	unsigned short last;
 };
 
+/*
+	Objects start out in shape mode: their properties live in a flat slot
+	array, and objects that had the same properties added in the same order
+	share a js_Shape. Objects that delete properties, grow too large, or
+	run out of shapes switch to dictionary mode, where the properties are
+	kept in an AA-tree.
+
+	Arrays and arguments objects start out dense: their array index
+	properties live in a js_Value vector where JS_THOLE marks missing
+	elements. They become sparse, and keep index properties by name like
+	other objects, when a write leaves too large a gap, when an element
+	needs attributes, or when the names are asked for by reflection.
+*/
+
 struct js_Object
 {
 	enum js_Class type;
 	int extensible;
-	js_Property *properties;
+	int watched; /* inline caches depend on the property table */
+	js_Shape *shape; /* NULL in dictionary mode */
+	js_Property *slots; /* shape mode property storage */
+	js_PropertyNode *properties; /* dictionary mode property tree */
 	int count; /* number of properties, for array sparseness check */
+	int slotcap;
+	int dense; /* array index properties live in elements */
+	js_Value *elements;
+	int elemlen, elemcap;
 	js_Object *prototype;
 	union {
 		int boolean;
@@ -125,14 +238,48 @@ struct js_Object
 struct js_Property
 {
 	const char *name;
-	js_Property *left, *right;
-	int level;
 	int atts;
 	js_Value value;
 	js_Object *getter;
 	js_Object *setter;
 };
 
+struct js_PropertyNode
+{
+	js_Property prop;
+	js_PropertyNode *left, *right;
+	int level;
+};
+
+struct js_Shape
+{
+	js_Shape *parent;
+	js_Shape *kids, *sibling; /* transitions to shapes with one more property */
+	const char *name; /* property added by the transition to this shape */
+	int count; /* number of properties */
+};
+
+/*
+	Inline cache entry of a property access instruction. Own properties of
+	shaped objects are remembered by slot index, which is valid as long as
+	the shape matches. All other results (found on a prototype, found in a
+	dictionary, or not found at all) are valid while J->propversion is
+	unchanged.
+*/
+
+struct js_PropCache
+{
+	enum js_Class type; /* receiver class */
+	js_Shape *shape; /* receiver shape, or NULL in dictionary mode */
+	js_Object *obj; /* receiver prototype, or the receiver in dictionary mode */
+	js_Environment *scope; /* scope chain of a variable lookup */
+	js_Object *holder; /* object that has the property */
+	js_Property *ref; /* the property, or NULL if not found */
+	js_Shape *next; /* shape after adding the property, for stores */
+	unsigned int version;
+	int slot; /* own property slot index, or -1 */
+};
+
 struct js_Iterator
 {
 	const char *name;
@@ -150,11 +297,11 @@ void js_pushobject(js_State *J, js_Object *v);
 
 /* jsvalue.c */
 int jsV_toboolean(js_State *J, js_Value *v);
-double jsV_tonumber(js_State *J, js_Value *v);
-double jsV_tointeger(js_State *J, js_Value *v);
-const char *jsV_tostring(js_State *J, js_Value *v);
+double jsV_tonumber(js_State *J, int idx);
+double jsV_tointeger(js_State *J, int idx);
+const char *jsV_tostring(js_State *J, int idx);
 js_Object *jsV_toobject(js_State *J, js_Value *v);
-void jsV_toprimitive(js_State *J, js_Value *v, int preferred);
+void jsV_toprimitive(js_State *J, int idx, int preferred);
 
 const char *js_itoa(char buf[32], int a);
 double js_stringtofloat(const char *s, char **ep);
@@ -173,6 +320,18 @@ js_Property *jsV_getpropertyx(js_State *J, js_Object *obj, const char *name, int
 js_Property *jsV_getproperty(js_State *J, js_Object *obj, const char *name);
 js_Property *jsV_setproperty(js_State *J, js_Object *obj, const char *name);
 js_Property *jsV_nextproperty(js_State *J, js_Object *obj, const char *name);
+js_Property *jsV_addproperty(js_State *J, js_Object *obj, js_Shape *shape);
+
+int jsV_isindex(const char *name, int *k);
+js_Value *jsV_getelement(js_Object *obj, int k);
+int jsV_setelement(js_State *J, js_Object *obj, int k, js_Value *value);
+void jsV_delelement(js_State *J, js_Object *obj, int k);
+void jsV_tosparse(js_State *J, js_Object *obj);
+
+js_PropCache *jsV_probecache(js_State *J, js_PropCache *cache, js_Object *obj);
+js_PropCache *jsV_fillcache(js_State *J, js_PropCache *cache, js_Object *obj, const char *name, int store);
+js_PropCache *jsV_probevarcache(js_State *J, js_PropCache *cache, js_Environment *E);
+js_PropCache *jsV_fillvarcache(js_State *J, js_PropCache *cache, js_Environment *E, js_Environment *key, const char *name);
 void jsV_delproperty(js_State *J, js_Object *obj, const char *name);
 
 js_Object *jsV_newiterator(js_State *J, js_Object *obj, int own);
@@ -180,6 +339,22 @@ const char *jsV_nextiterator(js_State *J, js_Object *iter);
 
 void jsV_resizearray(js_State *J, js_Object *obj, int newlen);
 
+/* jsgc.c */
+
+/*
+	Write barrier. Collections of the young generation do not look inside
+	old objects, so an old object that is given a young value is remembered
+	and scanned again by the next one.
+*/
+#define JSG_ISYOUNG(J, v) \
+	(JSV_TYPE(v) == JS_TOBJECT ? JSV_OBJECT(v)->gcmark != (J)->gcmark : \
+	JSV_TYPE(v) == JS_TMEMSTR && JSV_MEMSTR(v)->gcmark != (J)->gcmark)
+#define JSG_BARRIER(J, obj, v) \
+	((obj)->gcmark == (J)->gcmark && JSG_ISYOUNG(J, v) ? jsG_remember(J, obj) : (void)0)
+
+void jsG_gc(js_State *J, int report);
+void jsG_remember(js_State *J, js_Object *obj);
+
 /* jsdump.c */
 void js_dumpobject(js_State *J, js_Object *obj);
 void js_dumpvalue(js_State *J, js_Value v);
@@ -278,6 +278,7 @@ static void usage(void)
 	fprintf(stderr, "Usage: mujs [options] [script [scriptArgs*]]\n");
 	fprintf(stderr, "\t-i: Enter interactive prompt after running code.\n");
 	fprintf(stderr, "\t-s: Check strictness.\n");
+	fprintf(stderr, "\t-t n: Mark full garbage collections with n threads.\n");
 	exit(1);
 }
 
@@ -289,17 +290,20 @@ main(int argc, char **argv)
 	int status = 0;
 	int strict = 0;
 	int interactive = 0;
+	int gcthreads = 1;
 	int i, c;
 
-	while ((c = xgetopt(argc, argv, "is")) != -1) {
+	while ((c = xgetopt(argc, argv, "ist:")) != -1) {
 		switch (c) {
 		default: usage(); break;
 		case 'i': interactive = 1; break;
 		case 's': strict = 1; break;
+		case 't': gcthreads = atoi(xoptarg); break;
 		}
 	}
 
 	J = js_newstate(NULL, NULL, strict ? JS_STRICT : 0);
+	js_setgcthreads(J, gcthreads);
 
 	js_newcfunction(J, jsB_gc, "gc", 0);
 	js_setglobal(J, "gc");
@@ -49,6 +49,9 @@ void js_setreport(js_State *J, js_Report report);
 js_Panic js_atpanic(js_State *J, js_Panic panic);
 void js_freestate(js_State *J);
 void js_gc(js_State *J, int report);
+void js_setgcbudget(js_State *J, int microseconds);
+void js_setgcthreads(js_State *J, int n);
+void js_setlimits(js_State *J, int stacksize, int stacklimit, int calldepth, int trydepth);
 
 int js_dostring(js_State *J, const char *source);
 int js_dofile(js_State *J, const char *filename);
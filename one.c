@@ -9,6 +9,7 @@
 #include "jsfunction.c"
 #include "jsgc.c"
 #include "jsintern.c"
+#include "jsjit.c"
 #include "jslex.c"
 #include "jsmath.c"
 #include "jsnumber.c"
@@ -19,6 +20,7 @@
 #include "jsregexp.c"
 #include "jsrepr.c"
 #include "jsrun.c"
+#include "jsslab.c"
 #include "jsstate.c"
 #include "jsstring.c"
 #include "jsvalue.c"
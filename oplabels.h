@@ -0,0 +1,118 @@
+&&L_OP_POP,
+&&L_OP_DUP,
+&&L_OP_DUP2,
+&&L_OP_ROT2,
+&&L_OP_ROT3,
+&&L_OP_ROT4,
+&&L_OP_INTEGER,
+&&L_OP_NUMBER,
+&&L_OP_STRING,
+&&L_OP_CLOSURE,
+&&L_OP_NEWARRAY,
+&&L_OP_NEWOBJECT,
+&&L_OP_NEWREGEXP,
+&&L_OP_UNDEF,
+&&L_OP_NULL,
+&&L_OP_TRUE,
+&&L_OP_FALSE,
+&&L_OP_THIS,
+&&L_OP_CURRENT,
+&&L_OP_GETLOCAL,
+&&L_OP_SETLOCAL,
+&&L_OP_DELLOCAL,
+&&L_OP_HASVAR,
+&&L_OP_GETVAR,
+&&L_OP_SETVAR,
+&&L_OP_DELVAR,
+&&L_OP_IN,
+&&L_OP_INITPROP,
+&&L_OP_INITGETTER,
+&&L_OP_INITSETTER,
+&&L_OP_GETPROP,
+&&L_OP_GETPROP_S,
+&&L_OP_SETPROP,
+&&L_OP_SETPROP_S,
+&&L_OP_DELPROP,
+&&L_OP_DELPROP_S,
+&&L_OP_ITERATOR,
+&&L_OP_NEXTITER,
+&&L_OP_EVAL,
+&&L_OP_CALL,
+&&L_OP_NEW,
+&&L_OP_TYPEOF,
+&&L_OP_POS,
+&&L_OP_NEG,
+&&L_OP_BITNOT,
+&&L_OP_LOGNOT,
+&&L_OP_INC,
+&&L_OP_DEC,
+&&L_OP_POSTINC,
+&&L_OP_POSTDEC,
+&&L_OP_MUL,
+&&L_OP_DIV,
+&&L_OP_MOD,
+&&L_OP_ADD,
+&&L_OP_SUB,
+&&L_OP_SHL,
+&&L_OP_SHR,
+&&L_OP_USHR,
+&&L_OP_LT,
+&&L_OP_GT,
+&&L_OP_LE,
+&&L_OP_GE,
+&&L_OP_EQ,
+&&L_OP_NE,
+&&L_OP_STRICTEQ,
+&&L_OP_STRICTNE,
+&&L_OP_JCASE,
+&&L_OP_BITAND,
+&&L_OP_BITXOR,
+&&L_OP_BITOR,
+&&L_OP_INSTANCEOF,
+&&L_OP_THROW,
+&&L_OP_TRY,
+&&L_OP_ENDTRY,
+&&L_OP_CATCH,
+&&L_OP_ENDCATCH,
+&&L_OP_WITH,
+&&L_OP_ENDWITH,
+&&L_OP_DEBUGGER,
+&&L_OP_JUMP,
+&&L_OP_JTRUE,
+&&L_OP_JFALSE,
+&&L_OP_RETURN,
+&&L_OP_GETLOCAL_GETPROP_S,
+&&L_OP_SETLOCAL_POP,
+&&L_OP_INC_LOCAL,
+&&L_OP_DEC_LOCAL,
+&&L_OP_ADD_INTEGER,
+&&L_OP_LT_JFALSE,
+&&L_OP_GT_JFALSE,
+&&L_OP_LE_JFALSE,
+&&L_OP_GE_JFALSE,
+&&L_OP_GETUPVAL,
+&&L_OP_SETUPVAL,
+&&L_OP_GETGLOBAL,
+&&L_OP_SETGLOBAL,
+&&L_OP_ARGUMENTS,
+&&L_OP_GETARG,
+&&L_OP_ARGLEN,
+&&L_OP_ADD_NUM,
+&&L_OP_ADD_STR,
+&&L_OP_LT_NUM,
+&&L_OP_GT_NUM,
+&&L_OP_LE_NUM,
+&&L_OP_GE_NUM,
+&&L_OP_EQ_NUM,
+&&L_OP_NE_NUM,
+&&L_OP_EQ_STR,
+&&L_OP_NE_STR,
+&&L_OP_STRICTEQ_NUM,
+&&L_OP_STRICTNE_NUM,
+&&L_OP_STRICTEQ_STR,
+&&L_OP_STRICTNE_STR,
+&&L_OP_LT_JFALSE_NUM,
+&&L_OP_GT_JFALSE_NUM,
+&&L_OP_LE_JFALSE_NUM,
+&&L_OP_GE_JFALSE_NUM,
+&&L_OP_SWITCH,
@@ -81,3 +81,38 @@
 "jtrue",
 "jfalse",
 "return",
+"getlocal_getprop_s",
+"setlocal_pop",
+"inc_local",
+"dec_local",
+"add_integer",
+"lt_jfalse",
+"gt_jfalse",
+"le_jfalse",
+"ge_jfalse",
+"getupval",
+"setupval",
+"getglobal",
+"setglobal",
+"arguments",
+"getarg",
+"arglen",
+"add_num",
+"add_str",
+"lt_num",
+"gt_num",
+"le_num",
+"ge_num",
+"eq_num",
+"ne_num",
+"eq_str",
+"ne_str",
+"stricteq_num",
+"strictne_num",
+"stricteq_str",
+"strictne_str",
+"lt_jfalse_num",
+"gt_jfalse_num",
+"le_jfalse_num",
+"ge_jfalse_num",
+"switch",
@@ -85,7 +85,7 @@ int
 main(int argc, char **argv)
 {
 	js_State *J;
-	int minify = 0;
+	volatile int minify = 0;
 	int i;
 
 	J = js_newstate(NULL, NULL, 0);
@@ -0,0 +1,32 @@
+// Increment and decrement of local variables that do not hold numbers.
+
+function check(name, got, want) {
+	if (got !== want && !(got !== got && want !== want))
+		throw new Error(name + ": got " + got + ", expected " + want);
+}
+
+function inc(x) { x++; return x; }
+function preinc(x) { ++x; return x; }
+function dec(x) { x--; return x; }
+function predec(x) { --x; return x; }
+
+check("undefined++", inc(undefined), NaN);
+check("null++", inc(null), 1);
+check("true++", inc(true), 2);
+check("false--", dec(false), -1);
+check("'41'++", inc("41"), 42);
+check("++'41'", preinc("41"), 42);
+check("'x'--", dec("x"), NaN);
+check("--'10'", predec("10"), 9);
+check("2147483647++", inc(2147483647), 2147483648);
+check("-2147483648--", dec(-2147483648), -2147483649);
+check("1.5++", inc(1.5), 2.5);
+
+var calls = 0;
+check("{valueOf}++", inc({ valueOf: function () { ++calls; return 5; } }), 6);
+check("--{valueOf}", predec({ valueOf: function () { ++calls; return 5; } }), 4);
+check("valueOf calls", calls, 2);
+
+// valueOf may grow the stack while the local is being updated
+function deep(n) { return n > 0 ? deep(n - 1) + 1 : 0; }
+check("{deep valueOf}++", inc({ valueOf: function () { return deep(500); } }), 501);
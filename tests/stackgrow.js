@@ -0,0 +1,49 @@
+// Conversions whose callbacks make the value stack grow into a new block.
+
+function check(name, got, want) {
+	if (got !== want)
+		throw new Error(name + ": got " + got + ", expected " + want);
+}
+
+// push more values than ever before, so that each call moves the stack
+var size = 128;
+function grow() {
+	size *= 2;
+	Math.max.apply(null, new Array(size));
+}
+
+var calls = 0;
+function counted(v) {
+	return { valueOf: function () { ++calls; grow(); return v; } };
+}
+
+calls = 0;
+check("o + 1", counted(5) + 1, 6);
+check("o + 1 calls", calls, 1);
+
+calls = 0;
+check("o < 6", counted(5) < 6, true);
+check("o == 5", counted(5) == 5, true);
+check("comparison calls", calls, 2);
+
+function inc(x) { x++; return x; }
+calls = 0;
+check("x++", inc(counted(41)), 42);
+check("x++ calls", calls, 1);
+
+var a = [1, 2, 3, 4];
+a.length = counted(2);
+check("array length", a.length, 2);
+
+var s = { toString: function () { grow(); return "key"; } };
+var t = {};
+t[s] = "value";
+check("property key", t.key, "value");
+
+check("String(o)", String({ toString: function () { grow(); return "str"; } }), "str");
+
+check("setter", (function () {
+	var box = { set x(v) { grow(); this.y = v; } };
+	box.x = "set";
+	return box.y;
+})(), "set");
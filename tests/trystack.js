@@ -0,0 +1,18 @@
+// An error raised after a try block has ended is not caught by its handler.
+
+function f() { return 0; }
+
+// f is a parameter, so nothing between the try and the pushes of the call saves the pc
+function r(n, f, lim) {
+	try { f(); } catch (e) { throw new Error("caught by an ended try at depth " + n + ": " + e); }
+	if (n >= lim) return 0;
+	return f(1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, r(n + 1, f, lim));
+}
+
+for (var i = 0; i < 2000; ++i)
+	r(0, f, 1);
+
+var error;
+try { r(0, f, Infinity); } catch (e) { error = e; }
+if (error !== "stack overflow")
+	throw error;